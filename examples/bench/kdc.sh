@@ -0,0 +1,123 @@
+#!/bin/sh
+#
+# Stand up (or tear down) a throwaway MIT Kerberos KDC for the example
+# benchmarks.
+#
+#   kdc.sh start <dir>   create the realm, keytab and ticket cache under <dir>
+#   kdc.sh stop <dir>    stop the KDC and remove <dir>
+#
+# start writes <dir>/bench.env, which exports the environment the C, Go
+# and Java examples need, and <dir>/jaas.conf for the Java peers.
+
+set -e
+
+REALM=${BENCH_REALM:-BENCH.TEST}
+KDC_PORT=${BENCH_KDC_PORT:-18888}
+CLIENT=bench
+SERVICE=host/localhost
+PASSWORD=bench-password
+
+usage() {
+	echo "Usage: $0 start|stop <dir>" >&2
+	exit 1
+}
+
+[ $# -eq 2 ] || usage
+DIR=$2
+
+start() {
+	rm -rf "$DIR"
+	mkdir -p "$DIR"
+	DIR=$(cd "$DIR" && pwd)
+
+	cat > "$DIR/krb5.conf" <<EOF
+[libdefaults]
+	default_realm = $REALM
+	dns_lookup_kdc = false
+	dns_lookup_realm = false
+	dns_canonicalize_hostname = false
+	rdns = false
+	udp_preference_limit = 1
+	default_tkt_enctypes = aes256-cts-hmac-sha1-96 aes128-cts-hmac-sha1-96
+	default_tgs_enctypes = aes256-cts-hmac-sha1-96 aes128-cts-hmac-sha1-96
+	permitted_enctypes = aes256-cts-hmac-sha1-96 aes128-cts-hmac-sha1-96
+
+[realms]
+	$REALM = {
+		kdc = 127.0.0.1:$KDC_PORT
+	}
+
+[domain_realm]
+	localhost = $REALM
+EOF
+
+	cat > "$DIR/kdc.conf" <<EOF
+[kdcdefaults]
+	kdc_ports = $KDC_PORT
+	kdc_tcp_ports = $KDC_PORT
+
+[realms]
+	$REALM = {
+		database_name = $DIR/principal
+		key_stash_file = $DIR/stash
+		acl_file = $DIR/kadm5.acl
+		supported_enctypes = aes256-cts-hmac-sha1-96:normal aes128-cts-hmac-sha1-96:normal
+	}
+
+[logging]
+	kdc = FILE:$DIR/kdc.log
+EOF
+
+	cat > "$DIR/jaas.conf" <<EOF
+com.sun.security.jgss.initiate {
+  com.sun.security.auth.module.Krb5LoginModule required
+    useTicketCache=true
+    ticketCache="$DIR/ccache"
+    useKeyTab=false
+    isInitiator=true;
+};
+
+com.sun.security.jgss.accept {
+  com.sun.security.auth.module.Krb5LoginModule required
+    useKeyTab=true
+    keyTab="$DIR/server.keytab"
+    principal="$SERVICE@$REALM"
+    storeKey=true
+    isInitiator=false;
+};
+EOF
+
+	: > "$DIR/kadm5.acl"
+
+	export KRB5_CONFIG="$DIR/krb5.conf"
+	export KRB5_KDC_PROFILE="$DIR/kdc.conf"
+
+	kdb5_util create -s -r "$REALM" -P bench-master-key > /dev/null
+	kadmin.local -r "$REALM" -q "addprinc -pw $PASSWORD $CLIENT" > /dev/null
+	kadmin.local -r "$REALM" -q "addprinc -randkey $SERVICE" > /dev/null
+	kadmin.local -r "$REALM" -q "ktadd -k $DIR/server.keytab $SERVICE" > /dev/null
+
+	krb5kdc -r "$REALM" -P "$DIR/kdc.pid"
+
+	echo "$PASSWORD" | kinit -c "FILE:$DIR/ccache" "$CLIENT@$REALM" > /dev/null
+
+	cat > "$DIR/bench.env" <<EOF
+export KRB5_CONFIG="$DIR/krb5.conf"
+export KRB5CCNAME="FILE:$DIR/ccache"
+export KRB5_KTNAME="FILE:$DIR/server.keytab"
+export BENCH_JAAS_CONF="$DIR/jaas.conf"
+EOF
+}
+
+stop() {
+	if [ -f "$DIR/kdc.pid" ]; then
+		kill "$(cat "$DIR/kdc.pid")" 2> /dev/null || true
+	fi
+	rm -rf "$DIR"
+}
+
+case "$1" in
+	start) start ;;
+	stop) stop ;;
+	*) usage ;;
+esac
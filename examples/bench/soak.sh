@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Soak one of the example servers with gss-soak.  The server is started
+# here, so that its process can be sampled, and stopped afterwards.
+#
+#   soak.sh c|go [gss-soak arguments]
+#
+# Expects the environment written by kdc.sh.  The server's own output goes
+# to soak-server.log next to the realm's krb5.conf.
+
+set -e
+
+PORT=${SOAK_PORT:-12350}
+DEBUG_ADDR=127.0.0.1:$((PORT + 1))
+EXAMPLES=$(cd "$(dirname "$0")/.." && pwd)
+LOG=$(dirname "$KRB5_CONFIG")/soak-server.log
+
+[ $# -ge 1 ] || { echo "Usage: $0 c|go [gss-soak arguments]" >&2; exit 1; }
+IMPL=$1
+shift
+
+case $IMPL in
+c)
+	"$EXAMPLES/c/gss-server-c" -port "$PORT" host@localhost > "$LOG" 2>&1 &
+	EXTRA=
+	;;
+go)
+	"$EXAMPLES/go/gss-server-go" -port "$PORT" -debug-addr "$DEBUG_ADDR" > "$LOG" 2>&1 &
+	EXTRA="-debug-addr $DEBUG_ADDR"
+	;;
+*)
+	echo "unknown server $IMPL, expected c or go" >&2
+	exit 1
+	;;
+esac
+
+PID=$!
+trap 'kill $PID 2>/dev/null' EXIT
+
+# give the server time to acquire its credentials and listen
+sleep 1
+
+"$EXAMPLES/go/gss-soak-go" -port "$PORT" -pid "$PID" $EXTRA "$@"
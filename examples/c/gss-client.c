@@ -30,22 +30,54 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include <gssapi/gssapi.h>
 #include "gss-misc.h"
+#include "gss-probes.h"
+#include "gss-fanout.h"
 
 void usage()
 {
-     fprintf(stderr, "Usage: gss-client [-port port] [-d] [-seal] [-mutual] host service \
-msg\n");
+     fprintf(stderr, "Usage: gss-client [-port port] [-d] [-seal] [-mutual] [-count n] [-fastopen] \
+host service msg\n");
+     fprintf(stderr, "       gss-client [-port port] [-d] [-seal] [-mutual] [-f]\n");
+     fprintf(stderr, "                  -hosts file [-parallel n] [-timeout secs] service msg\n");
      exit(1);
 }
 
+/* progress messages, turned off when timing repeated contexts */
+int verbose = 1;
+
+/* carry the first context token in the SYN, set by -fastopen */
+int fast_open = 0;
+
+int client_init_context(int s, gss_cred_id_t cred, gss_name_t target_name,
+                        OM_uint32 req_flags, gss_OID oid,
+                        gss_ctx_id_t *gss_context, OM_uint32 *ret_flags);
+
+static void set_fast_open(int s)
+{
+#ifdef TCP_FASTOPEN_CONNECT
+     int on = 1;
+
+     if (setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                    (char *) &on, sizeof(on)) < 0) {
+          perror("setting TCP_FASTOPEN_CONNECT");
+          fast_open = 0;
+     }
+#else
+     fprintf(stderr, "TCP Fast Open is not supported on this system\n");
+     fast_open = 0;
+#endif
+}
+
 /*
  * Function: connect_to_server
  *
@@ -60,36 +92,55 @@ msg\n");
  *
  * Effects:
  *
- * The host name is resolved with gethostbyname(), and the socket is
- * opened and connected.  If an error occurs, an error message is
- * displayed and -1 is returned.
+ * The host name is resolved with getaddrinfo(), and each address is
+ * tried in turn until a socket is connected.  If an error occurs, an
+ * error message is displayed and -1 is returned.
+ *
+ * If fast_open is set the socket is opened with TCP_FASTOPEN_CONNECT,
+ * which defers the SYN until the first write.  Once the kernel holds a
+ * Fast Open cookie for the server, that first write - the initial
+ * context token - goes out with the SYN, saving a round trip on every
+ * new connection.  Without a cookie, or if the server does not support
+ * Fast Open, the connection falls back to an ordinary handshake.  The
+ * client side must be enabled in net.ipv4.tcp_fastopen (bit 1, the
+ * default on Linux).  Since connect() then succeeds without contacting
+ * the server, only the first address is ever tried; gss-server listens
+ * on both IPv6 and IPv4 so that this is enough for it.
  */
 int connect_to_server(host, port)
      char *host;
      u_short port;
 {
-     struct sockaddr_in saddr;
-     struct hostent *hp;
-     int s;
+     struct addrinfo hints, *res, *ai;
+     char service[16];
+     int s = -1, err;
      
-     if ((hp = gethostbyname(host)) == NULL) {
-          fprintf(stderr, "Unknown host: %s\n", host);
-          return -1;
-     }
-     
-     saddr.sin_family = hp->h_addrtype;
-     memcpy((char *)&saddr.sin_addr, hp->h_addr, sizeof(saddr.sin_addr));
-     saddr.sin_port = htons(port);
+     memset(&hints, 0, sizeof(hints));
+     hints.ai_family = AF_UNSPEC;
+     hints.ai_socktype = SOCK_STREAM;
+     sprintf(service, "%u", port);
 
-     if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-          perror("creating socket");
+     if ((err = getaddrinfo(host, service, &hints, &res)) != 0) {
+          fprintf(stderr, "Unknown host: %s: %s\n", host, gai_strerror(err));
           return -1;
      }
-     if (connect(s, (struct sockaddr *)&saddr, sizeof(saddr)) < 0) {
+
+     for (ai = res; ai != NULL; ai = ai->ai_next) {
+          if ((s = socket(ai->ai_family, ai->ai_socktype,
+                          ai->ai_protocol)) < 0) {
+               perror("creating socket");
+               continue;
+          }
+          if (fast_open)
+               set_fast_open(s);
+          if (connect(s, ai->ai_addr, ai->ai_addrlen) == 0)
+               break;
           perror("connecting to server");
           (void) close(s);
-          return -1;
+          s = -1;
      }
+     freeaddrinfo(res);
+
      return s;
 }
 
@@ -129,23 +180,71 @@ int client_establish_context(s, service_name, req_flags,  oid,
      gss_ctx_id_t *gss_context;
      OM_uint32 *ret_flags;
 {
-     gss_buffer_desc send_tok, recv_tok, *token_ptr;
+     gss_buffer_desc name_buf;
      gss_name_t target_name;
-     OM_uint32 maj_stat, min_stat, init_sec_min_stat;
+     OM_uint32 maj_stat, min_stat;
+     int ret;
 
      /*
-      * Import the name into target_name.  Use send_tok to save
-      * local variable space.
+      * Import the name into target_name.
       */
-     send_tok.value = service_name;
-     send_tok.length = strlen(service_name) + 1;
-     maj_stat = gss_import_name(&min_stat, &send_tok,
+     name_buf.value = service_name;
+     name_buf.length = strlen(service_name) + 1;
+     maj_stat = gss_import_name(&min_stat, &name_buf,
          (gss_OID) GSS_C_NT_HOSTBASED_SERVICE, &target_name);
      if (maj_stat != GSS_S_COMPLETE) {
           display_status("parsing name", maj_stat, min_stat);
           return -1;
      }
-     
+
+     if (verbose) {
+          fprintf(stderr, "req_flags: %d\n", req_flags);
+          fprintf(stderr, "service_name: %s\n", service_name);
+     }
+
+     ret = client_init_context(s, GSS_C_NO_CREDENTIAL, target_name,
+                               req_flags, oid, gss_context, ret_flags);
+
+     (void) gss_release_name(&min_stat, &target_name);
+     return ret;
+}
+
+/*
+ * Function: client_init_context
+ *
+ * Purpose: establishes a GSS-API context with an imported target name
+ *
+ * Arguments:
+ *
+ *      s               (r) an established TCP connection to the service
+ *      cred            (r) the initiator credentials, or
+ *                      GSS_C_NO_CREDENTIAL for the default ones
+ *      target_name     (r) the imported name of the service
+ *      req_flags       (r) the requested context flags
+ *      oid             (r) the mechanism, or GSS_C_NULL_OID
+ *      gss_context     (w) the established GSS-API context
+ *      ret_flags       (w) the returned flags from init_sec_context
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * As client_establish_context, except that the name is not imported
+ * and the credentials are not resolved again for each context.
+ */
+int client_init_context(s, cred, target_name, req_flags, oid, gss_context,
+                        ret_flags)
+     int s;
+     gss_cred_id_t cred;
+     gss_name_t target_name;
+     OM_uint32 req_flags;
+     gss_OID oid;
+     gss_ctx_id_t *gss_context;
+     OM_uint32 *ret_flags;
+{
+     gss_buffer_desc send_tok, recv_tok, *token_ptr;
+     OM_uint32 maj_stat, min_stat, init_sec_min_stat;
+
      /*
       * Perform the context-establishement loop.
       *
@@ -162,15 +261,14 @@ int client_establish_context(s, service_name, req_flags,  oid,
       * and only if the server has another token to send us.
       */
      
-     fprintf(stderr, "req_flags: %d\n", req_flags);
-     fprintf(stderr, "service_name: %s\n", service_name);
      token_ptr = GSS_C_NO_BUFFER;
      *gss_context = GSS_C_NO_CONTEXT;
 
      do {
+          GSS_PROBE1(init_start, token_ptr ? token_ptr->length : 0);
           maj_stat =
                gss_init_sec_context(&init_sec_min_stat,
-                                    GSS_C_NO_CREDENTIAL,
+                                    cred,
                                     gss_context,
                                     target_name,
                                     oid,
@@ -182,16 +280,20 @@ int client_establish_context(s, service_name, req_flags,  oid,
                                     &send_tok,
                                     ret_flags,
                                     NULL);      /* ignore time_rec */
+          GSS_PROBE3(init_done, send_tok.length, maj_stat, init_sec_min_stat);
 
           if (token_ptr != GSS_C_NO_BUFFER)
                (void) gss_release_buffer(&min_stat, &recv_tok);
 
           if (send_tok.length != 0) {
-               printf("Sending init_sec_context token (size=%ld)...",
-                     send_tok.length);
+               if (verbose)
+                    printf("Sending init_sec_context token (size=%ld)...",
+                           send_tok.length);
                if (send_token(s, &send_tok) < 0) {
                     (void) gss_release_buffer(&min_stat, &send_tok);
-                    (void) gss_release_name(&min_stat, &target_name);
+                    if (*gss_context != GSS_C_NO_CONTEXT)
+                         (void) gss_delete_sec_context(&min_stat, gss_context,
+                                                       GSS_C_NO_BUFFER);
                     return -1;
                }
           }
@@ -200,25 +302,26 @@ int client_establish_context(s, service_name, req_flags,  oid,
           if (maj_stat!=GSS_S_COMPLETE && maj_stat!=GSS_S_CONTINUE_NEEDED) {
                display_status("initializing context", maj_stat,
                               init_sec_min_stat);
-               (void) gss_release_name(&min_stat, &target_name);
-               if (*gss_context == GSS_C_NO_CONTEXT)
+               if (*gss_context != GSS_C_NO_CONTEXT)
                        gss_delete_sec_context(&min_stat, gss_context,
                                               GSS_C_NO_BUFFER);
                return -1;
           }
           
           if (maj_stat == GSS_S_CONTINUE_NEEDED) {
-               printf("continue needed...");
+               if (verbose)
+                    printf("continue needed...");
                if (recv_token(s, &recv_tok) < 0) {
-                    (void) gss_release_name(&min_stat, &target_name);
+                    (void) gss_delete_sec_context(&min_stat, gss_context,
+                                                  GSS_C_NO_BUFFER);
                     return -1;
                }
                token_ptr = &recv_tok;
           }
-          printf("\n");
+          if (verbose)
+               printf("\n");
      } while (maj_stat == GSS_S_CONTINUE_NEEDED);
 
-     (void) gss_release_name(&min_stat, &target_name);
      return 0;
 }
 
@@ -446,8 +549,10 @@ int call_server(host, port, oid, service_name, req_flag, msg, use_file, seal)
      }
 
      /* Verify signature block */
+     GSS_PROBE2(verify_mic_start, in_buf.length, out_buf.length);
      maj_stat = gss_verify_mic(&min_stat, context, &in_buf,
                                &out_buf, &qop_state);
+     GSS_PROBE2(verify_mic_done, maj_stat, min_stat);
      if (maj_stat != GSS_S_COMPLETE) {
           display_status("verifying signature", maj_stat, min_stat);
           (void) close(s);
@@ -463,6 +568,7 @@ int call_server(host, port, oid, service_name, req_flag, msg, use_file, seal)
 
      /* Delete context */
      maj_stat = gss_delete_sec_context(&min_stat, &context, &out_buf);
+     GSS_PROBE2(delete_context, maj_stat, min_stat);
      if (maj_stat != GSS_S_COMPLETE) {
           display_status("deleting context", maj_stat, min_stat);
           (void) close(s);
@@ -475,6 +581,183 @@ int call_server(host, port, oid, service_name, req_flag, msg, use_file, seal)
      return 0;
 }
 
+static double now_ms()
+{
+     struct timespec ts;
+
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+     double x = *(const double *) a, y = *(const double *) b;
+
+     return x < y ? -1 : x > y;
+}
+
+static void print_times(what, times, n)
+     char *what;
+     double *times;
+     int n;
+{
+     if (n == 0)
+          return;
+
+     qsort(times, n, sizeof(*times), cmp_double);
+     printf("%-10s p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+            what, times[n / 2], times[n * 90 / 100], times[n * 99 / 100],
+            times[n - 1]);
+}
+
+/*
+ * Function: count_server
+ *
+ * Purpose: Calls the "sign" service repeatedly, to time context creation.
+ *
+ * Arguments:
+ *
+ *      host            (r) the host providing the service
+ *      port            (r) the port to connect to on host
+ *      service_name    (r) the GSS-API service name to authenticate to
+ *      msg             (r) the message to have "signed"
+ *      count           (r) the number of contexts to create
+ *
+ * Returns: 0 if every call succeeded, -1 otherwise
+ *
+ * Effects:
+ *
+ * The initiator credentials are acquired, the service name imported
+ * and the message read once, before timing starts.  Then count times a
+ * connection is opened, a context established, a sign request made and
+ * the context deleted, as by call_server but without the diagnostic
+ * inquiries or progress messages.  The rate and the spread of handshake
+ * and whole-call times are printed at the end.
+ */
+int count_server(host, port, oid, service_name, req_flag, msg, use_file,
+                 seal, count)
+     char *host;
+     u_short port;
+     gss_OID oid;
+     char *service_name;
+     OM_uint32 req_flag;
+     char *msg;
+     int use_file;
+     bool seal;
+     int count;
+{
+     gss_cred_id_t cred;
+     gss_name_t target_name;
+     gss_ctx_id_t context;
+     gss_buffer_desc name_buf, in_buf, out_buf;
+     OM_uint32 maj_stat, min_stat, ret_flags;
+     gss_qop_t qop_state;
+     double *handshakes, *calls, start, t;
+     int i, s, state, failed = 0, ok = 0;
+
+     maj_stat = gss_acquire_cred(&min_stat, GSS_C_NO_NAME, GSS_C_INDEFINITE,
+                                 GSS_C_NULL_OID_SET, GSS_C_INITIATE,
+                                 &cred, NULL, NULL);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("acquiring credentials", maj_stat, min_stat);
+          return -1;
+     }
+
+     name_buf.value = service_name;
+     name_buf.length = strlen(service_name) + 1;
+     maj_stat = gss_import_name(&min_stat, &name_buf,
+         (gss_OID) GSS_C_NT_HOSTBASED_SERVICE, &target_name);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("parsing name", maj_stat, min_stat);
+          (void) gss_release_cred(&min_stat, &cred);
+          return -1;
+     }
+
+     if (use_file) {
+         read_file(msg, &in_buf);
+     } else {
+         in_buf.value = msg;
+         in_buf.length = strlen(msg);
+     }
+
+     handshakes = malloc(count * sizeof(*handshakes));
+     calls = malloc(count * sizeof(*calls));
+     if (handshakes == NULL || calls == NULL) {
+          fprintf(stderr, "Couldn't allocate %d timings\n", count);
+          exit(1);
+     }
+
+     verbose = 0;
+     start = now_ms();
+
+     for (i = 0; i < count; i++) {
+          t = now_ms();
+          if ((s = connect_to_server(host, port)) < 0) {
+               failed++;
+               continue;
+          }
+
+          if (client_init_context(s, cred, target_name, req_flag, oid,
+                                  &context, &ret_flags) < 0) {
+               (void) close(s);
+               failed++;
+               continue;
+          }
+          handshakes[ok] = now_ms() - t;
+
+          maj_stat = gss_wrap(&min_stat, context, seal ? 1 : 0,
+                              GSS_C_QOP_DEFAULT, &in_buf, &state, &out_buf);
+          if (maj_stat != GSS_S_COMPLETE) {
+               display_status("sealing message", maj_stat, min_stat);
+               goto fail;
+          }
+          if (send_token(s, &out_buf) < 0) {
+               (void) gss_release_buffer(&min_stat, &out_buf);
+               goto fail;
+          }
+          (void) gss_release_buffer(&min_stat, &out_buf);
+
+          if (recv_token(s, &out_buf) < 0)
+               goto fail;
+          GSS_PROBE2(verify_mic_start, in_buf.length, out_buf.length);
+          maj_stat = gss_verify_mic(&min_stat, context, &in_buf,
+                                    &out_buf, &qop_state);
+          GSS_PROBE2(verify_mic_done, maj_stat, min_stat);
+          (void) gss_release_buffer(&min_stat, &out_buf);
+          if (maj_stat != GSS_S_COMPLETE) {
+               display_status("verifying signature", maj_stat, min_stat);
+               goto fail;
+          }
+
+          maj_stat = gss_delete_sec_context(&min_stat, &context,
+                                            GSS_C_NO_BUFFER);
+          GSS_PROBE2(delete_context, maj_stat, min_stat);
+          (void) close(s);
+          calls[ok++] = now_ms() - t;
+          continue;
+
+     fail:
+          (void) gss_delete_sec_context(&min_stat, &context, GSS_C_NO_BUFFER);
+          (void) close(s);
+          failed++;
+     }
+
+     t = now_ms() - start;
+     printf("%d contexts, %d failed, %.1f ms, %.1f contexts/s\n",
+            count, failed, t, t > 0 ? ok * 1000.0 / t : 0.0);
+     print_times("handshake", handshakes, ok);
+     print_times("call", calls, ok);
+
+     free(handshakes);
+     free(calls);
+     if (use_file)
+         free(in_buf.value);
+     (void) gss_release_name(&min_stat, &target_name);
+     (void) gss_release_cred(&min_stat, &cred);
+
+     return failed ? -1 : 0;
+}
+
 static void parse_oid(char *mechanism, gss_OID *oid)
 {
     char        *mechstr = 0, *cp;
@@ -513,10 +796,19 @@ int main(argc, argv)
      u_short port = 4444;
      int use_file = 0;
      bool seal = false;
+     int count = 0;
      OM_uint32 req_flags = 0, min_stat;
      gss_OID oid = GSS_C_NULL_OID;
+     char *hosts_file = NULL;
+     struct fanout_opts fopts;
+     gss_buffer_desc msg_buf;
+     char **hosts;
+     int nhosts, failed;
      
      display_file = stdout;
+     memset(&fopts, 0, sizeof(fopts));
+     fopts.parallel = 16;
+     fopts.timeout = 10;
 
      /* Parse arguments. */
      argc--; argv++;
@@ -537,10 +829,53 @@ int main(argc, argv)
                seal = true;
           } else if (strcmp(*argv, "-mutual") == 0) {
                req_flags |= GSS_C_MUTUAL_FLAG;
+          } else if (strcmp(*argv, "-count") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               count = atoi(*argv);
+          } else if (strcmp(*argv, "-hosts") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               hosts_file = *argv;
+          } else if (strcmp(*argv, "-parallel") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               fopts.parallel = atoi(*argv);
+          } else if (strcmp(*argv, "-timeout") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               fopts.timeout = atoi(*argv);
+          } else if (strcmp(*argv, "-fastopen") == 0) {
+               fast_open = 1;
           } else 
                break;
           argc--; argv++;
      }
+     if (hosts_file) {
+          if (argc != 2)
+               usage();
+          if (mechanism)
+               parse_oid(mechanism, &oid);
+          if ((hosts = read_hosts(hosts_file, &nhosts)) == NULL)
+               exit(1);
+
+          fopts.port = port;
+          fopts.oid = oid;
+          fopts.service = argv[0];
+          fopts.req_flags = req_flags;
+          fopts.seal = seal;
+          if (use_file) {
+               read_file(argv[1], &msg_buf);
+          } else {
+               msg_buf.value = argv[1];
+               msg_buf.length = strlen(argv[1]);
+          }
+          fopts.msg = &msg_buf;
+
+          failed = fanout(hosts, nhosts, &fopts);
+          exit(failed == 0 ? 0 : 1);
+     }
+
      if (argc != 3)
           usage();
 
@@ -551,8 +886,12 @@ int main(argc, argv)
      if (mechanism)
          parse_oid(mechanism, &oid);
 
-     if (call_server(server_host, port, oid, service_name,
-                     req_flags, msg, use_file, seal) < 0)
+     if (count > 0) {
+          if (count_server(server_host, port, oid, service_name,
+                           req_flags, msg, use_file, seal, count) < 0)
+               exit(1);
+     } else if (call_server(server_host, port, oid, service_name,
+                            req_flags, msg, use_file, seal) < 0)
           exit(1);
 
      if (oid != GSS_C_NULL_OID)
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gssapi/gssapi.h>
+#include "gss-misc.h"
+#include "gss-probes.h"
+#include "gss-conn.h"
+#include "gss-topn.h"
+
+/*
+ * Function: conn_new
+ *
+ * Purpose: allocates the state for a newly accepted connection
+ *
+ * Arguments:
+ *
+ *      fd              (r) the connection to the client
+ *      use_lucid       (r) protect messages using a lucid context
+ *
+ * Returns: the connection, or NULL if out of memory
+ *
+ * Effects:
+ *
+ * The connection holds a reference to the current service credentials
+ * until its context is established.
+ */
+struct conn *conn_new(int fd, int use_lucid)
+{
+     struct conn *c;
+
+     if ((c = calloc(1, sizeof(*c))) == NULL)
+          return NULL;
+
+     c->fd = fd;
+     c->state = CONN_READ_LENGTH;
+     c->phase = CONN_ESTABLISHING;
+     c->use_lucid = use_lucid;
+     c->creds = creds_get();
+     c->context = GSS_C_NO_CONTEXT;
+
+     return c;
+}
+
+/*
+ * Function: conn_free
+ *
+ * Purpose: releases a connection's context and buffers
+ *
+ * Effects:
+ *
+ * The socket is not closed; that is up to the I/O loop.
+ */
+void conn_free(struct conn *c)
+{
+     OM_uint32 maj_stat, min_stat;
+
+     creds_put(c->creds);
+     if (c->lctx)
+          lucid_free(c->lctx);
+     if (c->context != GSS_C_NO_CONTEXT) {
+          maj_stat = gss_delete_sec_context(&min_stat, &c->context, NULL);
+          GSS_PROBE2(delete_context, maj_stat, min_stat);
+     }
+
+     free(c->in.value);
+     if (c->out_malloced)
+          free(c->out.value);
+     else
+          (void) gss_release_buffer(&min_stat, &c->out);
+     free(c->pending);
+     free(c);
+}
+
+/*
+ * Function: conn_keep
+ *
+ * Purpose: saves bytes that arrived after a complete token
+ *
+ * Returns: 0 on success, -1 if out of memory or too much is kept
+ */
+static int conn_keep(struct conn *c, const unsigned char *data, size_t len)
+{
+     unsigned char *p;
+
+     if (len == 0)
+          return 0;
+
+     if (c->npending + len > CONN_MAX_TOKEN) {
+          fprintf(stderr, "Too much input while busy\n");
+          return -1;
+     }
+
+     if ((p = realloc(c->pending, c->npending + len)) == NULL)
+          return -1;
+
+     memcpy(p + c->npending, data, len);
+     c->pending = p;
+     c->npending += len;
+
+     return 0;
+}
+
+/*
+ * Function: conn_feed
+ *
+ * Purpose: frames bytes read from the connection into a token
+ *
+ * Arguments:
+ *
+ *      c               (r/w) the connection
+ *      data            (r) the bytes read
+ *      len             (r) the number of bytes read
+ *
+ * Returns: 1 if a complete token is ready for conn_process, 0 if more
+ * input is needed, or -1 if the client sent a bad length or memory ran
+ * out
+ *
+ * Effects:
+ *
+ * Every byte is consumed.  Bytes beyond the end of the token, or that
+ * arrive while a token is being processed, are kept and fed again by
+ * conn_next once the reply has been sent.
+ */
+int conn_feed(struct conn *c, const unsigned char *data, size_t len)
+{
+     size_t n;
+
+     while (len > 0) {
+          switch (c->state) {
+          case CONN_READ_LENGTH:
+               n = sizeof(c->length) - c->have;
+               if (n > len)
+                    n = len;
+               memcpy(c->length + c->have, data, n);
+               c->have += n;
+               data += n;
+               len -= n;
+
+               if (c->have < sizeof(c->length))
+                    return 0;
+
+               c->in.length = ((size_t) c->length[0] << 24) |
+                    ((size_t) c->length[1] << 16) |
+                    ((size_t) c->length[2] << 8) | c->length[3];
+               if (c->in.length == 0 || c->in.length > CONN_MAX_TOKEN) {
+                    fprintf(stderr, "Bad token length %lu\n",
+                            (unsigned long) c->in.length);
+                    return -1;
+               }
+               if ((c->in.value = malloc(c->in.length)) == NULL)
+                    return -1;
+               c->have = 0;
+               c->state = CONN_READ_BODY;
+               break;
+
+          case CONN_READ_BODY:
+               n = c->in.length - c->have;
+               if (n > len)
+                    n = len;
+               memcpy((unsigned char *) c->in.value + c->have, data, n);
+               c->have += n;
+               data += n;
+               len -= n;
+
+               if (c->have < c->in.length)
+                    return 0;
+
+               c->have = 0;
+               c->state = CONN_PROCESS;
+               GSS_PROBE1(token_recv, c->in.length);
+               return conn_keep(c, data, len) < 0 ? -1 : 1;
+
+          default:
+               return conn_keep(c, data, len);
+          }
+     }
+
+     return 0;
+}
+
+/*
+ * Function: conn_accept
+ *
+ * Purpose: passes a context establishment token to gss_accept_sec_context
+ */
+static void conn_accept(struct conn *c)
+{
+     gss_buffer_desc client_name;
+     gss_name_t client;
+     OM_uint32 maj_stat, min_stat, acc_sec_min_stat;
+     uint64_t start;
+
+     GSS_PROBE1(accept_start, c->in.length);
+     start = topn_cpu_ns();
+     maj_stat = gss_accept_sec_context(&acc_sec_min_stat,
+                                       &c->context,
+                                       c->creds->cred,
+                                       &c->in,
+                                       GSS_C_NO_CHANNEL_BINDINGS,
+                                       &client,
+                                       NULL,
+                                       &c->out,
+                                       &c->ret_flags,
+                                       NULL,    /* ignore time_rec */
+                                       NULL);   /* ignore del_cred_handle */
+     c->cpu_ns += topn_cpu_ns() - start;
+     GSS_PROBE3(accept_done, c->out.length, maj_stat, acc_sec_min_stat);
+
+     if (maj_stat != GSS_S_COMPLETE && maj_stat != GSS_S_CONTINUE_NEEDED) {
+          display_status("accepting context", maj_stat, acc_sec_min_stat);
+          topn_record(NULL, 0, c->fd, c->cpu_ns, 1);
+          /* send any error token, then hang up */
+          c->close_after_write = 1;
+          return;
+     }
+
+     if (maj_stat == GSS_S_CONTINUE_NEEDED)
+          return;
+
+     c->phase = CONN_ESTABLISHED;
+     creds_put(c->creds);
+     c->creds = NULL;
+
+     maj_stat = gss_display_name(&min_stat, client, &client_name, NULL);
+     if (maj_stat == GSS_S_COMPLETE) {
+          printf("Accepted connection: \"%.*s\"\n",
+                 (int) client_name.length, (char *) client_name.value);
+          topn_record(client_name.value, client_name.length, c->fd,
+                      c->cpu_ns, 0);
+          (void) gss_release_buffer(&min_stat, &client_name);
+     }
+     (void) gss_release_name(&min_stat, &client);
+
+     if (c->use_lucid &&
+         lucid_import(&c->context, c->ret_flags, &c->lctx) < 0)
+          c->close_after_write = 1;
+}
+
+/*
+ * Function: conn_sign
+ *
+ * Purpose: unseals a message and produces its signature block
+ */
+static void conn_sign(struct conn *c)
+{
+     gss_buffer_desc msg_buf;
+     OM_uint32 maj_stat, min_stat;
+     int conf_state;
+
+     /* a lucid unwrap is done in place, msg_buf points into c->in */
+     GSS_PROBE1(unwrap_start, c->in.length);
+     if (c->lctx) {
+          min_stat = 0;
+          maj_stat = lucid_unwrap(c->lctx, &c->in, &msg_buf, &conf_state);
+     } else {
+          maj_stat = gss_unwrap(&min_stat, c->context, &c->in, &msg_buf,
+                                &conf_state, (gss_qop_t *) NULL);
+     }
+     GSS_PROBE3(unwrap_done, maj_stat == GSS_S_COMPLETE ? msg_buf.length : 0,
+                maj_stat, min_stat);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("unsealing message", maj_stat, min_stat);
+          c->close_after_write = 1;
+          return;
+     } else if (! conf_state) {
+          fprintf(stderr, "Warning!  Message not encrypted.\n");
+     }
+
+     GSS_PROBE1(get_mic_start, msg_buf.length);
+     if (c->lctx) {
+          if ((c->out.value = malloc(LUCID_MIC_LENGTH)) == NULL) {
+               c->close_after_write = 1;
+               return;
+          }
+          c->out.length = LUCID_MIC_LENGTH;
+          c->out_malloced = 1;
+          maj_stat = lucid_get_mic(c->lctx, &msg_buf, &c->out);
+     } else {
+          maj_stat = gss_get_mic(&min_stat, c->context, GSS_C_QOP_DEFAULT,
+                                 &msg_buf, &c->out);
+          (void) gss_release_buffer(&min_stat, &msg_buf);
+     }
+     GSS_PROBE3(get_mic_done,
+                maj_stat == GSS_S_COMPLETE ? c->out.length : 0,
+                maj_stat, min_stat);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("signing message", maj_stat, min_stat);
+          c->out.length = 0;
+          c->close_after_write = 1;
+     }
+}
+
+/*
+ * Function: conn_process
+ *
+ * Purpose: performs the GSS-API work for a complete token
+ *
+ * Arguments:
+ *
+ *      c               (r/w) a connection in the CONN_PROCESS state
+ *
+ * Effects:
+ *
+ * While the connection is being established the token is passed to
+ * gss_accept_sec_context and any output token becomes the reply.  Once
+ * it is established each token is a sealed message, and the reply is a
+ * signature block for the unsealed message.  Errors are displayed and
+ * mark the connection to be closed once any reply has been sent.
+ *
+ * This is the slow part of serving a connection, and it is safe to call
+ * from any thread as long as only one thread works on the connection at
+ * a time.
+ */
+void conn_process(struct conn *c)
+{
+     if (c->phase == CONN_ESTABLISHING)
+          conn_accept(c);
+     else
+          conn_sign(c);
+
+     free(c->in.value);
+     c->in.value = NULL;
+     c->in.length = 0;
+
+     c->out_length[0] = (c->out.length >> 24) & 0xff;
+     c->out_length[1] = (c->out.length >> 16) & 0xff;
+     c->out_length[2] = (c->out.length >> 8) & 0xff;
+     c->out_length[3] = c->out.length & 0xff;
+     c->out_done = 0;
+     c->state = CONN_WRITE;
+}
+
+/*
+ * Function: conn_out_iov
+ *
+ * Purpose: describes the part of the reply still to be written
+ *
+ * Arguments:
+ *
+ *      c               (r) a connection in the CONN_WRITE state
+ *      iov             (w) the unwritten length prefix and token
+ *
+ * Returns: the number of iovecs filled in, 0 if there is nothing to
+ * write
+ */
+int conn_out_iov(struct conn *c, struct iovec iov[2])
+{
+     size_t hdr = sizeof(c->out_length);
+     int n = 0;
+
+     if (c->out.length == 0)
+          return 0;
+
+     if (c->out_done < hdr) {
+          iov[n].iov_base = c->out_length + c->out_done;
+          iov[n].iov_len = hdr - c->out_done;
+          n++;
+          iov[n].iov_base = c->out.value;
+          iov[n].iov_len = c->out.length;
+          n++;
+     } else {
+          iov[n].iov_base = (unsigned char *) c->out.value +
+               (c->out_done - hdr);
+          iov[n].iov_len = c->out.length - (c->out_done - hdr);
+          n++;
+     }
+
+     return n;
+}
+
+/*
+ * Function: conn_written
+ *
+ * Purpose: records that part of the reply has been written
+ *
+ * Returns: 1 once the whole reply has been written, or if there is no
+ * reply, 0 otherwise
+ */
+int conn_written(struct conn *c, size_t n)
+{
+     c->out_done += n;
+
+     return c->out.length == 0 ||
+          c->out_done >= sizeof(c->out_length) + c->out.length;
+}
+
+/*
+ * Function: conn_next
+ *
+ * Purpose: gets the connection ready for its next token once the reply
+ * has been sent
+ *
+ * Returns: as conn_feed, except that -1 is also returned if the
+ * connection is to be closed
+ *
+ * Effects:
+ *
+ * Any bytes that arrived while the last token was being processed are
+ * fed in, so a token may be ready at once.
+ */
+int conn_next(struct conn *c)
+{
+     OM_uint32 min_stat;
+     unsigned char *pending;
+     size_t npending;
+     int ret;
+
+     if (c->out.length != 0)
+          GSS_PROBE1(token_send, c->out.length);
+
+     if (c->out_malloced)
+          free(c->out.value);
+     else
+          (void) gss_release_buffer(&min_stat, &c->out);
+     c->out.value = NULL;
+     c->out.length = 0;
+     c->out_malloced = 0;
+
+     if (c->close_after_write)
+          return -1;
+
+     c->state = CONN_READ_LENGTH;
+     c->have = 0;
+
+     pending = c->pending;
+     npending = c->npending;
+     c->pending = NULL;
+     c->npending = 0;
+
+     ret = conn_feed(c, pending, npending);
+     free(pending);
+
+     return ret;
+}
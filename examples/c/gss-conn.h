@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <gssapi/gssapi.h>
+
+#include "gss-lucid.h"
+#include "gss-creds.h"
+
+/*
+ * The per-connection state of the "sign" protocol for the event driven
+ * servers.  The I/O side feeds whatever bytes arrive to conn_feed, which
+ * frames them into tokens; each complete token is handed to conn_process,
+ * which may run on another thread, and its reply is written out with
+ * conn_out_iov and conn_written.  None of the functions block or touch
+ * the socket, so the same state machine serves any I/O loop.
+ */
+
+/* the largest token a client may send */
+#define CONN_MAX_TOKEN          (16 * 1024 * 1024)
+
+enum conn_state {
+     CONN_READ_LENGTH,          /* reading the 4 byte token length */
+     CONN_READ_BODY,            /* reading the token itself */
+     CONN_PROCESS,              /* a complete token awaits conn_process */
+     CONN_WRITE,                /* the reply is being written */
+};
+
+enum conn_phase {
+     CONN_ESTABLISHING,         /* tokens are context establishment tokens */
+     CONN_ESTABLISHED,          /* tokens are sealed messages */
+};
+
+struct conn {
+     int                fd;
+     enum conn_state    state;
+     enum conn_phase    phase;
+     int                use_lucid;
+     int                close_after_write;  /* the reply is the last */
+
+     struct creds       *creds;             /* until established */
+     gss_ctx_id_t       context;
+     OM_uint32          ret_flags;
+     lucid_ctx_t        lctx;
+     uint64_t           cpu_ns;             /* spent accepting the context */
+
+     unsigned char      length[4];
+     size_t             have;               /* bytes of length or body */
+     gss_buffer_desc    in;                 /* the token being read */
+
+     gss_buffer_desc    out;                /* the reply token */
+     int                out_malloced;       /* out is free()d, not released */
+     unsigned char      out_length[4];
+     size_t             out_done;           /* bytes of length and out sent */
+
+     unsigned char      *pending;           /* bytes after the last token */
+     size_t             npending;
+
+     /* for the I/O loop */
+     void               *owner;
+     int                busy;               /* conn_process is running */
+     int                hangup;             /* close once not busy */
+     struct conn        *next;
+     struct conn        *prev;              /* io_uring's live list */
+};
+
+struct conn *conn_new(int fd, int use_lucid);
+void conn_free(struct conn *c);
+int conn_feed(struct conn *c, const unsigned char *data, size_t len);
+void conn_process(struct conn *c);
+int conn_out_iov(struct conn *c, struct iovec iov[2]);
+int conn_written(struct conn *c, size_t n);
+int conn_next(struct conn *c);
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <gssapi/gssapi.h>
+#include "gss-creds.h"
+
+static struct creds *_Atomic current;
+
+/* the number of threads between loading current and taking a reference */
+static atomic_int getters;
+
+static char *refresh_name;
+static creds_acquire_fn refresh_acquire;
+static int refresh_interval;
+
+static struct creds *creds_new(gss_cred_id_t cred)
+{
+     struct creds *c;
+
+     if ((c = malloc(sizeof(*c))) == NULL)
+          return NULL;
+
+     c->cred = cred;
+     atomic_init(&c->refs, 1);
+
+     return c;
+}
+
+/*
+ * Function: creds_get
+ *
+ * Purpose: takes a reference to the current credentials
+ *
+ * Returns: the credentials, to be released with creds_put
+ */
+struct creds *creds_get(void)
+{
+     struct creds *c;
+
+     atomic_fetch_add(&getters, 1);
+     c = atomic_load(&current);
+     atomic_fetch_add(&c->refs, 1);
+     atomic_fetch_sub(&getters, 1);
+
+     return c;
+}
+
+/*
+ * Function: creds_put
+ *
+ * Purpose: drops a reference taken by creds_get
+ *
+ * Effects:
+ *
+ * Once credentials have been replaced and the last reference is dropped,
+ * the GSS-API credential is released.
+ */
+void creds_put(struct creds *c)
+{
+     OM_uint32 min_stat;
+
+     if (c == NULL || atomic_fetch_sub(&c->refs, 1) != 1)
+          return;
+
+     (void) gss_release_cred(&min_stat, &c->cred);
+     free(c);
+}
+
+/*
+ * Function: creds_publish
+ *
+ * Purpose: makes new credentials current
+ *
+ * Effects:
+ *
+ * The published reference to the old credentials is dropped only once
+ * every creds_get that may have loaded the old pointer has taken its
+ * own reference, so no thread can be left holding freed credentials.
+ * creds_get never waits.
+ */
+static void creds_publish(struct creds *c)
+{
+     struct creds *old;
+
+     old = atomic_exchange(&current, c);
+     while (atomic_load(&getters) != 0)
+          sched_yield();
+     creds_put(old);
+}
+
+static void *refresh_main(void *arg)
+{
+     gss_cred_id_t cred;
+     struct creds *c;
+
+     (void) arg;
+
+     for (;;) {
+          sleep(refresh_interval);
+
+          /* keep serving with the old credentials if this fails */
+          if (refresh_acquire(refresh_name, &cred) < 0)
+               continue;
+
+          if ((c = creds_new(cred)) == NULL) {
+               OM_uint32 min_stat;
+
+               (void) gss_release_cred(&min_stat, &cred);
+               continue;
+          }
+          creds_publish(c);
+     }
+
+     return NULL;
+}
+
+/*
+ * Function: creds_init
+ *
+ * Purpose: acquires the server's credentials and starts refreshing them
+ *
+ * Arguments:
+ *
+ *      service_name    (r) the ASCII service name
+ *      acquire         (r) the function that imports the name and
+ *                      acquires credentials for it
+ *      refresh_secs    (r) how often to re-acquire the credentials, or 0
+ *                      to keep the first ones
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * The credentials are acquired once before returning, so a bad service
+ * name or keytab is reported at startup.  A failed refresh is reported by
+ * the acquire function, and the current credentials stay in use.
+ */
+int creds_init(char *service_name, creds_acquire_fn acquire,
+               int refresh_secs)
+{
+     gss_cred_id_t cred;
+     struct creds *c;
+     pthread_t tid;
+
+     if (acquire(service_name, &cred) < 0)
+          return -1;
+
+     if ((c = creds_new(cred)) == NULL) {
+          fprintf(stderr, "Couldn't allocate credentials\n");
+          return -1;
+     }
+     atomic_store(&current, c);
+
+     if (refresh_secs <= 0)
+          return 0;
+
+     refresh_name = service_name;
+     refresh_acquire = acquire;
+     refresh_interval = refresh_secs;
+
+     if ((errno = pthread_create(&tid, NULL, refresh_main, NULL)) != 0) {
+          perror("starting credential refresh");
+          return -1;
+     }
+     pthread_detach(tid);
+
+     return 0;
+}
+
+/*
+ * Function: creds_release
+ *
+ * Purpose: drops the reference to the current credentials at exit
+ */
+void creds_release(void)
+{
+     creds_put(atomic_exchange(&current, NULL));
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <gssapi/gssapi.h>
+
+/*
+ * The server's acceptor credentials, re-acquired in the background so
+ * that a rotated keytab is picked up without a restart.  Each new
+ * credential is published with an atomic pointer swap; a context being
+ * established holds a reference to the credential it started with, and
+ * the old credential is released once the last such context is done
+ * with it.
+ */
+
+struct creds {
+     gss_cred_id_t      cred;
+     atomic_int         refs;
+};
+
+typedef int (*creds_acquire_fn)(char *service_name, gss_cred_id_t *creds);
+
+int creds_init(char *service_name, creds_acquire_fn acquire,
+               int refresh_secs);
+struct creds *creds_get(void);
+void creds_put(struct creds *c);
+void creds_release(void);
@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <gssapi/gssapi.h>
+#include "gss-conn.h"
+#include "gss-queue.h"
+#include "gss-event.h"
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0
+#endif
+
+#define EVENT_MAX_EVENTS        256
+#define EVENT_READ_SIZE         (64 * 1024)
+
+/*
+ * Each I/O thread has its own epoll set, and owns the connections it
+ * accepts.  A connection whose token is being processed belongs to a
+ * worker until the worker pushes it onto its I/O thread's done queue and
+ * signals the eventfd.
+ */
+struct io_thread {
+     pthread_t          tid;
+     int                epfd;
+     int                efd;
+     int                listen_fd;
+     int                use_lucid;
+     struct queue       done;
+     atomic_int         signalled;          /* efd has been written */
+     struct conn        *closed;            /* to free after this batch */
+     unsigned char      buf[EVENT_READ_SIZE];
+};
+
+static struct queue jobs;
+static sem_t jobs_ready;
+
+static void dispatch(struct io_thread *t, struct conn *c);
+static void read_conn(struct io_thread *t, struct conn *c);
+
+/*
+ * Function: close_conn
+ *
+ * Purpose: closes a connection
+ *
+ * Effects:
+ *
+ * The state is freed once the current batch of events has been handled,
+ * as later events in the batch may still point to it.
+ */
+static void close_conn(struct io_thread *t, struct conn *c)
+{
+     close(c->fd);
+     c->fd = -1;
+     c->next = t->closed;
+     t->closed = c;
+}
+
+/*
+ * Function: write_conn
+ *
+ * Purpose: writes as much of a connection's reply as the socket takes
+ *
+ * Effects:
+ *
+ * Once the reply has been written the connection goes back to reading,
+ * or is closed if the reply was its last.  If the socket is full the
+ * rest is written when epoll reports it writable.
+ */
+static void write_conn(struct io_thread *t, struct conn *c)
+{
+     struct iovec iov[2];
+     struct msghdr msg;
+     ssize_t n;
+     int niov;
+
+     while ((niov = conn_out_iov(c, iov)) > 0) {
+          memset(&msg, 0, sizeof(msg));
+          msg.msg_iov = iov;
+          msg.msg_iovlen = niov;
+
+          n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+          if (n < 0) {
+               if (errno == EINTR)
+                    continue;
+               if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+               close_conn(t, c);
+               return;
+          }
+          if (conn_written(c, n))
+               break;
+     }
+
+     switch (conn_next(c)) {
+     case -1:
+          close_conn(t, c);
+          return;
+     case 1:
+          dispatch(t, c);
+          return;
+     }
+
+     /* the client may have sent more while the token was processed */
+     read_conn(t, c);
+}
+
+/*
+ * Function: finish_conn
+ *
+ * Purpose: picks a connection up again after a worker has processed its
+ * token
+ */
+static void finish_conn(struct io_thread *t, struct conn *c)
+{
+     c->busy = 0;
+
+     if (c->hangup)
+          close_conn(t, c);
+     else
+          write_conn(t, c);
+}
+
+/*
+ * Function: dispatch
+ *
+ * Purpose: hands a complete token to the worker pool
+ *
+ * Effects:
+ *
+ * If the job queue is full the token is processed on the I/O thread,
+ * which slows this thread's connections down rather than failing them.
+ */
+static void dispatch(struct io_thread *t, struct conn *c)
+{
+     c->busy = 1;
+
+     if (queue_push(&jobs, c) == 0) {
+          sem_post(&jobs_ready);
+          return;
+     }
+
+     conn_process(c);
+     finish_conn(t, c);
+}
+
+/*
+ * Function: read_conn
+ *
+ * Purpose: reads everything available on a connection
+ *
+ * Effects:
+ *
+ * Nothing is read while a worker has the connection; it is read again
+ * once the reply has been sent.  A connection that the client has closed
+ * is closed here, or when its worker finishes.
+ */
+static void read_conn(struct io_thread *t, struct conn *c)
+{
+     ssize_t n;
+
+     while (!c->busy && !c->hangup) {
+          n = read(c->fd, t->buf, sizeof(t->buf));
+          if (n > 0) {
+               switch (conn_feed(c, t->buf, n)) {
+               case -1:
+                    c->hangup = 1;
+                    break;
+               case 1:
+                    dispatch(t, c);
+                    /* dispatch may have finished, and closed, c */
+                    return;
+               }
+          } else if (n == 0) {
+               c->hangup = 1;
+          } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+               return;
+          } else if (errno != EINTR) {
+               c->hangup = 1;
+          }
+     }
+
+     if (c->hangup && !c->busy)
+          close_conn(t, c);
+}
+
+/*
+ * Function: accept_conns
+ *
+ * Purpose: accepts the pending connections on the listening socket
+ */
+static void accept_conns(struct io_thread *t)
+{
+     struct epoll_event ev;
+     struct conn *c;
+     int fd;
+
+     for (;;) {
+          fd = accept4(t->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+          if (fd < 0) {
+               if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+               if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    perror("accepting connection");
+               return;
+          }
+
+          if ((c = conn_new(fd, t->use_lucid)) == NULL) {
+               close(fd);
+               continue;
+          }
+          c->owner = t;
+
+          /* edge triggered, so the interest set never needs changing */
+          memset(&ev, 0, sizeof(ev));
+          ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+          ev.data.ptr = c;
+          if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+               perror("adding connection");
+               close_conn(t, c);
+          }
+     }
+}
+
+/*
+ * Function: collect_done
+ *
+ * Purpose: picks up the connections the workers have finished with
+ */
+static void collect_done(struct io_thread *t)
+{
+     uint64_t count;
+     void *p;
+
+     (void) read(t->efd, &count, sizeof(count));
+
+     /* clear the flag before draining, so that no completion is missed */
+     atomic_store(&t->signalled, 0);
+
+     while (queue_pop(&t->done, &p) == 0)
+          finish_conn(t, p);
+}
+
+static void *io_main(void *arg)
+{
+     struct io_thread *t = arg;
+     struct epoll_event events[EVENT_MAX_EVENTS];
+     struct conn *c;
+     void *p;
+     int i, n;
+
+     for (;;) {
+          n = epoll_wait(t->epfd, events, EVENT_MAX_EVENTS, -1);
+          if (n < 0) {
+               if (errno == EINTR)
+                    continue;
+               perror("waiting for events");
+               break;
+          }
+
+          for (i = 0; i < n; i++) {
+               p = events[i].data.ptr;
+               if (p == &t->listen_fd) {
+                    accept_conns(t);
+               } else if (p == &t->efd) {
+                    collect_done(t);
+               } else {
+                    c = p;
+                    if (c->fd < 0 || c->busy)
+                         continue;
+                    if (c->state == CONN_WRITE)
+                         write_conn(t, c);
+                    else
+                         read_conn(t, c);
+               }
+          }
+
+          while ((c = t->closed) != NULL) {
+               t->closed = c->next;
+               conn_free(c);
+          }
+     }
+
+     return NULL;
+}
+
+static void *worker_main(void *arg)
+{
+     struct io_thread *t;
+     struct conn *c;
+     uint64_t one = 1;
+     void *p;
+
+     (void) arg;
+
+     for (;;) {
+          while (sem_wait(&jobs_ready) < 0)
+               ;
+
+          /* an item is promised; a push may still be finishing */
+          while (queue_pop(&jobs, &p) < 0)
+               sched_yield();
+
+          c = p;
+          conn_process(c);
+
+          t = c->owner;
+          while (queue_push(&t->done, c) < 0)
+               sched_yield();
+          if (atomic_exchange(&t->signalled, 1) == 0)
+               (void) write(t->efd, &one, sizeof(one));
+     }
+
+     return NULL;
+}
+
+/*
+ * Function: io_thread_init
+ *
+ * Purpose: sets up an I/O thread's epoll set, eventfd and done queue
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int io_thread_init(struct io_thread *t, int listen_fd, int use_lucid)
+{
+     struct epoll_event ev;
+
+     t->listen_fd = listen_fd;
+     t->use_lucid = use_lucid;
+     atomic_init(&t->signalled, 0);
+
+     if (queue_init(&t->done, EVENT_QUEUE_SIZE) < 0) {
+          fprintf(stderr, "Couldn't allocate done queue\n");
+          return -1;
+     }
+     if ((t->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+          perror("creating epoll set");
+          return -1;
+     }
+     if ((t->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+          perror("creating eventfd");
+          return -1;
+     }
+
+     /* wake only one I/O thread for each new connection */
+     memset(&ev, 0, sizeof(ev));
+     ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+     ev.data.ptr = &t->listen_fd;
+     if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+          perror("adding listening socket");
+          return -1;
+     }
+
+     memset(&ev, 0, sizeof(ev));
+     ev.events = EPOLLIN;
+     ev.data.ptr = &t->efd;
+     if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->efd, &ev) < 0) {
+          perror("adding eventfd");
+          return -1;
+     }
+
+     return 0;
+}
+
+/*
+ * Function: event_server
+ *
+ * Purpose: serves connections on a listening socket with I/O threads
+ * and a worker pool
+ *
+ * Arguments:
+ *
+ *      listen_fd       (r) the listening socket
+ *      use_lucid       (r) protect messages using lucid contexts
+ *      io_threads      (r) the number of epoll threads
+ *      workers         (r) the number of GSS-API worker threads
+ *
+ * Returns: -1 if the threads cannot be started; otherwise it does not
+ * return
+ *
+ * Effects:
+ *
+ * Each connection is served as by sign_server, except that the client
+ * may send any number of sealed messages, each answered with a
+ * signature block, until it closes the connection.  The calling thread
+ * becomes the first I/O thread.
+ */
+int event_server(int listen_fd, int use_lucid, int io_threads, int workers)
+{
+     struct io_thread *threads;
+     pthread_t tid;
+     int flags, i;
+
+     if (io_threads < 1 || workers < 1)
+          return -1;
+
+     flags = fcntl(listen_fd, F_GETFL);
+     if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+          perror("setting listening socket non-blocking");
+          return -1;
+     }
+
+     if (queue_init(&jobs, EVENT_QUEUE_SIZE) < 0 ||
+         sem_init(&jobs_ready, 0, 0) < 0) {
+          fprintf(stderr, "Couldn't set up job queue\n");
+          return -1;
+     }
+
+     if ((threads = calloc(io_threads, sizeof(*threads))) == NULL) {
+          fprintf(stderr, "Couldn't allocate I/O threads\n");
+          return -1;
+     }
+
+     for (i = 0; i < io_threads; i++)
+          if (io_thread_init(&threads[i], listen_fd, use_lucid) < 0)
+               return -1;
+
+     for (i = 0; i < workers; i++) {
+          if ((errno = pthread_create(&tid, NULL, worker_main, NULL)) != 0) {
+               perror("starting worker");
+               return -1;
+          }
+          pthread_detach(tid);
+     }
+
+     for (i = 1; i < io_threads; i++) {
+          if ((errno = pthread_create(&threads[i].tid, NULL, io_main,
+                                      &threads[i])) != 0) {
+               perror("starting I/O thread");
+               return -1;
+          }
+          pthread_detach(threads[i].tid);
+     }
+
+     io_main(&threads[0]);
+
+     return -1;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+/*
+ * The event driven "sign" server: I/O threads wait on epoll and frame
+ * tokens, and a pool of worker threads does the GSS-API calls, so a slow
+ * gss_accept_sec_context or unwrap of a large token never holds up I/O
+ * for other connections.
+ */
+
+/* the number of tokens that may wait for a worker */
+#define EVENT_QUEUE_SIZE        4096
+
+int event_server(int listen_fd, int use_lucid, int io_threads, int workers);
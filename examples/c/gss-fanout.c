@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+
+#include <gssapi/gssapi.h>
+#include "gss-misc.h"
+#include "gss-probes.h"
+#include "gss-fanout.h"
+
+struct result {
+     char               *host;
+     const char         *stage;     /* the step that failed, or NULL */
+     char               error[FANOUT_ERROR_SIZE];
+     double             connect_ms;
+     double             handshake_ms;
+     double             sign_ms;
+     double             total_ms;
+};
+
+struct run {
+     struct fanout_opts *opts;
+     gss_cred_id_t      cred;
+     struct result      *results;
+     int                nhosts;
+     atomic_int         next;
+};
+
+static double now_ms(void)
+{
+     struct timespec ts;
+
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int fail(struct result *r, const char *stage, const char *error)
+{
+     r->stage = stage;
+     snprintf(r->error, sizeof(r->error), "%s", error);
+     return -1;
+}
+
+/*
+ * Function: fail_gss
+ *
+ * Purpose: records the first GSS-API message for a major and minor status
+ */
+static int fail_gss(struct result *r, const char *stage, OM_uint32 maj_stat,
+                    OM_uint32 min_stat)
+{
+     gss_buffer_desc maj_msg, min_msg;
+     OM_uint32 ctx, tmp;
+
+     ctx = 0;
+     maj_msg.length = min_msg.length = 0;
+     (void) gss_display_status(&tmp, maj_stat, GSS_C_GSS_CODE,
+                               GSS_C_NULL_OID, &ctx, &maj_msg);
+     ctx = 0;
+     (void) gss_display_status(&tmp, min_stat, GSS_C_MECH_CODE,
+                               GSS_C_NULL_OID, &ctx, &min_msg);
+
+     r->stage = stage;
+     snprintf(r->error, sizeof(r->error), "%.*s: %.*s",
+              (int) maj_msg.length, (char *) maj_msg.value,
+              (int) min_msg.length, (char *) min_msg.value);
+
+     (void) gss_release_buffer(&tmp, &maj_msg);
+     (void) gss_release_buffer(&tmp, &min_msg);
+     return -1;
+}
+
+static int fail_io(struct result *r, const char *stage)
+{
+     return fail(r, stage, errno ? strerror(errno) : "connection closed");
+}
+
+/*
+ * Function: connect_host
+ *
+ * Purpose: connects to a host, giving up after a timeout
+ *
+ * Returns: the socket, or -1 on failure
+ *
+ * Effects:
+ *
+ * Each address getaddrinfo returns is tried in turn.  The socket is left
+ * blocking, with the timeout also applied to every send and receive.
+ */
+static int connect_host(struct result *r, u_short port, int timeout)
+{
+     struct addrinfo hints, *res, *ai;
+     struct timeval tv;
+     struct pollfd pfd;
+     socklen_t len;
+     char service[16];
+     int s = -1, err, flags = 0;
+
+     memset(&hints, 0, sizeof(hints));
+     hints.ai_family = AF_UNSPEC;
+     hints.ai_socktype = SOCK_STREAM;
+     snprintf(service, sizeof(service), "%u", port);
+
+     if ((err = getaddrinfo(r->host, service, &hints, &res)) != 0)
+          return fail(r, "resolve", gai_strerror(err));
+
+     for (ai = res; ai != NULL; ai = ai->ai_next) {
+          if ((s = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                          ai->ai_protocol)) < 0) {
+               err = errno;
+               continue;
+          }
+
+          flags = fcntl(s, F_GETFL);
+          (void) fcntl(s, F_SETFL, flags | O_NONBLOCK);
+
+          err = 0;
+          if (connect(s, ai->ai_addr, ai->ai_addrlen) < 0) {
+               err = errno;
+               if (err == EINPROGRESS) {
+                    pfd.fd = s;
+                    pfd.events = POLLOUT;
+                    switch (poll(&pfd, 1, timeout * 1000)) {
+                    case -1:
+                         err = errno;
+                         break;
+                    case 0:
+                         err = ETIMEDOUT;
+                         break;
+                    default:
+                         len = sizeof(err);
+                         if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err,
+                                        &len) < 0)
+                              err = errno;
+                    }
+               }
+          }
+          if (err == 0)
+               break;
+
+          (void) close(s);
+          s = -1;
+     }
+     freeaddrinfo(res);
+
+     if (s < 0) {
+          errno = err;
+          return fail_io(r, "connect");
+     }
+
+     (void) fcntl(s, F_SETFL, flags);
+     tv.tv_sec = timeout;
+     tv.tv_usec = 0;
+     (void) setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+     (void) setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+     return s;
+}
+
+/*
+ * Function: establish
+ *
+ * Purpose: establishes a context with service@host, as
+ * client_establish_context but without printing anything
+ */
+static int establish(struct run *run, struct result *r, int s,
+                     gss_ctx_id_t *context)
+{
+     gss_buffer_desc send_tok, recv_tok, *token_ptr;
+     gss_name_t target_name;
+     OM_uint32 maj_stat, min_stat, init_sec_min_stat;
+     char *name;
+     int ret = 0;
+
+     if ((name = malloc(strlen(run->opts->service) + strlen(r->host) + 2))
+         == NULL)
+          return fail(r, "handshake", "out of memory");
+     sprintf(name, "%s@%s", run->opts->service, r->host);
+
+     send_tok.value = name;
+     send_tok.length = strlen(name);
+     maj_stat = gss_import_name(&min_stat, &send_tok,
+                                (gss_OID) GSS_C_NT_HOSTBASED_SERVICE,
+                                &target_name);
+     free(name);
+     if (maj_stat != GSS_S_COMPLETE)
+          return fail_gss(r, "handshake", maj_stat, min_stat);
+
+     token_ptr = GSS_C_NO_BUFFER;
+     *context = GSS_C_NO_CONTEXT;
+
+     do {
+          GSS_PROBE1(init_start, token_ptr ? token_ptr->length : 0);
+          maj_stat = gss_init_sec_context(&init_sec_min_stat,
+                                          run->cred,
+                                          context,
+                                          target_name,
+                                          run->opts->oid,
+                                          run->opts->req_flags |
+                                          GSS_C_REPLAY_FLAG,
+                                          0,
+                                          NULL, /* no channel bindings */
+                                          token_ptr,
+                                          NULL, /* ignore mech type */
+                                          &send_tok,
+                                          NULL, /* ignore ret_flags */
+                                          NULL);/* ignore time_rec */
+          GSS_PROBE3(init_done, send_tok.length, maj_stat, init_sec_min_stat);
+
+          if (token_ptr != GSS_C_NO_BUFFER)
+               (void) gss_release_buffer(&min_stat, &recv_tok);
+
+          if (send_tok.length != 0) {
+               errno = 0;
+               if (send_token(s, &send_tok) < 0)
+                    ret = fail_io(r, "handshake");
+          }
+          (void) gss_release_buffer(&min_stat, &send_tok);
+
+          if (ret == 0 && maj_stat != GSS_S_COMPLETE &&
+              maj_stat != GSS_S_CONTINUE_NEEDED)
+               ret = fail_gss(r, "handshake", maj_stat, init_sec_min_stat);
+
+          if (ret == 0 && maj_stat == GSS_S_CONTINUE_NEEDED) {
+               errno = 0;
+               if (recv_token(s, &recv_tok) < 0)
+                    ret = fail_io(r, "handshake");
+               token_ptr = &recv_tok;
+          }
+     } while (ret == 0 && maj_stat == GSS_S_CONTINUE_NEEDED);
+
+     (void) gss_release_name(&min_stat, &target_name);
+     if (ret < 0 && *context != GSS_C_NO_CONTEXT)
+          (void) gss_delete_sec_context(&min_stat, context, GSS_C_NO_BUFFER);
+
+     return ret;
+}
+
+/*
+ * Function: sign
+ *
+ * Purpose: performs a sign request on an established context
+ */
+static int sign(struct run *run, struct result *r, int s,
+                gss_ctx_id_t context)
+{
+     gss_buffer_desc out_buf;
+     OM_uint32 maj_stat, min_stat;
+     gss_qop_t qop_state;
+     int state, ret = 0;
+
+     maj_stat = gss_wrap(&min_stat, context, run->opts->seal,
+                         GSS_C_QOP_DEFAULT, run->opts->msg, &state,
+                         &out_buf);
+     if (maj_stat != GSS_S_COMPLETE)
+          return fail_gss(r, "sign", maj_stat, min_stat);
+
+     errno = 0;
+     ret = send_token(s, &out_buf);
+     (void) gss_release_buffer(&min_stat, &out_buf);
+     if (ret < 0)
+          return fail_io(r, "sign");
+
+     errno = 0;
+     if (recv_token(s, &out_buf) < 0)
+          return fail_io(r, "sign");
+
+     GSS_PROBE2(verify_mic_start, run->opts->msg->length, out_buf.length);
+     maj_stat = gss_verify_mic(&min_stat, context, run->opts->msg, &out_buf,
+                               &qop_state);
+     GSS_PROBE2(verify_mic_done, maj_stat, min_stat);
+     (void) gss_release_buffer(&min_stat, &out_buf);
+     if (maj_stat != GSS_S_COMPLETE)
+          return fail_gss(r, "verify", maj_stat, min_stat);
+
+     return 0;
+}
+
+static void call_host(struct run *run, struct result *r)
+{
+     gss_ctx_id_t context;
+     OM_uint32 maj_stat, min_stat;
+     double start, t;
+     int s;
+
+     start = t = now_ms();
+
+     if ((s = connect_host(r, run->opts->port, run->opts->timeout)) < 0)
+          goto out;
+     r->connect_ms = now_ms() - t;
+
+     t = now_ms();
+     if (establish(run, r, s, &context) < 0)
+          goto out;
+     r->handshake_ms = now_ms() - t;
+
+     t = now_ms();
+     if (sign(run, r, s, context) == 0)
+          r->sign_ms = now_ms() - t;
+     maj_stat = gss_delete_sec_context(&min_stat, &context, GSS_C_NO_BUFFER);
+     GSS_PROBE2(delete_context, maj_stat, min_stat);
+
+out:
+     if (s >= 0)
+          (void) close(s);
+     r->total_ms = now_ms() - start;
+}
+
+static void *fanout_main(void *arg)
+{
+     struct run *run = arg;
+     int i;
+
+     while ((i = atomic_fetch_add(&run->next, 1)) < run->nhosts)
+          call_host(run, &run->results[i]);
+
+     return NULL;
+}
+
+static void print_results(struct run *run, double wall_ms)
+{
+     struct result *r;
+     int i, width = 4, failed = 0;
+
+     for (i = 0; i < run->nhosts; i++)
+          if ((int) strlen(run->results[i].host) > width)
+               width = strlen(run->results[i].host);
+
+     printf("%-*s %-9s %10s %10s %10s %10s  %s\n", width, "host", "status",
+            "connect", "handshake", "sign", "total", "error");
+
+     for (i = 0; i < run->nhosts; i++) {
+          r = &run->results[i];
+          if (r->stage)
+               failed++;
+          printf("%-*s %-9s %10.2f %10.2f %10.2f %10.2f  %s\n", width,
+                 r->host, r->stage ? r->stage : "ok", r->connect_ms,
+                 r->handshake_ms, r->sign_ms, r->total_ms, r->error);
+     }
+
+     printf("%d hosts, %d ok, %d failed, %.2f ms\n", run->nhosts,
+            run->nhosts - failed, failed, wall_ms);
+}
+
+/*
+ * Function: fanout
+ *
+ * Purpose: calls the "sign" service on a list of hosts in parallel
+ *
+ * Arguments:
+ *
+ *      hosts           (r) the host names
+ *      nhosts          (r) the number of hosts
+ *      opts            (r) the service, message and limits
+ *
+ * Returns: the number of hosts that failed, or -1 if none could be tried
+ *
+ * Effects:
+ *
+ * The initiator credentials are acquired once and shared.  Up to
+ * opts->parallel threads each take the next host from the list, resolve
+ * it with getaddrinfo, connect, establish a context with service@host
+ * and perform a sign request, timing each step.  Once every host is done
+ * a table of the timings and of the step that failed, if any, is
+ * printed in the order the hosts were given.
+ */
+int fanout(char **hosts, int nhosts, struct fanout_opts *opts)
+{
+     struct run run;
+     pthread_t *tids;
+     OM_uint32 maj_stat, min_stat;
+     double start;
+     int i, nthreads, failed = 0;
+
+     memset(&run, 0, sizeof(run));
+     run.opts = opts;
+     run.nhosts = nhosts;
+     atomic_init(&run.next, 0);
+
+     nthreads = opts->parallel < nhosts ? opts->parallel : nhosts;
+     if (nthreads < 1)
+          nthreads = 1;
+
+     run.results = calloc(nhosts, sizeof(*run.results));
+     tids = calloc(nthreads, sizeof(*tids));
+     if (run.results == NULL || tids == NULL) {
+          fprintf(stderr, "Couldn't allocate fan-out tables\n");
+          return -1;
+     }
+     for (i = 0; i < nhosts; i++)
+          run.results[i].host = hosts[i];
+
+     maj_stat = gss_acquire_cred(&min_stat, GSS_C_NO_NAME, GSS_C_INDEFINITE,
+                                 GSS_C_NULL_OID_SET, GSS_C_INITIATE,
+                                 &run.cred, NULL, NULL);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("acquiring credentials", maj_stat, min_stat);
+          return -1;
+     }
+
+     start = now_ms();
+     for (i = 0; i < nthreads; i++) {
+          if ((errno = pthread_create(&tids[i], NULL, fanout_main,
+                                      &run)) != 0) {
+               perror("starting fan-out thread");
+               nthreads = i;
+               break;
+          }
+     }
+     if (nthreads == 0)
+          fanout_main(&run);
+     for (i = 0; i < nthreads; i++)
+          pthread_join(tids[i], NULL);
+
+     print_results(&run, now_ms() - start);
+
+     for (i = 0; i < nhosts; i++)
+          if (run.results[i].stage)
+               failed++;
+
+     (void) gss_release_cred(&min_stat, &run.cred);
+     free(run.results);
+     free(tids);
+
+     return failed;
+}
+
+/*
+ * Function: read_hosts
+ *
+ * Purpose: reads a list of host names, one per line
+ *
+ * Arguments:
+ *
+ *      file_name       (r) the file, or "-" for standard input
+ *      nhosts          (w) the number of hosts read
+ *
+ * Returns: the host names, or NULL on failure
+ *
+ * Effects:
+ *
+ * Blank lines and anything after a '#' are ignored.
+ */
+char **read_hosts(char *file_name, int *nhosts)
+{
+     FILE *fp;
+     char line[1024], *p, *end, **hosts = NULL, **tmp;
+     int n = 0, size = 0;
+
+     if (strcmp(file_name, "-") == 0)
+          fp = stdin;
+     else if ((fp = fopen(file_name, "r")) == NULL) {
+          perror(file_name);
+          return NULL;
+     }
+
+     while (fgets(line, sizeof(line), fp) != NULL) {
+          if ((p = strchr(line, '#')) != NULL)
+               *p = '\0';
+          for (p = line; isspace((unsigned char) *p); p++)
+               ;
+          for (end = p; *end && !isspace((unsigned char) *end); end++)
+               ;
+          *end = '\0';
+          if (*p == '\0')
+               continue;
+
+          if (n == size) {
+               size = size ? size * 2 : 64;
+               if ((tmp = realloc(hosts, size * sizeof(*hosts))) == NULL)
+                    break;
+               hosts = tmp;
+          }
+          if ((hosts[n] = strdup(p)) == NULL)
+               break;
+          n++;
+     }
+
+     if (fp != stdin)
+          fclose(fp);
+
+     if (n == 0) {
+          fprintf(stderr, "No hosts in %s\n", file_name);
+          free(hosts);
+          return NULL;
+     }
+
+     *nhosts = n;
+     return hosts;
+}
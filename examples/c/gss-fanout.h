@@ -0,0 +1,27 @@
+#pragma once
+
+#include <sys/types.h>
+#include <gssapi/gssapi.h>
+
+/*
+ * Fan-out mode for the client: call the "sign" service on many hosts at
+ * once, a bounded number at a time, and report each host's latency and
+ * status in one table.
+ */
+
+/* the longest error message kept for a host */
+#define FANOUT_ERROR_SIZE       128
+
+struct fanout_opts {
+     u_short            port;
+     gss_OID            oid;
+     char               *service;   /* service@host is the target name */
+     OM_uint32          req_flags;
+     gss_buffer_t       msg;
+     int                seal;
+     int                parallel;   /* connections at once */
+     int                timeout;    /* seconds, for each network step */
+};
+
+char **read_hosts(char *file_name, int *nhosts);
+int fanout(char **hosts, int nhosts, struct fanout_opts *opts);
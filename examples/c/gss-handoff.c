@@ -0,0 +1,488 @@
+/*
+ * Zero-downtime restart of the sample server.
+ *
+ * handoff_init installs a SIGHUP handler that only sets a flag, and
+ * blocks SIGHUP.  The server waits for connections and messages in
+ * handoff_wait, which lets the signal through only while it is in ppoll(),
+ * so a SIGHUP that arrives at any other time stays pending until the
+ * server next waits, at a point where each connection is between tokens.
+ * handoff_send then starts the new binary with HANDOFF_FD_OPTION and one
+ * end of a socketpair, and passes it
+ *
+ *      a 4 byte count of connections, with the listening socket and the
+ *      connection sockets attached as SCM_RIGHTS ancillary data
+ *
+ *      the gss_export_sec_context token of each connection, framed as
+ *      by send_token
+ *
+ * The new process imports every context, then writes a single byte to
+ * acknowledge the handoff, and the old process exits.  If anything goes
+ * wrong before the acknowledgement the old process imports its own
+ * context tokens again and carries on serving.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include <gssapi/gssapi.h>
+#include "gss-misc.h"
+#include "gss-handoff.h"
+
+/* how long to wait for the new process to take over */
+#define HANDOFF_TIMEOUT_MS      30000
+
+#define HANDOFF_ACK             'k'
+
+volatile sig_atomic_t handoff_requested = 0;
+
+/* the arguments for the new process, slots 1 and 2 are the fd option */
+static char **handoff_argv;
+
+/* the signal mask to wait with, which lets SIGHUP through */
+static sigset_t handoff_wait_mask;
+
+static void handoff_signal(int sig)
+{
+     (void) sig;
+     handoff_requested = 1;
+}
+
+/*
+ * Function: handoff_init
+ *
+ * Purpose: prepares the server to hand off to a new process on SIGHUP
+ *
+ * Arguments:
+ *
+ *      argc, argv      (r) the server's command line
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * The command line is saved for starting the new process, without any
+ * HANDOFF_FD_OPTION this process was itself started with, and a SIGHUP
+ * handler that sets handoff_requested is installed.  SIGHUP is blocked
+ * except in handoff_wait, so handoff_init must be called before the
+ * server starts any other thread.
+ */
+int handoff_init(int argc, char **argv)
+{
+     struct sigaction sa;
+     sigset_t hup;
+     int i, n;
+
+     if ((handoff_argv = calloc(argc + 3, sizeof(char *))) == NULL) {
+          fprintf(stderr, "Out of memory saving the command line\n");
+          return -1;
+     }
+
+     handoff_argv[0] = argv[0];
+     n = 3;
+     for (i = 1; i < argc; i++) {
+          if (strcmp(argv[i], HANDOFF_FD_OPTION) == 0 && i + 1 < argc) {
+               i++;
+               continue;
+          }
+          handoff_argv[n++] = argv[i];
+     }
+     handoff_argv[n] = NULL;
+
+     memset(&sa, 0, sizeof(sa));
+     sa.sa_handler = handoff_signal;
+     sigemptyset(&sa.sa_mask);
+     sa.sa_flags = 0;   /* no SA_RESTART, ppoll() sees EINTR */
+
+     if (sigaction(SIGHUP, &sa, NULL) < 0) {
+          perror("installing SIGHUP handler");
+          return -1;
+     }
+
+     sigemptyset(&hup);
+     sigaddset(&hup, SIGHUP);
+     if ((errno = pthread_sigmask(SIG_BLOCK, &hup, &handoff_wait_mask)) != 0) {
+          perror("blocking SIGHUP");
+          return -1;
+     }
+     sigdelset(&handoff_wait_mask, SIGHUP);
+
+     return 0;
+}
+
+/*
+ * Function: handoff_wait
+ *
+ * Purpose: waits for a socket to become readable, or for a handoff
+ *
+ * Arguments:
+ *
+ *      fd              (r) the socket to wait for
+ *
+ * Returns: 0 if the socket is readable, 1 if a handoff has been
+ * requested, or -1 on error
+ *
+ * Effects:
+ *
+ * SIGHUP is unblocked only for the duration of the ppoll() call, so a
+ * signal that arrives after handoff_requested has been checked is still
+ * seen: it interrupts the ppoll() as soon as it starts.
+ */
+int handoff_wait(int fd)
+{
+     struct pollfd pfd;
+
+     pfd.fd = fd;
+     pfd.events = POLLIN;
+
+     for (;;) {
+          if (handoff_requested)
+               return 1;
+          if (ppoll(&pfd, 1, NULL, &handoff_wait_mask) >= 0)
+               return 0;
+          if (errno != EINTR)
+               return -1;
+     }
+}
+
+static int send_fds(int s, int *fds, int nfds, int count)
+{
+     struct msghdr msg;
+     struct iovec iov;
+     struct cmsghdr *cmsg;
+     union {
+          char buf[CMSG_SPACE(sizeof(int) * (HANDOFF_MAX_CONNS + 1))];
+          struct cmsghdr align;
+     } u;
+     uint32_t n = htonl(count);
+
+     memset(&msg, 0, sizeof(msg));
+     memset(&u, 0, sizeof(u));
+     iov.iov_base = &n;
+     iov.iov_len = sizeof(n);
+     msg.msg_iov = &iov;
+     msg.msg_iovlen = 1;
+     msg.msg_control = u.buf;
+     msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+     cmsg = CMSG_FIRSTHDR(&msg);
+     cmsg->cmsg_level = SOL_SOCKET;
+     cmsg->cmsg_type = SCM_RIGHTS;
+     cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+     memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+     while (sendmsg(s, &msg, 0) < 0) {
+          if (errno == EINTR)
+               continue;
+          perror("sending descriptors");
+          return -1;
+     }
+
+     return 0;
+}
+
+static int recv_fds(int s, int *fds, int max_fds, int *count)
+{
+     struct msghdr msg;
+     struct iovec iov;
+     struct cmsghdr *cmsg;
+     union {
+          char buf[CMSG_SPACE(sizeof(int) * (HANDOFF_MAX_CONNS + 1))];
+          struct cmsghdr align;
+     } u;
+     uint32_t n;
+     ssize_t ret;
+     int nfds;
+
+     memset(&msg, 0, sizeof(msg));
+     iov.iov_base = &n;
+     iov.iov_len = sizeof(n);
+     msg.msg_iov = &iov;
+     msg.msg_iovlen = 1;
+     msg.msg_control = u.buf;
+     msg.msg_controllen = sizeof(u.buf);
+
+     while ((ret = recvmsg(s, &msg, 0)) < 0) {
+          if (errno == EINTR)
+               continue;
+          perror("receiving descriptors");
+          return -1;
+     }
+
+     cmsg = CMSG_FIRSTHDR(&msg);
+     if (ret != sizeof(n) || (msg.msg_flags & MSG_CTRUNC) || cmsg == NULL ||
+         cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+          fprintf(stderr, "handoff: malformed descriptor message\n");
+          return -1;
+     }
+
+     nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+     memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+
+     *count = ntohl(n);
+     if (nfds != *count + 1 || nfds > max_fds) {
+          fprintf(stderr, "handoff: expected %d descriptors, got %d\n",
+                  *count + 1, nfds);
+          while (nfds > 0)
+               (void) close(fds[--nfds]);
+          return -1;
+     }
+
+     return 0;
+}
+
+/* wait for the new process to acknowledge the handoff */
+static int wait_ack(int s)
+{
+     struct pollfd pfd;
+     char ack;
+     int ret;
+
+     pfd.fd = s;
+     pfd.events = POLLIN;
+
+     while ((ret = poll(&pfd, 1, HANDOFF_TIMEOUT_MS)) < 0 && errno == EINTR)
+          ;
+     if (ret <= 0) {
+          fprintf(stderr, "handoff: no acknowledgement from new process\n");
+          return -1;
+     }
+
+     while ((ret = read(s, &ack, 1)) < 0 && errno == EINTR)
+          ;
+
+     return (ret == 1 && ack == HANDOFF_ACK) ? 0 : -1;
+}
+
+static void exec_new(int s, int listen_fd, struct handoff_conn *conns,
+                     int nconns)
+{
+     char path[PATH_MAX], fdbuf[16];
+     int i;
+
+     (void) close(listen_fd);
+     for (i = 0; i < nconns; i++)
+          (void) close(conns[i].fd);
+
+     /*
+      * SIGHUP stays blocked across the exec: until the new process has
+      * installed its handler, a HUP would kill it.  Its handoff_init
+      * keeps SIGHUP blocked outside ppoll(), where a pending one is
+      * then delivered.
+      */
+
+     snprintf(fdbuf, sizeof(fdbuf), "%d", s);
+     handoff_argv[1] = HANDOFF_FD_OPTION;
+     handoff_argv[2] = fdbuf;
+
+     /* resolve the path now, so a binary replaced by a deploy is started */
+     if (strchr(handoff_argv[0], '/') != NULL &&
+         realpath(handoff_argv[0], path) != NULL)
+          execv(path, handoff_argv);
+     else
+          execvp(handoff_argv[0], handoff_argv);
+
+     perror("starting new server");
+     _exit(127);
+}
+
+/*
+ * Function: handoff_send
+ *
+ * Purpose: hands the listening socket and established connections to a
+ * new copy of the server
+ *
+ * Arguments:
+ *
+ *      listen_fd       (r) the listening socket
+ *      conns           (r/w) the established connections
+ *      nconns          (r) the number of connections
+ *
+ * Returns: 0 if the new process has taken over, -1 otherwise
+ *
+ * Effects:
+ *
+ * Each connection's context is exported, which consumes it.  On success
+ * the connection sockets are closed and the caller should exit.  On
+ * failure each context is imported again into conns, and the caller can
+ * carry on serving.
+ */
+int handoff_send(int listen_fd, struct handoff_conn *conns, int nconns)
+{
+     gss_buffer_desc tokens[HANDOFF_MAX_CONNS];
+     int fds[HANDOFF_MAX_CONNS + 1];
+     int sv[2], i, nexported = 0, ret = -1;
+     OM_uint32 maj_stat, min_stat;
+     struct sigaction ign, old_pipe;
+     pid_t pid;
+
+     if (nconns > HANDOFF_MAX_CONNS) {
+          fprintf(stderr, "handoff: too many connections (%d)\n", nconns);
+          return -1;
+     }
+
+     for (; nexported < nconns; nexported++) {
+          maj_stat = gss_export_sec_context(&min_stat,
+                                            &conns[nexported].context,
+                                            &tokens[nexported]);
+          if (maj_stat != GSS_S_COMPLETE) {
+               display_status("exporting context", maj_stat, min_stat);
+               goto restore;
+          }
+     }
+
+     if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+          perror("creating handoff socket");
+          goto restore;
+     }
+
+     if ((pid = fork()) < 0) {
+          perror("forking new server");
+          (void) close(sv[0]);
+          (void) close(sv[1]);
+          goto restore;
+     }
+
+     if (pid == 0) {
+          (void) close(sv[0]);
+          exec_new(sv[1], listen_fd, conns, nconns);
+     }
+
+     (void) close(sv[1]);
+
+     /* a new process that dies early must not take this one with it */
+     memset(&ign, 0, sizeof(ign));
+     ign.sa_handler = SIG_IGN;
+     sigemptyset(&ign.sa_mask);
+     (void) sigaction(SIGPIPE, &ign, &old_pipe);
+
+     fds[0] = listen_fd;
+     for (i = 0; i < nconns; i++)
+          fds[i + 1] = conns[i].fd;
+
+     if (send_fds(sv[0], fds, nconns + 1, nconns) < 0)
+          goto fail;
+
+     for (i = 0; i < nconns; i++)
+          if (send_token(sv[0], &tokens[i]) < 0)
+               goto fail;
+
+     if (wait_ack(sv[0]) < 0)
+          goto fail;
+
+     for (i = 0; i < nconns; i++)
+          (void) close(conns[i].fd);
+     ret = 0;
+     (void) close(sv[0]);
+     (void) sigaction(SIGPIPE, &old_pipe, NULL);
+     goto out;
+
+fail:
+     (void) close(sv[0]);
+     (void) sigaction(SIGPIPE, &old_pipe, NULL);
+     (void) kill(pid, SIGTERM);
+     (void) waitpid(pid, NULL, 0);
+
+restore:
+     for (i = 0; i < nexported; i++) {
+          maj_stat = gss_import_sec_context(&min_stat, &tokens[i],
+                                            &conns[i].context);
+          if (maj_stat != GSS_S_COMPLETE) {
+               display_status("re-importing context", maj_stat, min_stat);
+               conns[i].context = GSS_C_NO_CONTEXT;
+          }
+     }
+
+out:
+     for (i = 0; i < nexported; i++)
+          (void) gss_release_buffer(&min_stat, &tokens[i]);
+
+     return ret;
+}
+
+/*
+ * Function: handoff_receive
+ *
+ * Purpose: takes over the listening socket and connections from the
+ * process that started this one
+ *
+ * Arguments:
+ *
+ *      fd              (r) the handoff socket, from HANDOFF_FD_OPTION
+ *      listen_fd       (w) the listening socket
+ *      conns           (w) the connections and their imported contexts
+ *      max_conns       (r) the size of conns
+ *      nconns          (w) the number of connections
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * The handoff is acknowledged only once every context has been imported,
+ * otherwise the old process keeps serving and this one should exit.  The
+ * handoff socket is closed.
+ */
+int handoff_receive(int fd, int *listen_fd, struct handoff_conn *conns,
+                    int max_conns, int *nconns)
+{
+     int fds[HANDOFF_MAX_CONNS + 1];
+     gss_buffer_desc token;
+     OM_uint32 maj_stat, min_stat;
+     char ack = HANDOFF_ACK;
+     int count, i, nimported = 0;
+
+     if (max_conns > HANDOFF_MAX_CONNS)
+          max_conns = HANDOFF_MAX_CONNS;
+
+     if (recv_fds(fd, fds, max_conns + 1, &count) < 0)
+          goto fail;
+
+     *listen_fd = fds[0];
+
+     for (; nimported < count; nimported++) {
+          if (recv_token(fd, &token) < 0)
+               goto fail_fds;
+
+          conns[nimported].fd = fds[nimported + 1];
+          conns[nimported].context = GSS_C_NO_CONTEXT;
+          maj_stat = gss_import_sec_context(&min_stat, &token,
+                                            &conns[nimported].context);
+          (void) gss_release_buffer(&min_stat, &token);
+          if (maj_stat != GSS_S_COMPLETE) {
+               display_status("importing context", maj_stat, min_stat);
+               goto fail_fds;
+          }
+     }
+
+     if (write(fd, &ack, 1) != 1) {
+          perror("acknowledging handoff");
+          goto fail_fds;
+     }
+
+     (void) close(fd);
+     *nconns = count;
+     return 0;
+
+fail_fds:
+     for (i = 0; i < nimported; i++)
+          (void) gss_delete_sec_context(&min_stat, &conns[i].context,
+                                        GSS_C_NO_BUFFER);
+     for (i = 0; i <= count; i++)
+          (void) close(fds[i]);
+fail:
+     (void) close(fd);
+     return -1;
+}
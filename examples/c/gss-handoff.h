@@ -0,0 +1,29 @@
+#pragma once
+
+#include <signal.h>
+#include <gssapi/gssapi.h>
+
+/*
+ * Zero-downtime restart: on SIGHUP the running server starts a new copy
+ * of its binary and passes it the listening socket and any established
+ * connections, with their security contexts, over a UNIX domain socket.
+ */
+
+/* the most connections handed over in one restart */
+#define HANDOFF_MAX_CONNS       64
+
+/* the option the new process is started with, followed by a descriptor */
+#define HANDOFF_FD_OPTION       "-handoff-fd"
+
+struct handoff_conn {
+     int                fd;
+     gss_ctx_id_t       context;
+};
+
+extern volatile sig_atomic_t handoff_requested;
+
+int handoff_init(int argc, char **argv);
+int handoff_wait(int fd);
+int handoff_send(int listen_fd, struct handoff_conn *conns, int nconns);
+int handoff_receive(int fd, int *listen_fd, struct handoff_conn *conns,
+                    int max_conns, int *nconns);
@@ -0,0 +1,949 @@
+/*
+ * Per-message protection using a lucid Kerberos context.
+ *
+ * The RFC 4121 token formats are implemented on top of the RFC 3961
+ * simplified profile as used by the AES encryption types (RFC 3962):
+ *
+ *   Kc, Ke, Ki = DK(base key, usage | 0x99, 0xAA, 0x55)
+ *   checksum   = HMAC-SHA1(Kc, data)[0..12)
+ *   encrypt    = AES-CTS(Ke, confounder | plaintext) |
+ *                HMAC-SHA1(Ki, confounder | plaintext)[0..12)
+ *
+ * The derived keys never change for the life of a context, so each is
+ * loaded into an OpenSSL context once: CBC and ECB cipher contexts for Ke,
+ * and keyed HMAC digest contexts for Kc and Ki that are copied for each
+ * token.  Tokens are encrypted and decrypted in place.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <gssapi/gssapi.h>
+#include <gssapi/gssapi_krb5.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "gss-misc.h"
+#include "gss-lucid.h"
+
+#define ENCTYPE_AES128_CTS_HMAC_SHA1_96 17
+#define ENCTYPE_AES256_CTS_HMAC_SHA1_96 18
+
+#define LUCID_PROTOCOL_CFX      1
+
+#define AES_BLOCK               16
+#define CONFOUNDER_LENGTH       AES_BLOCK
+#define HMAC_LENGTH             12
+#define TOKEN_HEADER_LENGTH     16
+
+/* RFC 4121 § 4.2.2 token flags */
+#define FLAG_SENT_BY_ACCEPTOR   0x01
+#define FLAG_SEALED             0x02
+#define FLAG_ACCEPTOR_SUBKEY    0x04
+
+/* RFC 4121 § 2 key usage numbers */
+#define KU_ACCEPTOR_SEAL        22
+#define KU_ACCEPTOR_SIGN        23
+#define KU_INITIATOR_SEAL       24
+#define KU_INITIATOR_SIGN       25
+
+/* keys for tokens travelling in one direction */
+struct lucid_dir {
+     EVP_CIPHER_CTX     *cbc;   /* Ke, encrypting on send, decrypting on receive */
+     EVP_CIPHER_CTX     *ecb;   /* Ke, decrypting; for the CTS tail on receive */
+     EVP_MD_CTX         *ki;    /* keyed HMAC template for Ki */
+     EVP_MD_CTX         *kc;    /* keyed HMAC template for Kc */
+};
+
+struct lucid_ctx {
+     OM_uint32          ctx_flags;
+     int                initiate;
+     unsigned char      key_flags;      /* FLAG_ACCEPTOR_SUBKEY or 0 */
+     uint64_t           send_seq;
+     uint64_t           recv_seq;
+     struct lucid_dir   send;
+     struct lucid_dir   recv;
+     EVP_MD_CTX         *work;  /* scratch copy of a keyed HMAC template */
+};
+
+static const unsigned char zero_iv[AES_BLOCK];
+
+/*
+ * RFC 3961 § 5.1 n-fold: replicate the input, each copy rotated right
+ * by 13 bits more than the last, up to the least common multiple of the
+ * input and output lengths and add the output sized blocks together with
+ * ones-complement addition.
+ */
+static void nfold(const unsigned char *in, unsigned int inlen,
+                  unsigned char *out, unsigned int outlen)
+{
+     unsigned int a, b, c, lcm;
+     unsigned int byte = 0;
+     int i, msbit;
+
+     a = outlen;
+     b = inlen;
+     while (b != 0) {
+          c = b;
+          b = a % b;
+          a = c;
+     }
+     lcm = outlen * inlen / a;
+
+     memset(out, 0, outlen);
+
+     for (i = lcm - 1; i >= 0; i--) {
+          /* the most significant bit of the input byte for this output byte */
+          msbit = (((inlen << 3) - 1)
+                   + (((inlen << 3) + 13) * (i / inlen))
+                   + ((inlen - (i % inlen)) << 3)) % (inlen << 3);
+
+          byte += (((in[((inlen - 1) - (msbit >> 3)) % inlen] << 8)
+                    | (in[(inlen - (msbit >> 3)) % inlen]))
+                   >> ((msbit & 7) + 1)) & 0xff;
+          byte += out[i % outlen];
+          out[i % outlen] = byte & 0xff;
+          byte >>= 8;
+     }
+
+     /* propagate the end-around carry */
+     if (byte) {
+          for (i = outlen - 1; i >= 0; i--) {
+               byte += out[i];
+               out[i] = byte & 0xff;
+               byte >>= 8;
+          }
+     }
+}
+
+static const EVP_CIPHER *aes_cipher(int cbc, size_t keylen)
+{
+     if (keylen == 16)
+          return cbc ? EVP_aes_128_cbc() : EVP_aes_128_ecb();
+     return cbc ? EVP_aes_256_cbc() : EVP_aes_256_ecb();
+}
+
+static EVP_CIPHER_CTX *cipher_ctx(const EVP_CIPHER *cipher,
+                                  const unsigned char *key, int enc)
+{
+     EVP_CIPHER_CTX *ctx;
+
+     if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+          return NULL;
+
+     if (EVP_CipherInit_ex(ctx, cipher, NULL, key, zero_iv, enc) != 1) {
+          EVP_CIPHER_CTX_free(ctx);
+          return NULL;
+     }
+     EVP_CIPHER_CTX_set_padding(ctx, 0);
+
+     return ctx;
+}
+
+static EVP_MD_CTX *hmac_ctx(const unsigned char *key, size_t keylen)
+{
+     EVP_PKEY *pkey;
+     EVP_MD_CTX *ctx;
+
+     if ((pkey = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, key,
+                                      (int) keylen)) == NULL)
+          return NULL;
+
+     if ((ctx = EVP_MD_CTX_new()) != NULL &&
+         EVP_DigestSignInit(ctx, NULL, EVP_sha1(), NULL, pkey) != 1) {
+          EVP_MD_CTX_free(ctx);
+          ctx = NULL;
+     }
+
+     /* the digest context holds its own reference to the key */
+     EVP_PKEY_free(pkey);
+
+     return ctx;
+}
+
+/*
+ * RFC 3961 § 5.1 DK(base, usage | kind): n-fold the usage constant to the
+ * cipher block size and encrypt it repeatedly with the base key, for AES
+ * random-to-key is the identity.
+ */
+static int derive_key(const unsigned char *base, size_t keylen,
+                      unsigned int usage, unsigned char kind,
+                      unsigned char *out)
+{
+     unsigned char constant[5], block[AES_BLOCK];
+     EVP_CIPHER_CTX *ecb;
+     size_t n;
+     int outl, ret = -1;
+
+     constant[0] = (usage >> 24) & 0xff;
+     constant[1] = (usage >> 16) & 0xff;
+     constant[2] = (usage >> 8) & 0xff;
+     constant[3] = usage & 0xff;
+     constant[4] = kind;
+
+     nfold(constant, sizeof(constant), block, sizeof(block));
+
+     if ((ecb = cipher_ctx(aes_cipher(0, keylen), base, 1)) == NULL)
+          return -1;
+
+     for (n = 0; n < keylen; n += AES_BLOCK) {
+          if (EVP_EncryptUpdate(ecb, block, &outl, block, AES_BLOCK) != 1)
+               goto out;
+          memcpy(out + n, block, AES_BLOCK);
+     }
+     ret = 0;
+
+out:
+     OPENSSL_cleanse(block, sizeof(block));
+     EVP_CIPHER_CTX_free(ecb);
+     return ret;
+}
+
+static int dir_init(struct lucid_dir *dir, const unsigned char *base,
+                    size_t keylen, unsigned int seal_usage,
+                    unsigned int sign_usage, int enc)
+{
+     unsigned char ke[32], ki[32], kc[32];
+     int ret = -1;
+
+     if (derive_key(base, keylen, seal_usage, 0xAA, ke) < 0 ||
+         derive_key(base, keylen, seal_usage, 0x55, ki) < 0 ||
+         derive_key(base, keylen, sign_usage, 0x99, kc) < 0)
+          goto out;
+
+     dir->cbc = cipher_ctx(aes_cipher(1, keylen), ke, enc);
+     dir->ecb = enc ? NULL : cipher_ctx(aes_cipher(0, keylen), ke, 0);
+     dir->ki = hmac_ctx(ki, keylen);
+     dir->kc = hmac_ctx(kc, keylen);
+
+     if (dir->cbc && (enc || dir->ecb) && dir->ki && dir->kc)
+          ret = 0;
+
+out:
+     OPENSSL_cleanse(ke, sizeof(ke));
+     OPENSSL_cleanse(ki, sizeof(ki));
+     OPENSSL_cleanse(kc, sizeof(kc));
+     return ret;
+}
+
+static void dir_free(struct lucid_dir *dir)
+{
+     EVP_CIPHER_CTX_free(dir->cbc);
+     EVP_CIPHER_CTX_free(dir->ecb);
+     EVP_MD_CTX_free(dir->ki);
+     EVP_MD_CTX_free(dir->kc);
+}
+
+/*
+ * Compute the truncated HMAC of up to two buffers using a keyed template,
+ * which is copied so that the template itself is never finalized.
+ */
+static int hmac(struct lucid_ctx *l, EVP_MD_CTX *tmpl,
+                const unsigned char *p1, size_t l1,
+                const unsigned char *p2, size_t l2,
+                unsigned char *out)
+{
+     unsigned char full[EVP_MAX_MD_SIZE];
+     size_t len = sizeof(full);
+
+     if (EVP_MD_CTX_copy_ex(l->work, tmpl) != 1 ||
+         EVP_DigestSignUpdate(l->work, p1, l1) != 1 ||
+         (l2 && EVP_DigestSignUpdate(l->work, p2, l2) != 1) ||
+         EVP_DigestSignFinal(l->work, full, &len) != 1)
+          return -1;
+
+     memcpy(out, full, HMAC_LENGTH);
+     return 0;
+}
+
+/*
+ * AES-CTS encryption in place (RFC 3962 § 5): CBC with a zero IV, with the
+ * last two blocks swapped and the final block truncated to the length of
+ * the plaintext.  buf must have room for len rounded up to a whole block.
+ */
+static int cts_encrypt(EVP_CIPHER_CTX *cbc, unsigned char *buf, size_t len)
+{
+     size_t nblocks = (len + AES_BLOCK - 1) / AES_BLOCK;
+     size_t last = len - (nblocks - 1) * AES_BLOCK;
+     unsigned char tmp[AES_BLOCK];
+     unsigned char *pen, *fin;
+     int outl;
+
+     if (len < AES_BLOCK)
+          return -1;
+
+     memset(buf + len, 0, nblocks * AES_BLOCK - len);
+
+     if (EVP_CipherInit_ex(cbc, NULL, NULL, NULL, zero_iv, -1) != 1 ||
+         EVP_EncryptUpdate(cbc, buf, &outl, buf,
+                           (int) (nblocks * AES_BLOCK)) != 1)
+          return -1;
+
+     if (nblocks > 1) {
+          pen = buf + (nblocks - 2) * AES_BLOCK;
+          fin = buf + (nblocks - 1) * AES_BLOCK;
+          memcpy(tmp, pen, AES_BLOCK);
+          memcpy(pen, fin, AES_BLOCK);
+          memcpy(fin, tmp, last);
+     }
+
+     return 0;
+}
+
+/* AES-CTS decryption in place, the inverse of cts_encrypt */
+static int cts_decrypt(struct lucid_dir *dir, unsigned char *buf, size_t len)
+{
+     size_t nblocks = (len + AES_BLOCK - 1) / AES_BLOCK;
+     size_t last = len - (nblocks - 1) * AES_BLOCK;
+     unsigned char prev[AES_BLOCK], x[AES_BLOCK], cn1[AES_BLOCK];
+     unsigned char pn[AES_BLOCK];
+     unsigned char *pen, *fin;
+     size_t i;
+     int outl;
+
+     if (len < AES_BLOCK)
+          return -1;
+
+     if (EVP_CipherInit_ex(dir->cbc, NULL, NULL, NULL, zero_iv, -1) != 1)
+          return -1;
+
+     if (nblocks == 1)
+          return EVP_DecryptUpdate(dir->cbc, buf, &outl, buf,
+                                   AES_BLOCK) == 1 ? 0 : -1;
+
+     pen = buf + (nblocks - 2) * AES_BLOCK;
+     fin = buf + (nblocks - 1) * AES_BLOCK;
+
+     /* the ciphertext block that chains into the swapped pair */
+     if (nblocks > 2)
+          memcpy(prev, pen - AES_BLOCK, AES_BLOCK);
+     else
+          memset(prev, 0, AES_BLOCK);
+
+     if (nblocks > 2 &&
+         EVP_DecryptUpdate(dir->cbc, buf, &outl, buf,
+                           (int) ((nblocks - 2) * AES_BLOCK)) != 1)
+          return -1;
+
+     /*
+      * pen holds E(Pn | 0... ^ Cn-1), fin the first bytes of Cn-1.  The
+      * rest of Cn-1 is recovered from the decryption of pen.
+      */
+     if (EVP_DecryptUpdate(dir->ecb, x, &outl, pen, AES_BLOCK) != 1)
+          return -1;
+
+     memcpy(cn1, fin, last);
+     memcpy(cn1 + last, x + last, AES_BLOCK - last);
+     for (i = 0; i < last; i++)
+          pn[i] = x[i] ^ cn1[i];
+
+     if (EVP_DecryptUpdate(dir->ecb, x, &outl, cn1, AES_BLOCK) != 1)
+          return -1;
+     for (i = 0; i < AES_BLOCK; i++)
+          pen[i] = x[i] ^ prev[i];
+
+     memcpy(fin, pn, last);
+
+     return 0;
+}
+
+static void put_seq(unsigned char *p, uint64_t seq)
+{
+     int i;
+
+     for (i = 7; i >= 0; i--) {
+          p[i] = seq & 0xff;
+          seq >>= 8;
+     }
+}
+
+static uint64_t get_seq(const unsigned char *p)
+{
+     uint64_t seq = 0;
+     int i;
+
+     for (i = 0; i < 8; i++)
+          seq = (seq << 8) | p[i];
+
+     return seq;
+}
+
+/*
+ * Tokens arrive in order on the stream the examples use, so the receive
+ * state is just the next expected sequence number rather than a replay
+ * window: an earlier number is reported as an old token and a later one
+ * as a gap when the context asked for replay or sequence detection.
+ */
+static OM_uint32 check_seq(struct lucid_ctx *l, uint64_t seq)
+{
+     if (seq == l->recv_seq) {
+          l->recv_seq++;
+          return GSS_S_COMPLETE;
+     }
+
+     if (seq > l->recv_seq) {
+          l->recv_seq = seq + 1;
+          return (l->ctx_flags & GSS_C_SEQUENCE_FLAG) ?
+               GSS_S_GAP_TOKEN : GSS_S_COMPLETE;
+     }
+
+     return (l->ctx_flags & (GSS_C_REPLAY_FLAG | GSS_C_SEQUENCE_FLAG)) ?
+          GSS_S_OLD_TOKEN : GSS_S_COMPLETE;
+}
+
+/* undo the right rotation of the token body by rrc bytes (RFC 4121 § 4.2.5) */
+static int unrotate(unsigned char *body, size_t len, size_t rrc)
+{
+     unsigned char small[64], *tmp;
+
+     if (len == 0 || (rrc %= len) == 0)
+          return 0;
+
+     tmp = rrc <= sizeof(small) ? small : malloc(rrc);
+     if (tmp == NULL)
+          return -1;
+
+     memcpy(tmp, body, rrc);
+     memmove(body, body + rrc, len - rrc);
+     memcpy(body + len - rrc, tmp, rrc);
+
+     if (tmp != small)
+          free(tmp);
+
+     return 0;
+}
+
+static unsigned char send_flags(struct lucid_ctx *l)
+{
+     return (l->initiate ? 0 : FLAG_SENT_BY_ACCEPTOR) | l->key_flags;
+}
+
+/* check the flags of a received token match the peer and key in use */
+static int recv_flags_ok(struct lucid_ctx *l, unsigned char flags)
+{
+     if (((flags & FLAG_SENT_BY_ACCEPTOR) != 0) != (l->initiate != 0))
+          return 0;
+
+     return (flags & FLAG_ACCEPTOR_SUBKEY) == l->key_flags;
+}
+
+/*
+ * Export a lucid copy of an established context.  Exporting a lucid
+ * context consumes the GSS-API context, so the context is first exported
+ * as an interprocess token, which is returned in ctx_token for the caller
+ * to import again if it still needs the context, and a temporary copy
+ * imported from it is converted.  On success context is GSS_C_NO_CONTEXT
+ * and the lucid context must be freed with
+ * gss_krb5_free_lucid_sec_context.
+ */
+static int export_lucid(gss_ctx_id_t *context, gss_buffer_t ctx_token,
+                        gss_krb5_lucid_context_v1_t **lucid)
+{
+     gss_ctx_id_t tmp_ctx = GSS_C_NO_CONTEXT;
+     OM_uint32 maj_stat, min_stat;
+     void *lp;
+
+     *lucid = NULL;
+
+     maj_stat = gss_export_sec_context(&min_stat, context, ctx_token);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("exporting context", maj_stat, min_stat);
+          return -1;
+     }
+
+     maj_stat = gss_import_sec_context(&min_stat, ctx_token, &tmp_ctx);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("importing context", maj_stat, min_stat);
+          goto fail;
+     }
+
+     maj_stat = gss_krb5_export_lucid_sec_context(&min_stat, &tmp_ctx, 1,
+                                                  &lp);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("exporting lucid context", maj_stat, min_stat);
+          (void) gss_delete_sec_context(&min_stat, &tmp_ctx, GSS_C_NO_BUFFER);
+          goto fail;
+     }
+
+     *lucid = lp;
+     return 0;
+
+fail:
+     (void) gss_release_buffer(&min_stat, ctx_token);
+     return -1;
+}
+
+/* the key that protects tokens, or NULL if it is not handled here */
+static gss_krb5_lucid_key_t *cfx_key(gss_krb5_lucid_context_v1_t *lucid)
+{
+     gss_krb5_lucid_key_t *key;
+
+     key = lucid->cfx_kd.have_acceptor_subkey ?
+          &lucid->cfx_kd.acceptor_subkey : &lucid->cfx_kd.ctx_key;
+
+     if (lucid->protocol != LUCID_PROTOCOL_CFX ||
+         !((key->type == ENCTYPE_AES128_CTS_HMAC_SHA1_96 && key->length == 16) ||
+           (key->type == ENCTYPE_AES256_CTS_HMAC_SHA1_96 && key->length == 32)))
+          return NULL;
+
+     return key;
+}
+
+/*
+ * Function: lucid_import
+ *
+ * Purpose: replaces an established GSS-API context with a lucid context
+ *
+ * Arguments:
+ *
+ *      context         (r/w) the established GSS-API context
+ *      ctx_flags       (r) the context flags returned on establishment
+ *      lctx            (w) the lucid context, or NULL
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * The context is exported as an interprocess token and a copy of it
+ * converted.  If it uses an encryption type or token format that is not
+ * handled here it is restored from the same token, lctx is set to NULL and
+ * the caller carries on with GSS-API.  Otherwise context is set to
+ * GSS_C_NO_CONTEXT and the lucid context is returned in lctx, to be freed
+ * with lucid_free.
+ */
+int lucid_import(gss_ctx_id_t *context, OM_uint32 ctx_flags,
+                 lucid_ctx_t *lctx)
+{
+     gss_buffer_desc ctx_token;
+     gss_krb5_lucid_context_v1_t *lucid = NULL;
+     gss_krb5_lucid_key_t *key;
+     struct lucid_ctx *l = NULL;
+     OM_uint32 maj_stat, min_stat;
+     int ret = -1;
+
+     *lctx = NULL;
+
+     if (export_lucid(context, &ctx_token, &lucid) < 0)
+          return -1;
+
+     if ((key = cfx_key(lucid)) == NULL) {
+          /* not for us, put the GSS-API context back */
+          maj_stat = gss_import_sec_context(&min_stat, &ctx_token, context);
+          if (maj_stat != GSS_S_COMPLETE) {
+               display_status("importing context", maj_stat, min_stat);
+               goto out;
+          }
+          ret = 0;
+          goto out;
+     }
+
+     if ((l = calloc(1, sizeof(*l))) == NULL)
+          goto out;
+
+     l->ctx_flags = ctx_flags;
+     l->initiate = lucid->initiate;
+     l->key_flags = lucid->cfx_kd.have_acceptor_subkey ?
+          FLAG_ACCEPTOR_SUBKEY : 0;
+     l->send_seq = lucid->send_seq;
+     l->recv_seq = lucid->recv_seq;
+
+     if ((l->work = EVP_MD_CTX_new()) == NULL ||
+         dir_init(&l->send, key->data, key->length,
+                  l->initiate ? KU_INITIATOR_SEAL : KU_ACCEPTOR_SEAL,
+                  l->initiate ? KU_INITIATOR_SIGN : KU_ACCEPTOR_SIGN, 1) < 0 ||
+         dir_init(&l->recv, key->data, key->length,
+                  l->initiate ? KU_ACCEPTOR_SEAL : KU_INITIATOR_SEAL,
+                  l->initiate ? KU_ACCEPTOR_SIGN : KU_INITIATOR_SIGN, 0) < 0) {
+          fprintf(stderr, "lucid context: failed to set up cipher contexts\n");
+          lucid_free(l);
+          goto out;
+     }
+
+     *lctx = l;
+     ret = 0;
+
+out:
+     if (lucid)
+          (void) gss_krb5_free_lucid_sec_context(&min_stat, lucid);
+     (void) gss_release_buffer(&min_stat, &ctx_token);
+     return ret;
+}
+
+static unsigned char *put32(unsigned char *p, uint32_t v)
+{
+     p[0] = (v >> 24) & 0xff;
+     p[1] = (v >> 16) & 0xff;
+     p[2] = (v >> 8) & 0xff;
+     p[3] = v & 0xff;
+     return p + 4;
+}
+
+static unsigned char *put_key(unsigned char *p, gss_krb5_lucid_key_t *key)
+{
+     p = put32(p, key->type);
+     p = put32(p, key->length);
+     memcpy(p, key->data, key->length);
+     return p + key->length;
+}
+
+/*
+ * Function: lucid_serialize
+ *
+ * Purpose: serializes an established context for another process
+ *
+ * Arguments:
+ *
+ *      context         (r/w) the established GSS-API context
+ *      token           (w) the serialized context
+ *
+ * Returns: 0 on success, 1 if the context does not use the CFX token
+ * format, -1 on failure
+ *
+ * Effects:
+ *
+ * The context's keys and sequence numbers are taken from a lucid copy of
+ * it and written in the LUCID_SERIAL_VERSION format, which the Go
+ * package's krb5.ImportLucidContext reads, so that a process that did not
+ * establish the context can carry on protecting messages with it.  The
+ * context itself is left usable, unless importing it again fails in which
+ * case it is set to GSS_C_NO_CONTEXT.  The token holds the session keys;
+ * the caller must clear it and release it with free().
+ */
+int lucid_serialize(gss_ctx_id_t *context, gss_buffer_t token)
+{
+     gss_buffer_desc ctx_token, peer;
+     gss_name_t src_name = GSS_C_NO_NAME, targ_name = GSS_C_NO_NAME;
+     gss_krb5_lucid_context_v1_t *lucid = NULL;
+     gss_krb5_lucid_key_t *ctx_key, *acc_key = NULL;
+     OM_uint32 maj_stat, min_stat, ctx_flags;
+     unsigned char *p;
+     int local, ret = -1;
+
+     token->value = NULL;
+     token->length = 0;
+     peer.value = NULL;
+     peer.length = 0;
+
+     maj_stat = gss_inquire_context(&min_stat, *context, &src_name,
+                                    &targ_name, NULL, NULL, &ctx_flags,
+                                    &local, NULL);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("inquiring context", maj_stat, min_stat);
+          return -1;
+     }
+
+     maj_stat = gss_display_name(&min_stat, local ? targ_name : src_name,
+                                 &peer, NULL);
+     (void) gss_release_name(&min_stat, &src_name);
+     (void) gss_release_name(&min_stat, &targ_name);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("displaying name", maj_stat, min_stat);
+          return -1;
+     }
+
+     if (export_lucid(context, &ctx_token, &lucid) < 0)
+          goto out;
+
+     if (lucid->protocol != LUCID_PROTOCOL_CFX) {
+          ret = 1;
+          goto restore;
+     }
+
+     ctx_key = &lucid->cfx_kd.ctx_key;
+     if (lucid->cfx_kd.have_acceptor_subkey)
+          acc_key = &lucid->cfx_kd.acceptor_subkey;
+
+     token->length = LUCID_SERIAL_FIXED_LENGTH + ctx_key->length +
+          (acc_key ? 8 + acc_key->length : 0) + 4 + peer.length;
+     if ((token->value = malloc(token->length)) == NULL) {
+          fprintf(stderr, "Out of memory serializing context\n");
+          token->length = 0;
+          goto restore;
+     }
+
+     p = token->value;
+     p = put32(p, LUCID_SERIAL_VERSION);
+     p = put32(p, lucid->initiate);
+     p = put32(p, ctx_flags);
+     p = put32(p, lucid->endtime);
+     put_seq(p, lucid->send_seq);
+     put_seq(p + 8, lucid->recv_seq);
+     p += 16;
+     p = put32(p, acc_key != NULL);
+     p = put_key(p, ctx_key);
+     if (acc_key)
+          p = put_key(p, acc_key);
+     p = put32(p, peer.length);
+     memcpy(p, peer.value, peer.length);
+     ret = 0;
+
+restore:
+     maj_stat = gss_import_sec_context(&min_stat, &ctx_token, context);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("importing context", maj_stat, min_stat);
+          ret = -1;
+     }
+
+     if (ret < 0 && token->value) {
+          OPENSSL_cleanse(token->value, token->length);
+          free(token->value);
+          token->value = NULL;
+          token->length = 0;
+     }
+
+     (void) gss_krb5_free_lucid_sec_context(&min_stat, lucid);
+     (void) gss_release_buffer(&min_stat, &ctx_token);
+out:
+     (void) gss_release_buffer(&min_stat, &peer);
+     return ret;
+}
+
+/*
+ * Function: lucid_free
+ *
+ * Purpose: releases a lucid context and its cipher and HMAC contexts
+ */
+void lucid_free(lucid_ctx_t lctx)
+{
+     if (lctx == NULL)
+          return;
+
+     dir_free(&lctx->send);
+     dir_free(&lctx->recv);
+     EVP_MD_CTX_free(lctx->work);
+     OPENSSL_cleanse(lctx, sizeof(*lctx));
+     free(lctx);
+}
+
+/*
+ * Function: lucid_wrap
+ *
+ * Purpose: produces a Wrap token for a message
+ *
+ * Arguments:
+ *
+ *      lctx            (r) the lucid context
+ *      conf_req        (r) non-zero to encrypt the message
+ *      msg             (r) the message
+ *      token           (w) the Wrap token
+ *
+ * Returns: GSS_S_COMPLETE on success, GSS_S_FAILURE on failure
+ *
+ * Effects:
+ *
+ * The token is built and encrypted in a single allocation, which the
+ * caller frees with free().  Tokens are sent with a rotation count of
+ * zero.
+ */
+OM_uint32 lucid_wrap(lucid_ctx_t l, int conf_req, gss_buffer_t msg,
+                     gss_buffer_t token)
+{
+     unsigned char *tok, *p;
+     size_t len;
+
+     if (conf_req)
+          len = TOKEN_HEADER_LENGTH + CONFOUNDER_LENGTH + msg->length +
+               TOKEN_HEADER_LENGTH + HMAC_LENGTH;
+     else
+          len = TOKEN_HEADER_LENGTH + msg->length + HMAC_LENGTH;
+
+     /* room for CTS to pad the final block while encrypting in place */
+     if ((tok = malloc(len + AES_BLOCK)) == NULL)
+          return GSS_S_FAILURE;
+
+     tok[0] = 0x05;
+     tok[1] = 0x04;
+     tok[2] = send_flags(l) | (conf_req ? FLAG_SEALED : 0);
+     tok[3] = 0xff;
+     tok[4] = tok[5] = 0;       /* EC */
+     tok[6] = tok[7] = 0;       /* RRC */
+     put_seq(tok + 8, l->send_seq);
+
+     if (conf_req) {
+          size_t plen = CONFOUNDER_LENGTH + msg->length + TOKEN_HEADER_LENGTH;
+
+          /* confounder | message | header, no filler is needed with CTS */
+          p = tok + TOKEN_HEADER_LENGTH;
+          if (RAND_bytes(p, CONFOUNDER_LENGTH) != 1)
+               goto fail;
+          memcpy(p + CONFOUNDER_LENGTH, msg->value, msg->length);
+          memcpy(p + CONFOUNDER_LENGTH + msg->length, tok, TOKEN_HEADER_LENGTH);
+
+          if (hmac(l, l->send.ki, p, plen, NULL, 0, p + plen + AES_BLOCK) < 0)
+               goto fail;
+          if (cts_encrypt(l->send.cbc, p, plen) < 0)
+               goto fail;
+
+          /* the HMAC was computed above the CTS padding, move it down */
+          memmove(p + plen, p + plen + AES_BLOCK, HMAC_LENGTH);
+     } else {
+          p = tok + TOKEN_HEADER_LENGTH;
+          memcpy(p, msg->value, msg->length);
+
+          /* checksum over message | header with EC and RRC of zero */
+          if (hmac(l, l->send.kc, p, msg->length, tok, TOKEN_HEADER_LENGTH,
+                   p + msg->length) < 0)
+               goto fail;
+          tok[5] = HMAC_LENGTH;
+     }
+
+     l->send_seq++;
+     token->value = tok;
+     token->length = len;
+     return GSS_S_COMPLETE;
+
+fail:
+     free(tok);
+     return GSS_S_FAILURE;
+}
+
+/*
+ * Function: lucid_unwrap
+ *
+ * Purpose: checks a Wrap token and recovers the message
+ *
+ * Arguments:
+ *
+ *      lctx            (r) the lucid context
+ *      token           (r/w) the Wrap token
+ *      msg             (w) the message
+ *      conf_state      (w) non-zero if the message was encrypted
+ *
+ * Returns: GSS_S_COMPLETE on success or a GSS-API major status
+ *
+ * Effects:
+ *
+ * The token is rotated and decrypted in place and msg is set to point
+ * into it, so msg is only valid until token is released and must not be
+ * released itself.
+ */
+OM_uint32 lucid_unwrap(lucid_ctx_t l, gss_buffer_t token, gss_buffer_t msg,
+                       int *conf_state)
+{
+     unsigned char *tok = token->value;
+     unsigned char *body, *copy, sum[HMAC_LENGTH], hdr[TOKEN_HEADER_LENGTH];
+     size_t len = token->length, blen, ec, rrc;
+
+     if (len < TOKEN_HEADER_LENGTH + HMAC_LENGTH ||
+         tok[0] != 0x05 || tok[1] != 0x04 || tok[3] != 0xff)
+          return GSS_S_DEFECTIVE_TOKEN;
+     if (!recv_flags_ok(l, tok[2]))
+          return GSS_S_DEFECTIVE_TOKEN;
+
+     ec = (tok[4] << 8) | tok[5];
+     rrc = (tok[6] << 8) | tok[7];
+     body = tok + TOKEN_HEADER_LENGTH;
+     blen = len - TOKEN_HEADER_LENGTH;
+
+     if (unrotate(body, blen, rrc) < 0)
+          return GSS_S_FAILURE;
+
+     if (tok[2] & FLAG_SEALED) {
+          size_t clen = blen - HMAC_LENGTH;
+
+          if (clen < CONFOUNDER_LENGTH + ec + TOKEN_HEADER_LENGTH)
+               return GSS_S_DEFECTIVE_TOKEN;
+
+          if (cts_decrypt(&l->recv, body, clen) < 0 ||
+              hmac(l, l->recv.ki, body, clen, NULL, 0, sum) < 0)
+               return GSS_S_FAILURE;
+          if (CRYPTO_memcmp(sum, body + clen, HMAC_LENGTH) != 0)
+               return GSS_S_BAD_SIG;
+
+          /* the encrypted copy of the header must match, bar the RRC */
+          copy = body + clen - TOKEN_HEADER_LENGTH;
+          if (memcmp(copy, tok, 6) != 0 || memcmp(copy + 8, tok + 8, 8) != 0)
+               return GSS_S_BAD_SIG;
+
+          msg->value = body + CONFOUNDER_LENGTH;
+          msg->length = clen - CONFOUNDER_LENGTH - ec - TOKEN_HEADER_LENGTH;
+     } else {
+          if (ec != HMAC_LENGTH)
+               return GSS_S_DEFECTIVE_TOKEN;
+
+          memcpy(hdr, tok, TOKEN_HEADER_LENGTH);
+          hdr[4] = hdr[5] = hdr[6] = hdr[7] = 0;
+
+          if (hmac(l, l->recv.kc, body, blen - HMAC_LENGTH,
+                   hdr, TOKEN_HEADER_LENGTH, sum) < 0)
+               return GSS_S_FAILURE;
+          if (CRYPTO_memcmp(sum, body + blen - HMAC_LENGTH, HMAC_LENGTH) != 0)
+               return GSS_S_BAD_SIG;
+
+          msg->value = body;
+          msg->length = blen - HMAC_LENGTH;
+     }
+
+     if (conf_state)
+          *conf_state = (tok[2] & FLAG_SEALED) != 0;
+
+     return check_seq(l, get_seq(tok + 8));
+}
+
+/*
+ * Function: lucid_get_mic
+ *
+ * Purpose: produces a MIC token for a message
+ *
+ * Arguments:
+ *
+ *      lctx            (r) the lucid context
+ *      msg             (r) the message
+ *      token           (r/w) the caller's buffer of at least
+ *                      LUCID_MIC_LENGTH bytes, set to the MIC token
+ *
+ * Returns: GSS_S_COMPLETE on success, GSS_S_FAILURE on failure
+ */
+OM_uint32 lucid_get_mic(lucid_ctx_t l, gss_buffer_t msg, gss_buffer_t token)
+{
+     unsigned char *tok = token->value;
+
+     if (token->length < LUCID_MIC_LENGTH)
+          return GSS_S_FAILURE;
+
+     tok[0] = 0x04;
+     tok[1] = 0x04;
+     tok[2] = send_flags(l);
+     memset(tok + 3, 0xff, 5);
+     put_seq(tok + 8, l->send_seq);
+
+     if (hmac(l, l->send.kc, msg->value, msg->length,
+              tok, TOKEN_HEADER_LENGTH, tok + TOKEN_HEADER_LENGTH) < 0)
+          return GSS_S_FAILURE;
+
+     l->send_seq++;
+     token->length = LUCID_MIC_LENGTH;
+     return GSS_S_COMPLETE;
+}
+
+/*
+ * Function: lucid_verify_mic
+ *
+ * Purpose: checks a MIC token against a message
+ *
+ * Returns: GSS_S_COMPLETE on success or a GSS-API major status
+ */
+OM_uint32 lucid_verify_mic(lucid_ctx_t l, gss_buffer_t msg, gss_buffer_t token)
+{
+     unsigned char *tok = token->value;
+     unsigned char sum[HMAC_LENGTH];
+     static const unsigned char filler[5] = { 0xff, 0xff, 0xff, 0xff, 0xff };
+
+     if (token->length != LUCID_MIC_LENGTH ||
+         tok[0] != 0x04 || tok[1] != 0x04 || memcmp(tok + 3, filler, 5) != 0)
+          return GSS_S_DEFECTIVE_TOKEN;
+     if (!recv_flags_ok(l, tok[2]))
+          return GSS_S_DEFECTIVE_TOKEN;
+
+     if (hmac(l, l->recv.kc, msg->value, msg->length,
+              tok, TOKEN_HEADER_LENGTH, sum) < 0)
+          return GSS_S_FAILURE;
+     if (CRYPTO_memcmp(sum, tok + TOKEN_HEADER_LENGTH, HMAC_LENGTH) != 0)
+          return GSS_S_BAD_SIG;
+
+     return check_seq(l, get_seq(tok + 8));
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <gssapi/gssapi.h>
+
+/*
+ * Per-message protection using a lucid (exported) Kerberos context.
+ *
+ * After context establishment the Kerberos keys and sequence numbers are
+ * exported from the GSS-API library and the RFC 4121 Wrap and MIC tokens
+ * are produced and checked directly with OpenSSL, using cipher and HMAC
+ * contexts that are keyed once per security context.  Only the CFX token
+ * format with aes128-cts-hmac-sha1-96 and aes256-cts-hmac-sha1-96 keys is
+ * handled; other contexts stay with the GSS-API library.
+ */
+
+typedef struct lucid_ctx *lucid_ctx_t;
+
+/* length of a MIC token produced by lucid_get_mic */
+#define LUCID_MIC_LENGTH        28
+
+/*
+ * A context serialized by lucid_serialize, all integers big-endian:
+ *
+ *      4       LUCID_SERIAL_VERSION
+ *      4       non-zero if the context was initiated here
+ *      4       GSS-API context flags
+ *      4       end time, seconds since the epoch
+ *      8       next sequence number to send
+ *      8       next sequence number expected from the peer
+ *      4       non-zero if the acceptor asserted a subkey
+ *      4+4+n   context key type, length and value
+ *      4+4+n   acceptor subkey type, length and value, if asserted
+ *      4+n     peer name length and display form
+ */
+#define LUCID_SERIAL_VERSION    1
+#define LUCID_SERIAL_FIXED_LENGTH 44
+
+int lucid_import(gss_ctx_id_t *context, OM_uint32 ctx_flags,
+                 lucid_ctx_t *lctx);
+void lucid_free(lucid_ctx_t lctx);
+int lucid_serialize(gss_ctx_id_t *context, gss_buffer_t token);
+
+OM_uint32 lucid_wrap(lucid_ctx_t lctx, int conf_req, gss_buffer_t msg,
+                     gss_buffer_t token);
+OM_uint32 lucid_unwrap(lucid_ctx_t lctx, gss_buffer_t token,
+                       gss_buffer_t msg, int *conf_state);
+OM_uint32 lucid_get_mic(lucid_ctx_t lctx, gss_buffer_t msg,
+                        gss_buffer_t token);
+OM_uint32 lucid_verify_mic(lucid_ctx_t lctx, gss_buffer_t msg,
+                           gss_buffer_t token);
@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <errno.h>
 #include <unistd.h>
@@ -31,6 +32,7 @@
 
 #include <gssapi/gssapi.h>
 #include "gss-misc.h"
+#include "gss-probes.h"
 
 #include <stdlib.h>
 
@@ -58,6 +60,37 @@ static int write_all(int fildes, char *buf, unsigned int nbyte)
      return(ptr-buf);
 }
 
+/* as write_all, for the length and data of a token in a single call */
+static int writev_all(int fildes, struct iovec *iov, int iovcnt)
+{
+     ssize_t ret;
+     int total = 0;
+
+     while (iovcnt > 0) {
+          ret = writev(fildes, iov, iovcnt);
+          if (ret < 0) {
+               if (errno == EINTR)
+                    continue;
+               return(ret);
+          } else if (ret == 0) {
+               return(total);
+          }
+          total += ret;
+
+          while (iovcnt > 0 && (size_t) ret >= iov->iov_len) {
+               ret -= iov->iov_len;
+               iov++;
+               iovcnt--;
+          }
+          if (iovcnt > 0) {
+               iov->iov_base = (char *) iov->iov_base + ret;
+               iov->iov_len -= ret;
+          }
+     }
+
+     return(total);
+}
+
 static int read_all(int fildes, char *buf, unsigned int nbyte)
 {
      int ret;
@@ -94,39 +127,39 @@ static int read_all(int fildes, char *buf, unsigned int nbyte)
  * send_token writes the token length (as a network long) and then the
  * token data to the file descriptor s.  It returns 0 on success, and
  * -1 if an error occurs or if it could not write all the data.
+ *
+ * The length and data go out in a single writev, so that a small token
+ * is a single segment: it is not held back by Nagle's algorithm waiting
+ * for the peer to acknowledge the length, and with TCP Fast Open the
+ * whole of the first token travels in the SYN.
  */
 int send_token(s, tok)
      int s;
      gss_buffer_t tok;
 {
      int len, ret;
+     struct iovec iov[2];
 
      len = htonl(tok->length);
 
-     ret = write_all(s, (char *) &len, 4);
-     if (ret < 0) {
-          perror("sending token length");
-          return -1;
-     } else if (ret != 4) {
-         if (display_file)
-             fprintf(display_file, 
-                     "sending token length: %d of %d bytes written\n", 
-                     ret, 4);
-          return -1;
-     }
+     iov[0].iov_base = &len;
+     iov[0].iov_len = 4;
+     iov[1].iov_base = tok->value;
+     iov[1].iov_len = tok->length;
 
-     ret = write_all(s, tok->value, tok->length);
+     ret = writev_all(s, iov, 2);
      if (ret < 0) {
-          perror("sending token data");
+          perror("sending token");
           return -1;
-     } else if (ret != tok->length) {
+     } else if (ret != 4 + tok->length) {
          if (display_file)
              fprintf(display_file, 
-                     "sending token data: %d of %ld bytes written\n", 
-                     ret, tok->length);
+                     "sending token: %d of %ld bytes written\n", 
+                     ret, 4 + tok->length);
          return -1;
      }
-     
+
+     GSS_PROBE1(token_send, tok->length);
      return 0;
 }
 
@@ -190,6 +223,7 @@ int recv_token(s, tok)
           return -1;
      }
 
+     GSS_PROBE1(token_recv, tok->length);
      return 0;
 }
 
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * USDT probes for tracing the examples with bpftrace, perf or SystemTap.
+ * They are built in when <sys/sdt.h> is available (HAVE_SYS_SDT_H, set
+ * by the Makefile) and compile to nothing otherwise; a built-in probe
+ * that nobody is tracing costs a single nop.
+ *
+ * Provider gss_example:
+ *
+ *      token_send(length)              a token was written
+ *      token_recv(length)              a token was read
+ *      accept_start(in_length)         gss_accept_sec_context, one round
+ *      accept_done(out_length, major, minor)
+ *      init_start(in_length)           gss_init_sec_context, one round
+ *      init_done(out_length, major, minor)
+ *      unwrap_start(in_length)
+ *      unwrap_done(out_length, major, minor)
+ *      get_mic_start(msg_length)
+ *      get_mic_done(mic_length, major, minor)
+ *      verify_mic_start(msg_length, mic_length)
+ *      verify_mic_done(major, minor)
+ *      delete_context(major, minor)
+ *
+ * For example, a histogram of accept latencies in microseconds:
+ *
+ *      bpftrace -e '
+ *      usdt:./gss-server-c:gss_example:accept_start { @s[tid] = nsecs; }
+ *      usdt:./gss-server-c:gss_example:accept_done /@s[tid]/ {
+ *          @us = hist((nsecs - @s[tid]) / 1000); delete(@s[tid]); }'
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define GSS_PROBE1(name, a)             DTRACE_PROBE1(gss_example, name, a)
+#define GSS_PROBE2(name, a, b)          DTRACE_PROBE2(gss_example, name, a, b)
+#define GSS_PROBE3(name, a, b, c)       DTRACE_PROBE3(gss_example, name, a, b, c)
+
+#else
+
+/* the arguments are still evaluated, so that none is left unused */
+#define GSS_PROBE1(name, a)             do { (void) (a); } while (0)
+#define GSS_PROBE2(name, a, b)          do { (void) (a); (void) (b); } while (0)
+#define GSS_PROBE3(name, a, b, c) \
+     do { (void) (a); (void) (b); (void) (c); } while (0)
+
+#endif
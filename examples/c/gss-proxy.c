@@ -0,0 +1,542 @@
+/*
+ * A token-aware impairment proxy for benchmarking the examples over a
+ * simulated network on one machine.
+ *
+ * Each connection accepted on the listening port is relayed to the real
+ * server.  The proxy reads whole tokens in the 4-byte length framing of
+ * send_token() and delays, paces, reorders or drops each token on its
+ * own, so that a benchmark sees one round trip per token exchange just
+ * as it would between two hosts.
+ *
+ *      gss-proxy-c -port 4445 -rtt 40 -jitter 5 localhost 4444
+ *
+ * Each direction gets half of the round-trip time.  Jitter moves a
+ * token by up to the given amount either way, but never ahead of the
+ * token before it; only -reorder lets a token be overtaken, by holding
+ * it back for a further round trip.  -bandwidth paces each direction as
+ * if the token had to cross a link of that speed.  A dropped token is
+ * never delivered, so the peer sees a stalled exchange, as it would if
+ * a middlebox ate it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+/* tokens longer than this end the connection */
+#define PROXY_MAX_TOKEN         (16 * 1024 * 1024)
+
+struct opts {
+     long               delay_us;       /* one way, half the round trip */
+     long               jitter_us;
+     long               bandwidth;      /* bytes per second, 0 for none */
+     int                drop;           /* percent of tokens */
+     int                reorder;        /* percent of tokens */
+     unsigned int       seed;
+     int                verbose;
+     const char         *host;
+     const char         *port;
+};
+
+struct token {
+     struct timespec    release;        /* when it may be sent */
+     uint32_t           length;
+     unsigned char      *data;          /* length prefix then token */
+     struct token       *next;
+};
+
+/* one direction of a relayed connection */
+struct flow {
+     const char         *name;
+     int                src;
+     int                dst;
+     struct opts        *opts;
+     unsigned int       seed;
+
+     pthread_mutex_t    lock;
+     pthread_cond_t     cond;
+     struct token       *queue;         /* in release order */
+     struct timespec    last;           /* release of the last in-order token */
+     int                eof;
+
+     unsigned long      tokens, dropped, reordered;
+};
+
+struct relay {
+     int                client;
+     int                server;
+     struct opts        *opts;
+     unsigned int       id;
+};
+
+void usage()
+{
+     fprintf(stderr, "Usage: gss-proxy [-port port] [-rtt ms] [-jitter ms]\n");
+     fprintf(stderr, "       [-bandwidth kbit/s] [-drop percent] [-reorder percent]\n");
+     fprintf(stderr, "       [-seed n] [-verbose] server_host server_port\n");
+     exit(1);
+}
+
+static void ts_add_us(struct timespec *ts, long us)
+{
+     ts->tv_sec += us / 1000000;
+     ts->tv_nsec += (us % 1000000) * 1000;
+     if (ts->tv_nsec >= 1000000000) {
+          ts->tv_sec++;
+          ts->tv_nsec -= 1000000000;
+     } else if (ts->tv_nsec < 0) {
+          ts->tv_sec--;
+          ts->tv_nsec += 1000000000;
+     }
+}
+
+static int ts_before(const struct timespec *a, const struct timespec *b)
+{
+     return a->tv_sec < b->tv_sec ||
+          (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static int read_all(int fd, unsigned char *buf, size_t len)
+{
+     ssize_t n;
+     size_t done;
+
+     for (done = 0; done < len; done += n) {
+          n = read(fd, buf + done, len - done);
+          if (n < 0 && errno == EINTR) {
+               n = 0;
+               continue;
+          }
+          if (n <= 0)
+               return -1;
+     }
+     return 0;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+     ssize_t n;
+     size_t done;
+
+     for (done = 0; done < len; done += n) {
+          n = send(fd, buf + done, len - done, MSG_NOSIGNAL);
+          if (n < 0 && errno == EINTR) {
+               n = 0;
+               continue;
+          }
+          if (n <= 0)
+               return -1;
+     }
+     return 0;
+}
+
+/*
+ * Function: flow_enqueue
+ *
+ * Purpose: schedules a token and queues it in release order
+ *
+ * Effects:
+ *
+ * The token is released half a round trip from now, give or take the
+ * jitter, but not before the previous token.  A reordered token is held
+ * back a further round trip and does not hold back the tokens after it.
+ */
+static void flow_enqueue(struct flow *p, struct token *t)
+{
+     struct opts *o = p->opts;
+     struct token **pp;
+     long us = o->delay_us;
+     int reorder;
+
+     if (o->jitter_us)
+          us += (long) (rand_r(&p->seed) % (2 * o->jitter_us + 1)) -
+               o->jitter_us;
+     if (us < 0)
+          us = 0;
+
+     clock_gettime(CLOCK_MONOTONIC, &t->release);
+     ts_add_us(&t->release, us);
+
+     pthread_mutex_lock(&p->lock);
+     reorder = o->reorder && (int) (rand_r(&p->seed) % 100) < o->reorder;
+     if (reorder) {
+          ts_add_us(&t->release, 2 * o->delay_us + 1000);
+          p->reordered++;
+     } else {
+          if (ts_before(&t->release, &p->last))
+               t->release = p->last;
+          p->last = t->release;
+     }
+
+     for (pp = &p->queue; *pp != NULL; pp = &(*pp)->next)
+          if (ts_before(&t->release, &(*pp)->release))
+               break;
+     t->next = *pp;
+     *pp = t;
+     p->tokens++;
+     pthread_cond_signal(&p->cond);
+     pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Function: flow_reader
+ *
+ * Purpose: reads tokens from one side of a connection and queues them
+ */
+static void *flow_reader(void *arg)
+{
+     struct flow *p = arg;
+     unsigned char hdr[4];
+     struct token *t;
+     uint32_t len;
+
+     while (read_all(p->src, hdr, sizeof(hdr)) == 0) {
+          len = (uint32_t) hdr[0] << 24 | hdr[1] << 16 | hdr[2] << 8 | hdr[3];
+          if (len > PROXY_MAX_TOKEN) {
+               fprintf(stderr, "%s: token of %u bytes is too long\n",
+                       p->name, len);
+               break;
+          }
+
+          if ((t = malloc(sizeof(*t))) == NULL ||
+              (t->data = malloc(sizeof(hdr) + len)) == NULL) {
+               free(t);
+               fprintf(stderr, "%s: out of memory\n", p->name);
+               break;
+          }
+          t->length = len;
+          memcpy(t->data, hdr, sizeof(hdr));
+          if (read_all(p->src, t->data + sizeof(hdr), len) < 0) {
+               free(t->data);
+               free(t);
+               break;
+          }
+
+          if (p->opts->drop &&
+              (int) (rand_r(&p->seed) % 100) < p->opts->drop) {
+               if (p->opts->verbose)
+                    printf("%s: dropped %u byte token\n", p->name, len);
+               p->dropped++;
+               free(t->data);
+               free(t);
+               continue;
+          }
+
+          flow_enqueue(p, t);
+     }
+
+     pthread_mutex_lock(&p->lock);
+     p->eof = 1;
+     pthread_cond_signal(&p->cond);
+     pthread_mutex_unlock(&p->lock);
+     return NULL;
+}
+
+/*
+ * Function: flow_writer
+ *
+ * Purpose: sends queued tokens to the other side as they fall due
+ *
+ * Effects:
+ *
+ * With a bandwidth cap, a token is sent only once the whole of it could
+ * have crossed the link, which is busy until the token before it has.
+ * When the reader is done and the queue is empty, the other side's
+ * write half is shut down, passing the end of stream along.
+ */
+static void *flow_writer(void *arg)
+{
+     struct flow *p = arg;
+     struct opts *o = p->opts;
+     struct timespec now, link = { 0, 0 };
+     struct token *t;
+     size_t size;
+
+     for (;;) {
+          pthread_mutex_lock(&p->lock);
+          for (;;) {
+               clock_gettime(CLOCK_MONOTONIC, &now);
+               if (p->queue && !ts_before(&now, &p->queue->release))
+                    break;
+               if (p->queue)
+                    pthread_cond_timedwait(&p->cond, &p->lock,
+                                           &p->queue->release);
+               else if (p->eof)
+                    break;
+               else
+                    pthread_cond_wait(&p->cond, &p->lock);
+          }
+          if ((t = p->queue) != NULL)
+               p->queue = t->next;
+          pthread_mutex_unlock(&p->lock);
+
+          if (t == NULL)
+               break;
+
+          size = sizeof(uint32_t) + t->length;
+          if (o->bandwidth) {
+               if (ts_before(&link, &now))
+                    link = now;
+               ts_add_us(&link, (long) ((double) size * 1000000 / o->bandwidth));
+               while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                      &link, NULL) == EINTR)
+                    ;
+          }
+
+          if (o->verbose)
+               printf("%s: %u byte token\n", p->name, t->length);
+
+          if (write_all(p->dst, t->data, size) < 0) {
+               free(t->data);
+               free(t);
+               /* wakes the reader, which ends this direction */
+               (void) shutdown(p->src, SHUT_RD);
+               break;
+          }
+          free(t->data);
+          free(t);
+     }
+
+     (void) shutdown(p->dst, SHUT_WR);
+     return NULL;
+}
+
+static void flow_init(struct flow *p, const char *name, int src, int dst,
+                      struct opts *opts, unsigned int seed)
+{
+     pthread_condattr_t attr;
+
+     memset(p, 0, sizeof(*p));
+     p->name = name;
+     p->src = src;
+     p->dst = dst;
+     p->opts = opts;
+     p->seed = seed;
+     pthread_mutex_init(&p->lock, NULL);
+     pthread_condattr_init(&attr);
+     pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+     pthread_cond_init(&p->cond, &attr);
+     pthread_condattr_destroy(&attr);
+}
+
+static void flow_destroy(struct flow *p)
+{
+     struct token *t;
+
+     while ((t = p->queue) != NULL) {
+          p->queue = t->next;
+          free(t->data);
+          free(t);
+     }
+     pthread_cond_destroy(&p->cond);
+     pthread_mutex_destroy(&p->lock);
+}
+
+/*
+ * Function: connect_server
+ *
+ * Purpose: opens a connection to the real server
+ *
+ * Returns: the socket, or -1 on failure
+ */
+static int connect_server(struct opts *o)
+{
+     struct addrinfo hints, *res, *ai;
+     int s = -1, err, on = 1;
+
+     memset(&hints, 0, sizeof(hints));
+     hints.ai_family = AF_UNSPEC;
+     hints.ai_socktype = SOCK_STREAM;
+
+     if ((err = getaddrinfo(o->host, o->port, &hints, &res)) != 0) {
+          fprintf(stderr, "%s: %s\n", o->host, gai_strerror(err));
+          return -1;
+     }
+
+     for (ai = res; ai != NULL; ai = ai->ai_next) {
+          if ((s = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                          ai->ai_protocol)) < 0)
+               continue;
+          if (connect(s, ai->ai_addr, ai->ai_addrlen) == 0)
+               break;
+          close(s);
+          s = -1;
+     }
+     if (s < 0)
+          perror("connecting to server");
+     else
+          (void) setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+     freeaddrinfo(res);
+     return s;
+}
+
+/*
+ * Function: relay_main
+ *
+ * Purpose: relays one client connection until both directions are done
+ */
+static void *relay_main(void *arg)
+{
+     struct relay *r = arg;
+     struct flow up, down;
+     pthread_t tids[3];
+
+     if ((r->server = connect_server(r->opts)) < 0) {
+          close(r->client);
+          free(r);
+          return NULL;
+     }
+
+     /* each connection gets its own sequence of random choices */
+     flow_init(&up, "client->server", r->client, r->server, r->opts,
+               r->opts->seed + 2 * r->id);
+     flow_init(&down, "server->client", r->server, r->client, r->opts,
+               r->opts->seed + 2 * r->id + 1);
+
+     pthread_create(&tids[0], NULL, flow_reader, &up);
+     pthread_create(&tids[1], NULL, flow_writer, &up);
+     pthread_create(&tids[2], NULL, flow_reader, &down);
+     flow_writer(&down);
+     pthread_join(tids[0], NULL);
+     pthread_join(tids[1], NULL);
+     pthread_join(tids[2], NULL);
+
+     if (r->opts->verbose)
+          printf("connection %u: %lu/%lu tokens up, %lu/%lu down "
+                 "(%lu/%lu dropped, %lu/%lu reordered)\n", r->id,
+                 up.tokens, up.tokens + up.dropped,
+                 down.tokens, down.tokens + down.dropped,
+                 up.dropped, down.dropped, up.reordered, down.reordered);
+
+     flow_destroy(&up);
+     flow_destroy(&down);
+     close(r->client);
+     close(r->server);
+     free(r);
+     return NULL;
+}
+
+static int create_socket(u_short port)
+{
+     struct sockaddr_in6 saddr;
+     int s, on = 1, off = 0;
+
+     memset(&saddr, 0, sizeof(saddr));
+     saddr.sin6_family = AF_INET6;
+     saddr.sin6_port = htons(port);
+     saddr.sin6_addr = in6addr_any;
+
+     if ((s = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+          perror("creating socket");
+          return -1;
+     }
+     (void) setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+     (void) setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+     if (bind(s, (struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
+          perror("binding socket");
+          close(s);
+          return -1;
+     }
+     if (listen(s, 128) < 0) {
+          perror("listening on socket");
+          close(s);
+          return -1;
+     }
+     return s;
+}
+
+int main(int argc, char **argv)
+{
+     struct opts opts;
+     struct relay *r;
+     pthread_t tid;
+     u_short port = 4445;
+     unsigned int id = 0;
+     int s, c, on = 1;
+
+     memset(&opts, 0, sizeof(opts));
+     argc--; argv++;
+     while (argc) {
+          if (strcmp(*argv, "-port") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               port = atoi(*argv);
+          } else if (strcmp(*argv, "-rtt") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               opts.delay_us = atof(*argv) * 1000 / 2;
+          } else if (strcmp(*argv, "-jitter") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               opts.jitter_us = atof(*argv) * 1000;
+          } else if (strcmp(*argv, "-bandwidth") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               opts.bandwidth = atol(*argv) * 1000 / 8;
+          } else if (strcmp(*argv, "-drop") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               opts.drop = atoi(*argv);
+          } else if (strcmp(*argv, "-reorder") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               opts.reorder = atoi(*argv);
+          } else if (strcmp(*argv, "-seed") == 0) {
+               argc--; argv++;
+               if (!argc) usage();
+               opts.seed = strtoul(*argv, NULL, 0);
+          } else if (strcmp(*argv, "-verbose") == 0) {
+               opts.verbose = 1;
+          } else
+               break;
+          argc--; argv++;
+     }
+     if (argc != 2 || (*argv)[0] == '-')
+          usage();
+     opts.host = argv[0];
+     opts.port = argv[1];
+
+     if ((s = create_socket(port)) < 0)
+          return 1;
+
+     setvbuf(stdout, NULL, _IOLBF, 0);
+
+     for (;;) {
+          if ((c = accept4(s, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+               if (errno != EINTR)
+                    perror("accepting connection");
+               continue;
+          }
+          (void) setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+          if ((r = calloc(1, sizeof(*r))) == NULL) {
+               fprintf(stderr, "out of memory\n");
+               close(c);
+               continue;
+          }
+          r->client = c;
+          r->opts = &opts;
+          r->id = id++;
+          if ((errno = pthread_create(&tid, NULL, relay_main, r)) != 0) {
+               perror("starting relay thread");
+               close(c);
+               free(r);
+               continue;
+          }
+          pthread_detach(tid);
+     }
+}
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+
+#include "gss-queue.h"
+
+/*
+ * Function: queue_init
+ *
+ * Purpose: initializes a queue
+ *
+ * Arguments:
+ *
+ *      q               (w) the queue
+ *      size            (r) the capacity, a power of two of at least 2
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int queue_init(struct queue *q, size_t size)
+{
+     size_t i;
+
+     if (size < 2 || (size & (size - 1)) != 0)
+          return -1;
+
+     if ((q->cells = calloc(size, sizeof(*q->cells))) == NULL)
+          return -1;
+
+     for (i = 0; i < size; i++)
+          atomic_init(&q->cells[i].seq, i);
+
+     q->mask = size - 1;
+     atomic_init(&q->enqueue_pos, 0);
+     atomic_init(&q->dequeue_pos, 0);
+
+     return 0;
+}
+
+void queue_destroy(struct queue *q)
+{
+     free(q->cells);
+     q->cells = NULL;
+}
+
+/*
+ * Function: queue_push
+ *
+ * Purpose: adds an item to the tail of the queue
+ *
+ * Returns: 0 on success, -1 if the queue is full
+ */
+int queue_push(struct queue *q, void *data)
+{
+     struct queue_cell *cell;
+     size_t pos, seq;
+     ptrdiff_t diff;
+
+     pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+     for (;;) {
+          cell = &q->cells[pos & q->mask];
+          seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+          diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+
+          if (diff == 0) {
+               /* the cell is free on this lap, try to claim it */
+               if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos,
+                                                         &pos, pos + 1,
+                                                         memory_order_relaxed,
+                                                         memory_order_relaxed))
+                    break;
+          } else if (diff < 0) {
+               /* the cell still holds an item from the previous lap */
+               return -1;
+          } else {
+               pos = atomic_load_explicit(&q->enqueue_pos,
+                                          memory_order_relaxed);
+          }
+     }
+
+     cell->data = data;
+     atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+     return 0;
+}
+
+/*
+ * Function: queue_pop
+ *
+ * Purpose: removes the item at the head of the queue
+ *
+ * Returns: 0 on success, -1 if the queue is empty
+ *
+ * Effects:
+ *
+ * A push that has claimed the head cell but not yet stored its item
+ * makes the queue look empty, so a consumer that knows an item is
+ * coming (eg. from a semaphore) should retry.
+ */
+int queue_pop(struct queue *q, void **data)
+{
+     struct queue_cell *cell;
+     size_t pos, seq;
+     ptrdiff_t diff;
+
+     pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+     for (;;) {
+          cell = &q->cells[pos & q->mask];
+          seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+          diff = (ptrdiff_t) seq - (ptrdiff_t) (pos + 1);
+
+          if (diff == 0) {
+               if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos,
+                                                         &pos, pos + 1,
+                                                         memory_order_relaxed,
+                                                         memory_order_relaxed))
+                    break;
+          } else if (diff < 0) {
+               return -1;
+          } else {
+               pos = atomic_load_explicit(&q->dequeue_pos,
+                                          memory_order_relaxed);
+          }
+     }
+
+     *data = cell->data;
+     atomic_store_explicit(&cell->seq, pos + q->mask + 1,
+                           memory_order_release);
+
+     return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * A bounded multi-producer, multi-consumer queue of pointers (Dmitry
+ * Vyukov's array queue).  Each cell carries a sequence number that tells
+ * producers and consumers whether it is free or full for the current lap,
+ * so pushing and popping is a single compare-and-swap on the shared
+ * position with no locks.  The queue never blocks: callers that need to
+ * sleep pair it with a semaphore or eventfd.
+ */
+
+#define QUEUE_CACHELINE         64
+
+struct queue_cell {
+     atomic_size_t      seq;
+     void               *data;
+};
+
+struct queue {
+     struct queue_cell  *cells;
+     size_t             mask;
+     char               pad0[QUEUE_CACHELINE];
+     atomic_size_t      enqueue_pos;
+     char               pad1[QUEUE_CACHELINE];
+     atomic_size_t      dequeue_pos;
+     char               pad2[QUEUE_CACHELINE];
+};
+
+int queue_init(struct queue *q, size_t size);
+void queue_destroy(struct queue *q);
+int queue_push(struct queue *q, void *data);
+int queue_pop(struct queue *q, void **data);
@@ -26,19 +26,35 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
 
 #include <gssapi/gssapi.h>
 #include "gss-misc.h"
+#include "gss-probes.h"
+#include "gss-lucid.h"
+#include "gss-handoff.h"
+#include "gss-event.h"
+#include "gss-uring.h"
+#include "gss-creds.h"
+#include "gss-topn.h"
 
 #include <string.h>
 
 void usage()
 {
      fprintf(stderr, "Usage: gss-server [-port port] [-verbose]\n");
-     fprintf(stderr, "       [-inetd] [-logfile file] [service_name]\n");
+     fprintf(stderr, "       [-inetd] [-export] [-lucid] [-handoff] [-logfile file]\n");
+     fprintf(stderr, "       [-event] [-io-threads n] [-workers n] [-uring]\n");
+     fprintf(stderr, "       [-refresh secs] [-stats file] [-fastopen]\n");
+     fprintf(stderr, "       [-lucid-file file]\n");
+     fprintf(stderr, "       [service_name]\n");
      exit(1);
 }
 
@@ -46,6 +62,20 @@ FILE *logger;
 
 int verbose = 0;
 
+/* accept TCP Fast Open connections, set by -fastopen */
+int fast_open = 0;
+
+/* connections that may be waiting on Fast Open data before the handshake */
+#define FAST_OPEN_QUEUE 16
+
+/* where -export saves serialized lucid contexts, set by -lucid-file */
+char *lucid_file = NULL;
+
+int wait_for_message(int s);
+int save_lucid_context(gss_buffer_t token);
+int serve_message(int s, gss_ctx_id_t context, OM_uint32 ret_flags,
+                  int use_lucid);
+
 /*
  * Function: server_acquire_creds
  *
@@ -116,7 +146,8 @@ int server_acquire_creds(service_name, server_creds)
  * Any valid client request is accepted.  If a context is established,
  * its handle is returned in context and the client name is returned
  * in client_name and 0 is returned.  If unsuccessful, an error
- * message is displayed and -1 is returned.
+ * message is displayed, any partly established context is deleted and
+ * -1 is returned.
  */
 int server_establish_context(s, server_creds, context, client_name, \
      ret_flags)
@@ -128,22 +159,29 @@ int server_establish_context(s, server_creds, context, client_name, \
      OM_uint32 *ret_flags;
 {
      gss_buffer_desc send_tok, recv_tok;
-     gss_name_t client;
+     gss_name_t client = GSS_C_NO_NAME;
      gss_OID doid;
      OM_uint32 maj_stat, min_stat, acc_sec_min_stat;
      gss_buffer_desc    oid_name;
+     uint64_t cpu_ns = 0, start;
 
      *context = GSS_C_NO_CONTEXT;
      
      do {
-          if (recv_token(s, &recv_tok) < 0)
-               return -1;
+          if (recv_token(s, &recv_tok) < 0) {
+               /* a client that hangs up mid-handshake counts as a failure */
+               if (*context != GSS_C_NO_CONTEXT)
+                    topn_record(NULL, 0, s, cpu_ns, 1);
+               goto fail;
+          }
 
           if (verbose && logger) {
               fprintf(logger, "Received token (size=%ld): \n", recv_tok.length);
               print_token(&recv_tok);
           }
 
+          GSS_PROBE1(accept_start, recv_tok.length);
+          start = topn_cpu_ns();
           maj_stat =
                gss_accept_sec_context(&acc_sec_min_stat,
                                       context,
@@ -156,6 +194,9 @@ int server_establish_context(s, server_creds, context, client_name, \
                                       ret_flags,
                                       NULL,     /* ignore time_rec */
                                       NULL);    /* ignore del_cred_handle */
+          cpu_ns += topn_cpu_ns() - start;
+          GSS_PROBE3(accept_done, send_tok.length, maj_stat,
+                     acc_sec_min_stat);
 
           (void) gss_release_buffer(&min_stat, &recv_tok);
 
@@ -168,7 +209,9 @@ int server_establish_context(s, server_creds, context, client_name, \
               }
               if (send_token(s, &send_tok) < 0) {
                   fprintf(logger, "failure sending token\n");
-                  return -1;
+                  topn_record(NULL, 0, s, cpu_ns, 1);
+                  (void) gss_release_buffer(&min_stat, &send_tok);
+                  goto fail;
               }
 
               (void) gss_release_buffer(&min_stat, &send_tok);
@@ -176,10 +219,8 @@ int server_establish_context(s, server_creds, context, client_name, \
           if (maj_stat!=GSS_S_COMPLETE && maj_stat!=GSS_S_CONTINUE_NEEDED) {
               display_status("accepting context", maj_stat,
                               acc_sec_min_stat);
-              if (*context == GSS_C_NO_CONTEXT)
-                       gss_delete_sec_context(&min_stat, context,
-                                              GSS_C_NO_BUFFER);
-              return -1;
+              topn_record(NULL, 0, s, cpu_ns, 1);
+              goto fail;
           }
 
           if (verbose && logger) {
@@ -198,7 +239,7 @@ int server_establish_context(s, server_creds, context, client_name, \
          maj_stat = gss_oid_to_str(&min_stat, doid, &oid_name);
          if (maj_stat != GSS_S_COMPLETE) {
              display_status("converting oid->string", maj_stat, min_stat);
-             return -1;
+             goto fail;
          }
          fprintf(logger, "Accepted connection using mechanism OID %.*s.\n",
                  (int) oid_name.length, (char *) oid_name.value);
@@ -208,14 +249,24 @@ int server_establish_context(s, server_creds, context, client_name, \
      maj_stat = gss_display_name(&min_stat, client, client_name, &doid);
      if (maj_stat != GSS_S_COMPLETE) {
           display_status("displaying name", maj_stat, min_stat);
-          return -1;
+          topn_record(NULL, 0, s, cpu_ns, 1);
+          goto fail;
      }
+     topn_record(client_name->value, client_name->length, s, cpu_ns, 0);
      maj_stat = gss_release_name(&min_stat, &client);
      if (maj_stat != GSS_S_COMPLETE) {
           display_status("releasing name", maj_stat, min_stat);
-          return -1;
+          (void) gss_release_buffer(&min_stat, client_name);
+          goto fail;
      }
      return 0;
+
+fail:
+     if (client != GSS_C_NO_NAME)
+          (void) gss_release_name(&min_stat, &client);
+     if (*context != GSS_C_NO_CONTEXT)
+          (void) gss_delete_sec_context(&min_stat, context, GSS_C_NO_BUFFER);
+     return -1;
 }
 
 /*
@@ -233,30 +284,71 @@ int server_establish_context(s, server_creds, context, client_name, \
  *
  * A listening socket on the specified port is created and returned.
  * On error, an error message is displayed and -1 is returned.
+ *
+ * The socket is dual-stack, accepting both IPv6 and IPv4 connections,
+ * unless the system has no IPv6, in which case it is IPv4 only.  A
+ * fast open client sends to the first address its resolver returns,
+ * and for "localhost" that is usually ::1.
+ *
+ * If fast_open is set, TCP Fast Open is enabled on the socket so that
+ * a client's first context token can arrive with its SYN and be
+ * processed before the handshake completes.  The server side must be
+ * enabled in net.ipv4.tcp_fastopen (bit 2); if it is not, clients fall
+ * back to an ordinary handshake.
  */
 int create_socket(port)
      u_short port;
 {
+     struct sockaddr_in6 saddr6;
      struct sockaddr_in saddr;
+     struct sockaddr *sa;
+     socklen_t salen;
      int s;
-     int on = 1;
+     int on = 1, off = 0;
      
+     memset(&saddr6, 0, sizeof(saddr6));
+     saddr6.sin6_family = AF_INET6;
+     saddr6.sin6_port = htons(port);
+     saddr6.sin6_addr = in6addr_any;
+
+     memset(&saddr, 0, sizeof(saddr));
      saddr.sin_family = AF_INET;
      saddr.sin_port = htons(port);
      saddr.sin_addr.s_addr = INADDR_ANY;
 
-     if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+     if ((s = socket(AF_INET6, SOCK_STREAM, 0)) >= 0) {
+          /* Accept IPv4 connections too, as IPv4-mapped addresses */
+          (void) setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&off,
+               sizeof(off));
+          sa = (struct sockaddr *) &saddr6;
+          salen = sizeof(saddr6);
+     } else if (errno == EAFNOSUPPORT &&
+                (s = socket(AF_INET, SOCK_STREAM, 0)) >= 0) {
+          sa = (struct sockaddr *) &saddr;
+          salen = sizeof(saddr);
+     } else {
           perror("creating socket");
           return -1;
      }
      /* Let the socket be reused right away */
      (void) setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&on, 
           sizeof(on));
-     if (bind(s, (struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
+     if (bind(s, sa, salen) < 0) {
           perror("binding socket");
           (void) close(s);
           return -1;
      }
+     if (fast_open) {
+#ifdef TCP_FASTOPEN
+          int qlen = FAST_OPEN_QUEUE;
+
+          if (setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN, (char *)&qlen,
+                         sizeof(qlen)) < 0)
+               perror("setting TCP_FASTOPEN");
+#else
+          fprintf(stderr, "TCP Fast Open is not supported on this system\n");
+#endif
+     }
      if (listen(s, 5) < 0) {
           perror("listening on socket");
           (void) close(s);
@@ -303,6 +395,7 @@ int export_context(context)
         if (copied_token.value == 0) {
             fprintf(logger, "Couldn't allocate memory to copy context \
                 token.\n");
+            (void) gss_release_buffer(&min_stat, &context_token);
             return 1;
         }
         memcpy(copied_token.value, context_token.value, \
@@ -311,6 +404,8 @@ int export_context(context)
             context);
         if (maj_stat != GSS_S_COMPLETE) {
                 display_status("importing context", maj_stat, min_stat);
+                free(copied_token.value);
+                (void) gss_release_buffer(&min_stat, &context_token);
                 return 1;
         }
         free(copied_token.value);
@@ -319,9 +414,86 @@ int export_context(context)
                 fprintf(logger, "Importing context: %7.4f seconds\n",
                         timeval_subtract(&tm1, &tm2));
         (void) gss_release_buffer(&min_stat, &context_token);
+
+        /*
+         * And in the form that the Go krb5 package can import, so that
+         * another process can carry on with the context.  The serialized
+         * context holds the session keys, so it only ever goes to the
+         * file given with -lucid-file.
+         */
+        if (lucid_file == NULL)
+                return 0;
+
+        switch (lucid_serialize(context, &context_token)) {
+        case -1:
+                /* the context is gone only if it could not be re-imported */
+                if (*context == GSS_C_NO_CONTEXT)
+                        return 1;
+                fprintf(stderr, "Couldn't serialize lucid context, continuing\n");
+                break;
+        case 0:
+                if (save_lucid_context(&context_token) < 0)
+                        fprintf(stderr, "Couldn't save lucid context, continuing\n");
+                memset(context_token.value, 0, context_token.length);
+                free(context_token.value);
+                break;
+        }
         return 0;
 }
 
+/*
+ * Function: save_lucid_context
+ *
+ * Purpose: appends a serialized lucid context to the -lucid-file file
+ *
+ * Arguments:
+ *
+ *      token           (r) the serialized context
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * The context is written framed as by send_token.  The file is created
+ * with mode 0600, and an existing file that the group or others can
+ * access is refused, since the context holds the session keys.
+ */
+int save_lucid_context(token)
+     gss_buffer_t token;
+{
+     struct stat st;
+     int fd, ret;
+
+     if ((fd = open(lucid_file, O_WRONLY | O_CREAT | O_APPEND, 0600)) < 0) {
+          perror(lucid_file);
+          return -1;
+     }
+
+     if (fstat(fd, &st) < 0) {
+          perror(lucid_file);
+          (void) close(fd);
+          return -1;
+     }
+     if (st.st_mode & (S_IRWXG | S_IRWXO)) {
+          fprintf(stderr, "%s: must not be accessible by group or others\n",
+                  lucid_file);
+          (void) close(fd);
+          return -1;
+     }
+
+     ret = send_token(fd, token);
+     if (close(fd) < 0) {
+          perror(lucid_file);
+          ret = -1;
+     }
+
+     if (ret == 0 && verbose && logger)
+          fprintf(logger, "Saved serialized lucid context: %ld bytes\n",
+                  (long) token->length);
+
+     return ret;
+}
+
 
 /*
  * Function: sign_server
@@ -334,8 +506,13 @@ int export_context(context)
  *                      accept()ed
  *      service_name    (r) the ASCII name of the GSS-API service to
  *                      establish a context as
+ *      export_ctx      (r) export and re-import the context once established
+ *      use_lucid       (r) protect messages using a lucid context
+ *      handoff_ctx     (w) the established context, if the connection is
+ *                      to be handed to a new process, or NULL if handoff
+ *                      is not enabled
  * 
- * Returns: -1 on error
+ * Returns: -1 on error, 1 if the connection is to be handed off
  *
  * Effects:
  *
@@ -346,18 +523,24 @@ int export_context(context)
  * to the sender.  The context is then destroyed and the connection
  * closed.
  *
+ * If a handoff is requested while the server waits for the sealed
+ * message, the context is returned in handoff_ctx and 1 is returned
+ * without reading from the connection, so that the new process can
+ * carry on with the request.
+ *
  * If any error occurs, -1 is returned.
  */
-int sign_server(s, server_creds, export_ctx)
+int sign_server(s, server_creds, export_ctx, use_lucid, handoff_ctx)
      int s;
      gss_cred_id_t server_creds;
      int export_ctx;
+     int use_lucid;
+     gss_ctx_id_t *handoff_ctx;
 {
-     gss_buffer_desc client_name, xmit_buf, msg_buf;
+     gss_buffer_desc client_name;
      gss_ctx_id_t context;
-     OM_uint32 maj_stat, min_stat;
-     int conf_state, ret_flags;
-     char       *cp;
+     OM_uint32 min_stat;
+     int ret_flags;
      
      /* Establish a context with the client */
      if (server_establish_context(s, server_creds, &context,
@@ -370,28 +553,129 @@ int sign_server(s, server_creds, export_ctx)
 
     if( export_ctx )
         if (export_context(&context))
-            return -1;
+            goto fail;
+
+     if (handoff_ctx != NULL) {
+        switch (wait_for_message(s)) {
+        case -1:
+            goto fail;
+        case 1:
+            *handoff_ctx = context;
+            return 1;
+        }
+     }
+
+     return serve_message(s, context, ret_flags, use_lucid);
+
+fail:
+     if (context != GSS_C_NO_CONTEXT)
+        (void) gss_delete_sec_context(&min_stat, &context, GSS_C_NO_BUFFER);
+     return -1;
+}
+
+/*
+ * Function: wait_for_message
+ *
+ * Purpose: waits for the client to send its message, or for a handoff
+ *
+ * Arguments:
+ *
+ *      s               (r) the connection to the client
+ *
+ * Returns: 0 if the message is ready to be read, 1 if a handoff has been
+ * requested, or -1 on error
+ */
+int wait_for_message(s)
+     int s;
+{
+     int ret;
+
+     if ((ret = handoff_wait(s)) < 0)
+          perror("waiting for message");
+
+     return ret;
+}
+
+/*
+ * Function: serve_message
+ *
+ * Purpose: Performs a sign request on an established context.
+ *
+ * Arguments:
+ *
+ *      s               (r) the connection to the client
+ *      context         (r) the established GSS-API context
+ *      ret_flags       (r) the context flags
+ *      use_lucid       (r) protect messages using a lucid context
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * The sealed token is received and unsealed, and a signature block
+ * for the message is returned to the sender.  The context is then
+ * destroyed, as it is if anything fails.
+ *
+ * With use_lucid the context is exported as a lucid context, and the
+ * token is unsealed and the signature block produced by gss-lucid.c
+ * rather than the GSS-API library, if the context's encryption type is
+ * supported.
+ */
+int serve_message(s, context, ret_flags, use_lucid)
+     int s;
+     gss_ctx_id_t context;
+     OM_uint32 ret_flags;
+     int use_lucid;
+{
+     gss_buffer_desc xmit_buf, msg_buf, mic_buf;
+     OM_uint32 maj_stat, min_stat;
+     int conf_state;
+     int ret = -1;
+     char       *cp;
+     lucid_ctx_t lctx = NULL;
+     unsigned char mic[LUCID_MIC_LENGTH];
+
+     xmit_buf.length = msg_buf.length = mic_buf.length = 0;
+     xmit_buf.value = msg_buf.value = mic_buf.value = NULL;
+
+     if (use_lucid) {
+        if (lucid_import(&context, ret_flags, &lctx) < 0)
+            goto out;
+        if (verbose && logger)
+            fprintf(logger, lctx ? "Using lucid context\n" :
+                    "Lucid context not supported, using GSS-API\n");
+     }
 
 
      /* Receive the sealed message token */
      if (recv_token(s, &xmit_buf) < 0)
-        return(-1);
+        goto out;
           
      if (verbose && logger) {
         fprintf(logger, "Sealed message token:\n");
         print_token(&xmit_buf);
      }
 
-     maj_stat = gss_unwrap(&min_stat, context, &xmit_buf, &msg_buf,
-                           &conf_state, (gss_qop_t *) NULL);
+     /* a lucid unwrap is done in place, msg_buf points into xmit_buf */
+     GSS_PROBE1(unwrap_start, xmit_buf.length);
+     if (lctx) {
+        min_stat = 0;
+        maj_stat = lucid_unwrap(lctx, &xmit_buf, &msg_buf, &conf_state);
+     } else {
+        maj_stat = gss_unwrap(&min_stat, context, &xmit_buf, &msg_buf,
+                              &conf_state, (gss_qop_t *) NULL);
+     }
+     GSS_PROBE3(unwrap_done, maj_stat == GSS_S_COMPLETE ? msg_buf.length : 0,
+                maj_stat, min_stat);
      if (maj_stat != GSS_S_COMPLETE) {
         display_status("unsealing message", maj_stat, min_stat);
-        return(-1);
+        goto out;
      } else if (! conf_state) {
         fprintf(stderr, "Warning!  Message not encrypted.\n");
      }
 
-     (void) gss_release_buffer(&min_stat, &xmit_buf);
+     if (!lctx)
+        (void) gss_release_buffer(&min_stat, &xmit_buf);
 
      fprintf(logger, "Received message: ");
      cp = msg_buf.value;
@@ -404,39 +688,160 @@ int sign_server(s, server_creds, export_ctx)
      }
           
      /* Produce a signature block for the message */
-     maj_stat = gss_get_mic(&min_stat, context, GSS_C_QOP_DEFAULT,
-                            &msg_buf, &xmit_buf);
+     GSS_PROBE1(get_mic_start, msg_buf.length);
+     if (lctx) {
+        mic_buf.value = mic;
+        mic_buf.length = sizeof(mic);
+        min_stat = 0;
+        maj_stat = lucid_get_mic(lctx, &msg_buf, &mic_buf);
+     } else {
+        maj_stat = gss_get_mic(&min_stat, context, GSS_C_QOP_DEFAULT,
+                               &msg_buf, &mic_buf);
+     }
+     GSS_PROBE3(get_mic_done, maj_stat == GSS_S_COMPLETE ? mic_buf.length : 0,
+                maj_stat, min_stat);
      if (maj_stat != GSS_S_COMPLETE) {
         display_status("signing message", maj_stat, min_stat);
-        return(-1);
+        goto out;
      }
 
-     (void) gss_release_buffer(&min_stat, &msg_buf);
-
      if (verbose && logger) {
         fprintf(logger, "Reply MIC token:\n");
-        print_token(&xmit_buf);
+        print_token(&mic_buf);
      }
 
      /* Send the signature block to the client */
-     if (send_token(s, &xmit_buf) < 0)
-        return(-1);
+     if (send_token(s, &mic_buf) < 0)
+        goto out;
 
+     ret = 0;
+
+out:
+     /* with a lucid context msg_buf and mic_buf are not allocated */
      (void) gss_release_buffer(&min_stat, &xmit_buf);
+     if (lctx) {
+        lucid_free(lctx);
+     } else {
+        (void) gss_release_buffer(&min_stat, &msg_buf);
+        (void) gss_release_buffer(&min_stat, &mic_buf);
+     }
 
      /* Delete context */
-     maj_stat = gss_delete_sec_context(&min_stat, &context, NULL);
-     if (maj_stat != GSS_S_COMPLETE) {
-        display_status("deleting context", maj_stat, min_stat);
-        return(-1);
+     if (context != GSS_C_NO_CONTEXT) {
+        maj_stat = gss_delete_sec_context(&min_stat, &context, NULL);
+        GSS_PROBE2(delete_context, maj_stat, min_stat);
+        if (maj_stat != GSS_S_COMPLETE) {
+           display_status("deleting context", maj_stat, min_stat);
+           ret = -1;
+        }
      }
 
      fflush(logger);
 
-     return(0);
+     return ret;
+}
+
+/*
+ * Function: context_flags
+ *
+ * Purpose: returns the flags of an established context, or 0 if they
+ * cannot be determined
+ */
+OM_uint32 context_flags(context)
+     gss_ctx_id_t context;
+{
+     OM_uint32 maj_stat, min_stat, flags;
+
+     maj_stat = gss_inquire_context(&min_stat, context, NULL, NULL, NULL,
+                                    NULL, &flags, NULL, NULL);
+     if (maj_stat != GSS_S_COMPLETE) {
+          display_status("inquiring context", maj_stat, min_stat);
+          return 0;
+     }
+
+     return flags;
+}
+
+/*
+ * Function: resume_server
+ *
+ * Purpose: takes over from the server process that started this one
+ *
+ * Arguments:
+ *
+ *      fd              (r) the handoff socket
+ *      use_lucid       (r) protect messages using a lucid context
+ *
+ * Returns: the listening socket, or -1 on failure
+ *
+ * Effects:
+ *
+ * The listening socket and the connections that were waiting for a
+ * message are received from the old process, and the request on each
+ * connection is completed before the listening socket is returned.
+ */
+int resume_server(fd, use_lucid)
+     int fd;
+     int use_lucid;
+{
+     struct handoff_conn conns[HANDOFF_MAX_CONNS];
+     int listen_fd, nconns, i;
+
+     if (handoff_receive(fd, &listen_fd, conns, HANDOFF_MAX_CONNS,
+                         &nconns) < 0)
+          return -1;
+
+     if (verbose && logger)
+          fprintf(logger, "Took over %d connection(s) from previous server\n",
+                  nconns);
+
+     for (i = 0; i < nconns; i++) {
+          serve_message(conns[i].fd, conns[i].context,
+                        context_flags(conns[i].context), use_lucid);
+          close(conns[i].fd);
+     }
+
+     return listen_fd;
 }
 
+/*
+ * Function: handoff_server
+ *
+ * Purpose: hands the server over to a new process
+ *
+ * Arguments:
+ *
+ *      stmp            (r) the listening socket
+ *      s               (r) a connection waiting for a message, or -1
+ *      context         (r) the connection's context
+ *      use_lucid       (r) protect messages using a lucid context
+ *
+ * Effects:
+ *
+ * If the new process takes over, this process exits.  Otherwise the
+ * request on the connection, if any, is completed here.
+ */
+void handoff_server(stmp, s, context, use_lucid)
+     int stmp;
+     int s;
+     gss_ctx_id_t context;
+     int use_lucid;
+{
+     struct handoff_conn conn;
 
+     handoff_requested = 0;
+     conn.fd = s;
+     conn.context = context;
+
+     if (handoff_send(stmp, &conn, s < 0 ? 0 : 1) == 0)
+          exit(0);
+
+     fprintf(stderr, "Handoff failed, continuing\n");
+
+     if (s >= 0 && conn.context != GSS_C_NO_CONTEXT)
+          serve_message(s, conn.context, context_flags(conn.context),
+                        use_lucid);
+}
 
 int
 main(argc, argv)
@@ -444,13 +849,24 @@ main(argc, argv)
      char **argv;
 {
      char *service_name;
-     gss_cred_id_t server_creds;
-     OM_uint32 min_stat;
+     struct creds *creds;
      u_short port = 4444;
-     int s;
+     int s, ret;
      int once = 0;
      int do_inetd = 0;
      int export_ctx = 0;
+     int use_lucid = 0;
+     int handoff = 0;
+     int handoff_fd = -1;
+     int event = 0;
+     int io_threads = 1;
+     int workers = 4;
+     int use_uring = 0;
+     int refresh = 0;
+     char *stats_file = NULL;
+     int orig_argc = argc;
+     char **orig_argv = argv;
+     gss_ctx_id_t context;
 
      logger = stdout;
      display_file = stdout;
@@ -468,6 +884,40 @@ main(argc, argv)
               do_inetd = 1;
           } else if (strcmp(*argv, "-export") == 0) {
               export_ctx = 1;
+          } else if (strcmp(*argv, "-lucid") == 0) {
+              use_lucid = 1;
+          } else if (strcmp(*argv, "-handoff") == 0) {
+              handoff = 1;
+          } else if (strcmp(*argv, HANDOFF_FD_OPTION) == 0) {
+              argc--; argv++;
+              if (!argc) usage();
+              handoff_fd = atoi(*argv);
+          } else if (strcmp(*argv, "-event") == 0) {
+              event = 1;
+          } else if (strcmp(*argv, "-io-threads") == 0) {
+              argc--; argv++;
+              if (!argc) usage();
+              io_threads = atoi(*argv);
+          } else if (strcmp(*argv, "-workers") == 0) {
+              argc--; argv++;
+              if (!argc) usage();
+              workers = atoi(*argv);
+          } else if (strcmp(*argv, "-uring") == 0) {
+              use_uring = 1;
+          } else if (strcmp(*argv, "-fastopen") == 0) {
+              fast_open = 1;
+          } else if (strcmp(*argv, "-lucid-file") == 0) {
+              argc--; argv++;
+              if (!argc) usage();
+              lucid_file = *argv;
+          } else if (strcmp(*argv, "-refresh") == 0) {
+              argc--; argv++;
+              if (!argc) usage();
+              refresh = atoi(*argv);
+          } else if (strcmp(*argv, "-stats") == 0) {
+              argc--; argv++;
+              if (!argc) usage();
+              stats_file = *argv;
           } else if (strcmp(*argv, "-logfile") == 0) {
               argc--; argv++;
               if (!argc) usage();
@@ -489,28 +939,85 @@ main(argc, argv)
 
      service_name = *argv;
 
-     if (server_acquire_creds(service_name, &server_creds) < 0)
+     /* only the blocking server waits in handoff_wait */
+     if (handoff && (event || use_uring)) {
+         fprintf(stderr, "-handoff cannot be used with -event or -uring\n");
+         usage();
+     }
+
+     /* before any other thread starts, so that they all block SIGHUP */
+     if (handoff && !do_inetd && handoff_init(orig_argc, orig_argv) < 0)
          return -1;
-     
+
+     /* before any other thread starts, so that they all block SIGUSR1 */
+     if (stats_file && topn_init(stats_file) < 0)
+         return -1;
+
+     /* a connection from inetd is served before a refresh would be due */
+     if (creds_init(service_name, server_acquire_creds,
+                    do_inetd ? 0 : refresh) < 0)
+         return -1;
+
      if (do_inetd) {
          close(1);
          close(2);
 
-         sign_server(0, server_creds);
+         creds = creds_get();
+         sign_server(0, creds->cred, export_ctx, use_lucid, NULL);
+         creds_put(creds);
          close(0);
      } else {
          int stmp;
 
-         if ((stmp = create_socket(port)) >= 0) {
+         if (handoff_fd >= 0)
+             stmp = resume_server(handoff_fd, use_lucid);
+         else
+             stmp = create_socket(port);
+
+         if (stmp >= 0 && use_uring) {
+             switch (uring_server(stmp, use_lucid)) {
+             case 1:
+                 /* falls through to the other servers */
+                 fprintf(stderr, "io_uring not available, using %s server\n",
+                         event ? "epoll" : "blocking");
+                 break;
+             case -1:
+                 /* its connections are already closed, so don't carry on */
+                 fprintf(stderr, "io_uring server failed, exiting\n");
+                 close(stmp);
+                 creds_release();
+                 exit(1);
+             }
+         }
+
+         if (stmp >= 0 && event) {
+             /* serves connections until killed */
+             event_server(stmp, use_lucid, io_threads, workers);
+         } else if (stmp >= 0) {
              do {
+                 /* SIGHUP is only let through while waiting here */
+                 if (handoff && (ret = handoff_wait(stmp)) != 0) {
+                     if (ret == 1)
+                         handoff_server(stmp, -1, GSS_C_NO_CONTEXT, use_lucid);
+                     else
+                         perror("waiting for connection");
+                     continue;
+                 }
+
                  /* Accept a TCP connection */
                  if ((s = accept(stmp, NULL, 0)) < 0) {
-                     perror("accepting connection");
+                     if (errno != EINTR)
+                         perror("accepting connection");
                      continue;
                  }
                  /* this return value is not checked, because there's
                     not really anything to do if it fails */
-                 sign_server(s, server_creds, export_ctx);
+                 creds = creds_get();
+                 ret = sign_server(s, creds->cred, export_ctx, use_lucid,
+                                   handoff ? &context : NULL);
+                 creds_put(creds);
+                 if (ret == 1)
+                     handoff_server(stmp, s, context, use_lucid);
                  close(s);
              } while (!once);
 
@@ -518,7 +1025,7 @@ main(argc, argv)
          }
      }
 
-     (void) gss_release_cred(&min_stat, &server_creds);
+     creds_release();
 
      /*NOTREACHED*/
      (void) close(s);
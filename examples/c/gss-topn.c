@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "gss-topn.h"
+
+static int enabled;
+static const char *stats_path;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct topn handshakes = { "handshakes" };
+static struct topn cpu = { "handshake CPU time (us)" };
+static struct topn failures = { "failed handshakes" };
+
+/*
+ * Function: topn_add
+ *
+ * Purpose: adds weight to a client's entry in a table
+ *
+ * Effects:
+ *
+ * A client not in the table takes a free slot, or else replaces the
+ * entry with the least weight, starting from that weight.
+ */
+static void topn_add(struct topn *t, const char *name, uint64_t weight)
+{
+     struct topn_entry *e, *min = NULL;
+     int i;
+
+     t->total += weight;
+
+     for (i = 0; i < t->used; i++) {
+          e = &t->slots[i];
+          if (strcmp(e->name, name) == 0) {
+               e->weight += weight;
+               return;
+          }
+          if (min == NULL || e->weight < min->weight)
+               min = e;
+     }
+
+     if (t->used < TOPN_SLOTS) {
+          e = &t->slots[t->used++];
+          e->weight = weight;
+          e->error = 0;
+     } else {
+          e = min;
+          e->error = e->weight;
+          e->weight += weight;
+     }
+     snprintf(e->name, sizeof(e->name), "%s", name);
+}
+
+/*
+ * Function: topn_cpu_ns
+ *
+ * Purpose: returns the CPU time used by the calling thread
+ */
+uint64_t topn_cpu_ns(void)
+{
+     struct timespec ts;
+
+     if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0)
+          return 0;
+     return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Function: topn_record
+ *
+ * Purpose: accounts for one handshake
+ *
+ * Arguments:
+ *
+ *      name            (r) the client principal, or NULL if the
+ *                      handshake failed before it was known
+ *      len             (r) the length of name
+ *      fd              (r) the connection, whose peer address stands in
+ *                      for an unknown client
+ *      cpu_ns          (r) the CPU time the handshake's
+ *                      gss_accept_sec_context calls took
+ *      failed          (r) whether the handshake failed
+ *
+ * Effects:
+ *
+ * Does nothing unless topn_init has been called.
+ */
+void topn_record(const char *name, size_t len, int fd, uint64_t cpu_ns,
+                 int failed)
+{
+     struct sockaddr_storage addr;
+     socklen_t addrlen = sizeof(addr);
+     char key[TOPN_NAME_MAX], host[NI_MAXHOST];
+
+     if (!enabled)
+          return;
+
+     if (name != NULL) {
+          if (len >= sizeof(key))
+               len = sizeof(key) - 1;
+          memcpy(key, name, len);
+          key[len] = '\0';
+     } else if (getpeername(fd, (struct sockaddr *) &addr, &addrlen) == 0 &&
+                getnameinfo((struct sockaddr *) &addr, addrlen, host,
+                            sizeof(host), NULL, 0, NI_NUMERICHOST) == 0) {
+          snprintf(key, sizeof(key), "[%s]", host);
+     } else {
+          snprintf(key, sizeof(key), "[unknown]");
+     }
+
+     pthread_mutex_lock(&lock);
+     topn_add(&handshakes, key, 1);
+     topn_add(&cpu, key, cpu_ns / 1000);
+     if (failed)
+          topn_add(&failures, key, 1);
+     pthread_mutex_unlock(&lock);
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+     const struct topn_entry *x = a, *y = b;
+
+     return x->weight < y->weight ? 1 : x->weight > y->weight ? -1 : 0;
+}
+
+static void topn_print(FILE *fp, struct topn *t)
+{
+     struct topn_entry sorted[TOPN_SLOTS];
+     int i;
+
+     memcpy(sorted, t->slots, t->used * sizeof(*sorted));
+     qsort(sorted, t->used, sizeof(*sorted), cmp_entry);
+
+     fprintf(fp, "# top %s, total %llu\n", t->title,
+             (unsigned long long) t->total);
+     for (i = 0; i < t->used && i < TOPN_REPORT; i++)
+          fprintf(fp, "%-40s %12llu  +/- %llu\n", sorted[i].name,
+                  (unsigned long long) sorted[i].weight,
+                  (unsigned long long) sorted[i].error);
+}
+
+/*
+ * Function: topn_dump
+ *
+ * Purpose: prints the heaviest clients in each table
+ *
+ * Effects:
+ *
+ * Each line gives a client, its weight and how much of that weight may
+ * have been inherited from clients it replaced.
+ */
+void topn_dump(FILE *fp)
+{
+     pthread_mutex_lock(&lock);
+     topn_print(fp, &handshakes);
+     topn_print(fp, &cpu);
+     topn_print(fp, &failures);
+     pthread_mutex_unlock(&lock);
+     fflush(fp);
+}
+
+static void *stats_main(void *arg)
+{
+     sigset_t *set = arg;
+     FILE *fp;
+     int sig;
+
+     for (;;) {
+          if (sigwait(set, &sig) != 0)
+               continue;
+
+          if ((fp = fopen(stats_path, "w")) == NULL) {
+               perror(stats_path);
+               continue;
+          }
+          topn_dump(fp);
+          fclose(fp);
+     }
+
+     return NULL;
+}
+
+/*
+ * Function: topn_init
+ *
+ * Purpose: starts per-client accounting
+ *
+ * Arguments:
+ *
+ *      stats_file      (r) the file the tables are written to
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * SIGUSR1 is blocked in the calling thread, and so in every thread it
+ * starts afterwards, and a thread is started that rewrites stats_file
+ * each time the process receives SIGUSR1.  Call this before starting
+ * any other threads.
+ */
+int topn_init(const char *stats_file)
+{
+     static sigset_t set;
+     pthread_t tid;
+
+     sigemptyset(&set);
+     sigaddset(&set, SIGUSR1);
+     if ((errno = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0) {
+          perror("blocking SIGUSR1");
+          return -1;
+     }
+
+     stats_path = stats_file;
+     enabled = 1;
+
+     if ((errno = pthread_create(&tid, NULL, stats_main, &set)) != 0) {
+          perror("starting stats thread");
+          return -1;
+     }
+     pthread_detach(tid);
+
+     return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-client handshake accounting in bounded memory.  Each table keeps
+ * the heaviest clients by one measure with the space-saving algorithm:
+ * a client that is not in a full table replaces the lightest entry and
+ * inherits its weight as a possible overestimate, so any client whose
+ * true weight exceeds total / TOPN_SLOTS is guaranteed to be listed.
+ */
+
+#define TOPN_SLOTS              64          /* entries in each table */
+#define TOPN_REPORT             20          /* entries printed */
+#define TOPN_NAME_MAX           128
+
+struct topn_entry {
+     char               name[TOPN_NAME_MAX];
+     uint64_t           weight;
+     uint64_t           error;              /* most weight is overstated by */
+};
+
+struct topn {
+     const char         *title;
+     int                used;
+     uint64_t           total;
+     struct topn_entry  slots[TOPN_SLOTS];
+};
+
+int topn_init(const char *stats_file);
+uint64_t topn_cpu_ns(void);
+void topn_record(const char *name, size_t len, int fd, uint64_t cpu_ns,
+                 int failed);
+void topn_dump(FILE *fp);
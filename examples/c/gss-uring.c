@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <gssapi/gssapi.h>
+#include "gss-conn.h"
+#include "gss-uring.h"
+
+#ifndef HAVE_LIBURING
+
+int uring_server(int listen_fd, int use_lucid)
+{
+     (void) listen_fd;
+     (void) use_lucid;
+
+     fprintf(stderr, "Built without io_uring support\n");
+     return 1;
+}
+
+#else
+
+#include <liburing.h>
+
+/*
+ * Requests are tagged with the connection and the operation in the low
+ * bits of the user data; the accept carries no connection.  A
+ * connection's busy count is the number of its requests in flight, and
+ * it is only freed once that drops to zero.
+ */
+enum uring_op {
+     OP_ACCEPT,
+     OP_RECV,
+     OP_SEND,
+};
+
+#define OP_MASK                 3
+#define URING_BGID              0
+
+struct uring {
+     struct io_uring            ring;
+     struct io_uring_buf_ring   *br;
+     unsigned char              *bufs;
+     int                        listen_fd;
+     int                        use_lucid;
+     int                        accepted;
+     struct conn                *conns;     /* live connections */
+};
+
+static void conn_reply(struct uring *u, struct conn *c);
+
+/*
+ * Function: get_sqe
+ *
+ * Purpose: gets a submission queue entry, submitting the queue if it is
+ * full
+ */
+static struct io_uring_sqe *get_sqe(struct uring *u)
+{
+     struct io_uring_sqe *sqe;
+
+     while ((sqe = io_uring_get_sqe(&u->ring)) == NULL)
+          io_uring_submit(&u->ring);
+
+     return sqe;
+}
+
+static void prep(struct io_uring_sqe *sqe, struct conn *c, enum uring_op op)
+{
+     io_uring_sqe_set_data64(sqe, (unsigned long long) (uintptr_t) c | op);
+     if (c != NULL)
+          c->busy++;
+}
+
+static void arm_accept(struct uring *u)
+{
+     struct io_uring_sqe *sqe = get_sqe(u);
+
+     io_uring_prep_multishot_accept(sqe, u->listen_fd, NULL, NULL,
+                                    SOCK_CLOEXEC);
+     prep(sqe, NULL, OP_ACCEPT);
+}
+
+/*
+ * Function: arm_recv
+ *
+ * Purpose: reads from a connection into whichever provided buffer the
+ * kernel picks
+ */
+static void arm_recv(struct uring *u, struct conn *c)
+{
+     struct io_uring_sqe *sqe = get_sqe(u);
+
+     io_uring_prep_recv(sqe, c->fd, NULL, 0, 0);
+     sqe->flags |= IOSQE_BUFFER_SELECT;
+     sqe->buf_group = URING_BGID;
+     prep(sqe, c, OP_RECV);
+}
+
+/*
+ * Function: arm_send
+ *
+ * Purpose: writes the rest of a connection's reply
+ *
+ * Effects:
+ *
+ * The length prefix and the token are sent as two linked requests, so
+ * the token is not sent unless the whole prefix was.
+ */
+static void arm_send(struct uring *u, struct conn *c)
+{
+     struct io_uring_sqe *sqe;
+     struct iovec iov[2];
+     int i, n;
+
+     n = conn_out_iov(c, iov);
+     for (i = 0; i < n; i++) {
+          sqe = get_sqe(u);
+          io_uring_prep_send(sqe, c->fd, iov[i].iov_base, iov[i].iov_len,
+                             MSG_WAITALL | MSG_NOSIGNAL);
+          if (i < n - 1)
+               sqe->flags |= IOSQE_IO_LINK;
+          prep(sqe, c, OP_SEND);
+     }
+}
+
+static void close_conn(struct uring *u, struct conn *c)
+{
+     c->hangup = 1;
+     if (c->busy)
+          return;
+
+     if (c->prev != NULL)
+          c->prev->next = c->next;
+     else
+          u->conns = c->next;
+     if (c->next != NULL)
+          c->next->prev = c->prev;
+
+     close(c->fd);
+     conn_free(c);
+}
+
+/*
+ * Function: conn_next_token
+ *
+ * Purpose: gets a connection going again once its reply has been sent
+ */
+static void conn_next_token(struct uring *u, struct conn *c)
+{
+     switch (conn_next(c)) {
+     case -1:
+          close_conn(u, c);
+          break;
+     case 1:
+          conn_reply(u, c);
+          break;
+     default:
+          arm_recv(u, c);
+     }
+}
+
+/*
+ * Function: conn_reply
+ *
+ * Purpose: processes a complete token and sends the reply
+ */
+static void conn_reply(struct uring *u, struct conn *c)
+{
+     conn_process(c);
+
+     if (conn_written(c, 0))
+          conn_next_token(u, c);
+     else
+          arm_send(u, c);
+}
+
+static void recycle(struct uring *u, unsigned int bid)
+{
+     io_uring_buf_ring_add(u->br, u->bufs + (size_t) bid * URING_BUFFER_SIZE,
+                           URING_BUFFER_SIZE, bid,
+                           io_uring_buf_ring_mask(URING_BUFFERS), 0);
+     io_uring_buf_ring_advance(u->br, 1);
+}
+
+static void on_accept(struct uring *u, struct io_uring_cqe *cqe)
+{
+     struct conn *c;
+
+     if (!(cqe->flags & IORING_CQE_F_MORE))
+          arm_accept(u);
+
+     if (cqe->res < 0) {
+          fprintf(stderr, "accepting connection: %s\n", strerror(-cqe->res));
+          return;
+     }
+
+     u->accepted = 1;
+     if ((c = conn_new(cqe->res, u->use_lucid)) == NULL) {
+          close(cqe->res);
+          return;
+     }
+     c->prev = NULL;
+     c->next = u->conns;
+     if (u->conns != NULL)
+          u->conns->prev = c;
+     u->conns = c;
+     arm_recv(u, c);
+}
+
+static void on_recv(struct uring *u, struct conn *c, struct io_uring_cqe *cqe)
+{
+     unsigned int bid;
+     int ret;
+
+     c->busy--;
+
+     if (cqe->res == -ENOBUFS) {
+          /* every buffer is in use; the connection waits its turn */
+          arm_recv(u, c);
+          return;
+     }
+     if (cqe->res <= 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+          close_conn(u, c);
+          return;
+     }
+
+     bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+     ret = conn_feed(c, u->bufs + (size_t) bid * URING_BUFFER_SIZE,
+                     cqe->res);
+     recycle(u, bid);
+
+     if (ret < 0)
+          close_conn(u, c);
+     else if (ret == 1)
+          conn_reply(u, c);
+     else
+          arm_recv(u, c);
+}
+
+static void on_send(struct uring *u, struct conn *c, struct io_uring_cqe *cqe)
+{
+     c->busy--;
+
+     if (cqe->res > 0)
+          (void) conn_written(c, cqe->res);
+     else if (cqe->res != -ECANCELED)
+          c->hangup = 1;
+
+     /* wait for the rest of the linked sends */
+     if (c->busy)
+          return;
+
+     if (c->hangup)
+          close_conn(u, c);
+     else if (conn_written(c, 0))
+          conn_next_token(u, c);
+     else
+          arm_send(u, c);
+}
+
+/*
+ * Function: uring_init
+ *
+ * Purpose: sets up the ring and registers the receive buffers
+ *
+ * Returns: 0 on success, or 1 if io_uring or provided buffer rings are
+ * not available
+ */
+static int uring_init(struct uring *u)
+{
+     unsigned int i;
+     int ret;
+
+     if ((ret = io_uring_queue_init(URING_ENTRIES, &u->ring, 0)) < 0) {
+          fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+          return 1;
+     }
+
+     u->br = io_uring_setup_buf_ring(&u->ring, URING_BUFFERS, URING_BGID, 0,
+                                     &ret);
+     if (u->br == NULL) {
+          fprintf(stderr, "io_uring_setup_buf_ring: %s\n", strerror(-ret));
+          io_uring_queue_exit(&u->ring);
+          return 1;
+     }
+
+     if ((u->bufs = malloc((size_t) URING_BUFFERS * URING_BUFFER_SIZE))
+         == NULL) {
+          io_uring_free_buf_ring(&u->ring, u->br, URING_BUFFERS, URING_BGID);
+          io_uring_queue_exit(&u->ring);
+          return 1;
+     }
+
+     for (i = 0; i < URING_BUFFERS; i++)
+          io_uring_buf_ring_add(u->br, u->bufs + (size_t) i * URING_BUFFER_SIZE,
+                                URING_BUFFER_SIZE, i,
+                                io_uring_buf_ring_mask(URING_BUFFERS), i);
+     io_uring_buf_ring_advance(u->br, URING_BUFFERS);
+
+     return 0;
+}
+
+/*
+ * Function: uring_exit
+ *
+ * Purpose: tears down the ring, and closes and frees every connection
+ * that is still open
+ */
+static void uring_exit(struct uring *u)
+{
+     struct conn *c;
+
+     io_uring_free_buf_ring(&u->ring, u->br, URING_BUFFERS, URING_BGID);
+     io_uring_queue_exit(&u->ring);
+     free(u->bufs);
+
+     /* nothing is in flight once the ring is gone */
+     while ((c = u->conns) != NULL) {
+          u->conns = c->next;
+          close(c->fd);
+          conn_free(c);
+     }
+}
+
+/*
+ * Function: uring_server
+ *
+ * Purpose: serves connections on a listening socket with io_uring
+ *
+ * Arguments:
+ *
+ *      listen_fd       (r) the listening socket
+ *      use_lucid       (r) protect messages using lucid contexts
+ *
+ * Returns: 1 if io_uring cannot be used, so that the caller can fall
+ * back to another server, -1 on error; otherwise it does not return
+ *
+ * Effects:
+ *
+ * Connections are served as by event_server, with the GSS-API calls
+ * made on the ring's thread.  One multishot accept produces every new
+ * connection, reads land in buffers the kernel picks from a ring shared
+ * with the server, and each reply is sent as a linked pair of requests.
+ */
+int uring_server(int listen_fd, int use_lucid)
+{
+     struct uring u;
+     struct io_uring_cqe *cqe;
+     struct conn *c;
+     unsigned int head, count;
+     unsigned long long data;
+     int ret;
+
+     memset(&u, 0, sizeof(u));
+     u.listen_fd = listen_fd;
+     u.use_lucid = use_lucid;
+
+     if (uring_init(&u) != 0)
+          return 1;
+
+     arm_accept(&u);
+
+     for (;;) {
+          ret = io_uring_submit_and_wait(&u.ring, 1);
+          if (ret < 0 && ret != -EINTR) {
+               fprintf(stderr, "io_uring_submit_and_wait: %s\n",
+                       strerror(-ret));
+               break;
+          }
+
+          count = 0;
+          io_uring_for_each_cqe(&u.ring, head, cqe) {
+               count++;
+               data = io_uring_cqe_get_data64(cqe);
+               c = (struct conn *) (uintptr_t) (data & ~(unsigned long long)
+                                                OP_MASK);
+
+               switch (data & OP_MASK) {
+               case OP_ACCEPT:
+                    /* kernels without multishot accept refuse it */
+                    if (cqe->res == -EINVAL && !u.accepted) {
+                         uring_exit(&u);
+                         return 1;
+                    }
+                    on_accept(&u, cqe);
+                    break;
+               case OP_RECV:
+                    on_recv(&u, c, cqe);
+                    break;
+               case OP_SEND:
+                    on_send(&u, c, cqe);
+                    break;
+               }
+          }
+          io_uring_cq_advance(&u.ring, count);
+     }
+
+     uring_exit(&u);
+     return -1;
+}
+
+#endif /* HAVE_LIBURING */
@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+ * The io_uring "sign" server: accepts, token reads and replies are all
+ * submitted to one ring, so a small-token exchange costs a fraction of
+ * the syscalls of the blocking server.  Needs liburing at build time
+ * (HAVE_LIBURING) and Linux 5.19 or later at run time.
+ */
+
+#define URING_ENTRIES           256         /* submission queue size */
+#define URING_BUFFERS           256         /* provided receive buffers */
+#define URING_BUFFER_SIZE       (16 * 1024)
+
+int uring_server(int listen_fd, int use_lucid);
@@ -0,0 +1,420 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+// gss-bench runs every pairing of the C, Go and Java example clients and
+// servers through a fixed set of workloads and prints a comparable table of
+// throughput, latency percentiles and CPU time per operation.
+//
+// It expects the environment written by examples/bench/kdc.sh: KRB5_CONFIG,
+// KRB5CCNAME and KRB5_KTNAME pointing at a throwaway realm with a
+// host/localhost service principal, and BENCH_JAAS_CONF for the Java peers.
+//
+// Each operation is one run of an example client: connect, establish a
+// context with mutual authentication, send one wrap token and verify the
+// MIC that comes back.  Client latency and CPU therefore include process
+// start-up, which dominates for the JVM; the server figures are measured on
+// the long running server process and are the fairer comparison between
+// acceptor implementations.
+package main
+
+import (
+	"crypto/rand"
+	"errors"
+	"flag"
+	"fmt"
+	"io/ioutil"
+	"net"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+	"text/tabwriter"
+	"time"
+)
+
+// clockTicks is the kernel USER_HZ, which is 100 on every Linux platform
+// that Go supports
+const clockTicks = 100
+
+type workload struct {
+	name string
+	seal bool
+	file bool   // msg names a file containing the message
+	msg  string // the message, or the name of the file containing it
+}
+
+type impl struct {
+	name   string
+	server func(port int) *exec.Cmd
+	client func(port int, w workload) *exec.Cmd
+}
+
+type result struct {
+	server, client, workload string
+	ops, failures            int
+	elapsed                  time.Duration
+	latencies                []time.Duration
+	clientCPU, serverCPU     time.Duration
+	serverCPUErr             error
+}
+
+var (
+	examplesDir string
+	jaasConf    string
+	krb5Conf    string
+)
+
+func main() {
+	flag.StringVar(&examplesDir, "dir", "..", "examples directory containing the c, go and java builds")
+	impls := flag.String("impls", "c,go,java", "comma separated list of implementations to pair")
+	workloads := flag.String("workloads", "handshake,small-sealed,large-sealed,mic", "comma separated list of workloads")
+	ops := flag.Int("n", 50, "operations per client/server/workload cell")
+	warmup := flag.Int("warmup", 2, "unmeasured operations before each cell")
+	port := flag.Int("port", 12340, "first local port for the servers")
+	largeSize := flag.Int("large-size", 1<<20, "payload size in bytes for the large-sealed workload")
+	csv := flag.Bool("csv", false, "print comma separated values instead of a table")
+	flag.Parse()
+
+	jaasConf = os.Getenv("BENCH_JAAS_CONF")
+	krb5Conf = os.Getenv("KRB5_CONFIG")
+	if jaasConf == "" || krb5Conf == "" {
+		fatal(errors.New("KRB5_CONFIG and BENCH_JAAS_CONF must be set, see examples/bench/kdc.sh"))
+	}
+
+	var err error
+	if examplesDir, err = filepath.Abs(examplesDir); err != nil {
+		fatal(err)
+	}
+
+	tmpDir, err := ioutil.TempDir("", "gss-bench")
+	if err != nil {
+		fatal(err)
+	}
+	defer os.RemoveAll(tmpDir)
+
+	wl, err := selectWorkloads(*workloads, tmpDir, *largeSize)
+	if err != nil {
+		fatal(err)
+	}
+
+	im, err := selectImpls(*impls)
+	if err != nil {
+		fatal(err)
+	}
+
+	var results []*result
+	for i, srvImpl := range im {
+		srvPort := *port + i
+		srv := srvImpl.server(srvPort)
+		if err := srv.Start(); err != nil {
+			fatal(fmt.Errorf("starting %s server: %w", srvImpl.name, err))
+		}
+
+		if err := waitForPort(srvPort, 30*time.Second); err != nil {
+			_ = srv.Process.Kill()
+			fatal(fmt.Errorf("%s server: %w", srvImpl.name, err))
+		}
+
+		for _, cliImpl := range im {
+			for _, w := range wl {
+				fmt.Fprintf(os.Stderr, "%s server, %s client, %s ...\n", srvImpl.name, cliImpl.name, w.name)
+				r := runCell(srvImpl, cliImpl, w, srv.Process.Pid, srvPort, *warmup, *ops)
+				results = append(results, r)
+			}
+		}
+
+		_ = srv.Process.Kill()
+		_ = srv.Wait()
+	}
+
+	if *csv {
+		printCSV(results)
+	} else {
+		printTable(results)
+	}
+}
+
+func selectWorkloads(names, dir string, largeSize int) (wl []workload, err error) {
+	large := make([]byte, largeSize)
+	if _, err = rand.Read(large); err != nil {
+		return
+	}
+
+	largeFile := filepath.Join(dir, "large.bin")
+	if err = ioutil.WriteFile(largeFile, large, 0600); err != nil {
+		return
+	}
+
+	all := map[string]workload{
+		// the protocol always carries one message, so handshake sends
+		// a single signed byte
+		"handshake":    {name: "handshake", msg: "x"},
+		"small-sealed": {name: "small-sealed", seal: true, msg: strings.Repeat("0123456789abcdef", 4)},
+		"large-sealed": {name: "large-sealed", seal: true, file: true, msg: largeFile},
+		"mic":          {name: "mic", msg: strings.Repeat("0123456789abcdef", 4)},
+	}
+
+	for _, n := range strings.Split(names, ",") {
+		w, ok := all[n]
+		if !ok {
+			return nil, fmt.Errorf("unknown workload %q", n)
+		}
+		wl = append(wl, w)
+	}
+
+	return
+}
+
+func selectImpls(names string) (im []impl, err error) {
+	all := map[string]impl{
+		"c":    {"c", cServer, cClient},
+		"go":   {"go", goServer, goClient},
+		"java": {"java", javaServer, javaClient},
+	}
+
+	for _, n := range strings.Split(names, ",") {
+		i, ok := all[n]
+		if !ok {
+			return nil, fmt.Errorf("unknown implementation %q", n)
+		}
+		im = append(im, i)
+	}
+
+	return
+}
+
+func cServer(port int) *exec.Cmd {
+	return exec.Command(filepath.Join(examplesDir, "c", "gss-server-c"),
+		"-port", strconv.Itoa(port), "host@localhost")
+}
+
+func cClient(port int, w workload) *exec.Cmd {
+	args := []string{"-port", strconv.Itoa(port), "-mutual"}
+	if w.seal {
+		args = append(args, "-seal")
+	}
+	if w.file {
+		args = append(args, "-f")
+	}
+	args = append(args, "localhost", "host@localhost", w.msg)
+
+	return exec.Command(filepath.Join(examplesDir, "c", "gss-client-c"), args...)
+}
+
+func goServer(port int) *exec.Cmd {
+	return exec.Command(filepath.Join(examplesDir, "go", "gss-server-go"),
+		"-port", strconv.Itoa(port))
+}
+
+func goClient(port int, w workload) *exec.Cmd {
+	args := []string{"-port", strconv.Itoa(port), "-mutual"}
+	if w.seal {
+		args = append(args, "-seal")
+	}
+	if w.file {
+		args = append(args, "-f")
+	}
+	args = append(args, "localhost", "host/localhost", w.msg)
+
+	return exec.Command(filepath.Join(examplesDir, "go", "gss-client-go"), args...)
+}
+
+func javaArgs() []string {
+	return []string{
+		"-Djava.security.krb5.conf=" + krb5Conf,
+		"-Djava.security.auth.login.config=" + jaasConf,
+		"-Djavax.security.auth.useSubjectCredsOnly=false",
+		"-cp", filepath.Join(examplesDir, "java"),
+	}
+}
+
+func javaServer(port int) *exec.Cmd {
+	args := append(javaArgs(), "SampleServer", strconv.Itoa(port))
+	return exec.Command("java", args...)
+}
+
+func javaClient(port int, w workload) *exec.Cmd {
+	args := append(javaArgs(), "SampleClient")
+	if !w.seal {
+		args = append(args, "-sign")
+	}
+	if w.file {
+		args = append(args, "-f")
+	}
+	args = append(args, "host/localhost", "localhost", strconv.Itoa(port), w.msg)
+
+	return exec.Command("java", args...)
+}
+
+func waitForPort(port int, timeout time.Duration) error {
+	addr := fmt.Sprintf("localhost:%d", port)
+	deadline := time.Now().Add(timeout)
+
+	for time.Now().Before(deadline) {
+		conn, err := net.DialTimeout("tcp", addr, time.Second)
+		if err == nil {
+			conn.Close()
+			return nil
+		}
+		time.Sleep(50 * time.Millisecond)
+	}
+
+	return fmt.Errorf("not listening on %s after %s", addr, timeout)
+}
+
+func runCell(srv, cli impl, w workload, srvPid, port, warmup, ops int) *result {
+	r := &result{server: srv.name, client: cli.name, workload: w.name}
+
+	for i := 0; i < warmup; i++ {
+		_ = cli.client(port, w).Run()
+	}
+
+	cpuBefore, errBefore := procCPU(srvPid)
+	start := time.Now()
+
+	for i := 0; i < ops; i++ {
+		cmd := cli.client(port, w)
+		t0 := time.Now()
+		err := cmd.Run()
+		lat := time.Since(t0)
+
+		if cmd.ProcessState != nil {
+			r.clientCPU += cmd.ProcessState.UserTime() + cmd.ProcessState.SystemTime()
+		}
+		if err != nil {
+			r.failures++
+			continue
+		}
+
+		r.ops++
+		r.latencies = append(r.latencies, lat)
+	}
+
+	r.elapsed = time.Since(start)
+	cpuAfter, errAfter := procCPU(srvPid)
+
+	switch {
+	case errBefore != nil:
+		r.serverCPUErr = errBefore
+	case errAfter != nil:
+		r.serverCPUErr = errAfter
+	default:
+		r.serverCPU = cpuAfter - cpuBefore
+	}
+
+	return r
+}
+
+// procCPU returns the user and system CPU time consumed by process pid,
+// read from /proc/<pid>/stat
+func procCPU(pid int) (time.Duration, error) {
+	b, err := ioutil.ReadFile(fmt.Sprintf("/proc/%d/stat", pid))
+	if err != nil {
+		return 0, err
+	}
+
+	// the command name may contain spaces, the fields we want follow it
+	stat := string(b)
+	idx := strings.LastIndexByte(stat, ')')
+	if idx < 0 {
+		return 0, errors.New("unexpected format of /proc/pid/stat")
+	}
+
+	// fields after the command name start at field 3 (state); utime and
+	// stime are fields 14 and 15
+	fields := strings.Fields(stat[idx+1:])
+	if len(fields) < 13 {
+		return 0, errors.New("unexpected format of /proc/pid/stat")
+	}
+
+	utime, err := strconv.ParseInt(fields[11], 10, 64)
+	if err != nil {
+		return 0, err
+	}
+	stime, err := strconv.ParseInt(fields[12], 10, 64)
+	if err != nil {
+		return 0, err
+	}
+
+	return time.Duration(utime+stime) * time.Second / clockTicks, nil
+}
+
+func percentile(sorted []time.Duration, p float64) time.Duration {
+	if len(sorted) == 0 {
+		return 0
+	}
+
+	idx := int(p*float64(len(sorted)) + 0.5)
+	if idx > 0 {
+		idx--
+	}
+	if idx >= len(sorted) {
+		idx = len(sorted) - 1
+	}
+
+	return sorted[idx]
+}
+
+// columns returns the formatted values of one result row
+func (r *result) columns() []string {
+	sort.Slice(r.latencies, func(i, j int) bool { return r.latencies[i] < r.latencies[j] })
+
+	ms := func(d time.Duration) string {
+		return strconv.FormatFloat(float64(d)/float64(time.Millisecond), 'f', 2, 64)
+	}
+
+	perOp := func(d time.Duration) string {
+		if r.ops == 0 {
+			return "-"
+		}
+		return ms(d / time.Duration(r.ops))
+	}
+
+	opsPerSec := "-"
+	if r.elapsed > 0 {
+		opsPerSec = strconv.FormatFloat(float64(r.ops)/r.elapsed.Seconds(), 'f', 1, 64)
+	}
+
+	srvCPU := "-"
+	if r.serverCPUErr == nil {
+		srvCPU = perOp(r.serverCPU)
+	}
+
+	return []string{
+		r.server, r.client, r.workload,
+		strconv.Itoa(r.ops), strconv.Itoa(r.failures), opsPerSec,
+		ms(percentile(r.latencies, 0.50)),
+		ms(percentile(r.latencies, 0.90)),
+		ms(percentile(r.latencies, 0.99)),
+		perOp(r.clientCPU), srvCPU,
+	}
+}
+
+var header = []string{
+	"server", "client", "workload", "ops", "failed", "ops/s",
+	"p50 ms", "p90 ms", "p99 ms", "client cpu ms/op", "server cpu ms/op",
+}
+
+func printTable(results []*result) {
+	w := tabwriter.NewWriter(os.Stdout, 0, 0, 2, ' ', tabwriter.AlignRight)
+	fmt.Fprintln(w, strings.Join(header, "\t")+"\t")
+	for _, r := range results {
+		fmt.Fprintln(w, strings.Join(r.columns(), "\t")+"\t")
+	}
+	w.Flush()
+}
+
+func printCSV(results []*result) {
+	fmt.Println(strings.Join(header, ","))
+	for _, r := range results {
+		fmt.Println(strings.Join(r.columns(), ","))
+	}
+}
+
+func fatal(err error) {
+	fmt.Fprintln(os.Stderr, err)
+	os.Exit(1)
+}
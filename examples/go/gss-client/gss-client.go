@@ -9,6 +9,7 @@ import (
 	"encoding/binary"
 	"flag"
 	"fmt"
+	"io/ioutil"
 	"net"
 	"os"
 
@@ -22,17 +23,26 @@ func main() {
 	port := flag.Int("port", 1234, "remote port to connect to")
 	mutual := flag.Bool("mutual", false, "request mutual authentication")
 	seal := flag.Bool("seal", false, "seal (encrypt) the message")
+	useFile := flag.Bool("f", false, "read the message from the file named by msg")
 	flag.BoolVar(&_debug, "d", false, "enable debugging")
 	flag.Parse()
 
 	if flag.NArg() != 3 {
-		fmt.Fprintf(os.Stderr, "Usage: %s [-port <int>] [-mutual] [-seal] [-d] host service msg\n", os.Args[0])
+		fmt.Fprintf(os.Stderr, "Usage: %s [-port <int>] [-mutual] [-seal] [-f] [-d] host service msg\n", os.Args[0])
 		os.Exit(1)
 	}
 
 	host := flag.Arg(0)
 	service := flag.Arg(1)
-	msg := flag.Arg(2)
+	msg := []byte(flag.Arg(2))
+
+	if *useFile {
+		var err error
+		if msg, err = ioutil.ReadFile(flag.Arg(2)); err != nil {
+			fmt.Fprintln(os.Stderr, err)
+			os.Exit(1)
+		}
+	}
 
 	// Connect to the host
 	addr := fmt.Sprintf("%s:%d", host, *port)
@@ -90,7 +100,7 @@ func main() {
 	}
 
 	// Wrap the message
-	outToken, err = client.Wrap([]byte(msg), *seal)
+	outToken, err = client.Wrap(msg, *seal)
 	if err != nil {
 		fmt.Fprintln(os.Stderr, err)
 		os.Exit(1)
@@ -107,7 +117,7 @@ func main() {
 		os.Exit(1)
 	}
 
-	if err = client.VerifySignature([]byte(msg), inToken); err != nil {
+	if err = client.VerifySignature(msg, inToken); err != nil {
 		fmt.Fprintln(os.Stderr, err)
 		os.Exit(1)
 	}
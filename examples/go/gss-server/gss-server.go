@@ -5,13 +5,13 @@
 package main
 
 import (
-	"bytes"
-	"encoding/binary"
+	"expvar"
 	"flag"
 	"fmt"
-	"io"
 	"net"
+	"net/http"
 	"os"
+	"runtime"
 
 	"github.com/golang-auth/go-gssapi/v2"
 	_ "github.com/golang-auth/go-gssapi/v2/krb5"
@@ -19,11 +19,21 @@ import (
 
 var _debug bool
 
+var bufPool *gssapi.BufferPool
+
 func main() {
 	port := flag.Int("port", 1234, "local port to listen on")
 	flag.BoolVar(&_debug, "d", false, "enable debugging")
+	debugAddr := flag.String("debug-addr", "", "serve runtime statistics at http://<addr>/debug/vars")
+	bufIdle := flag.Duration("buffer-idle", gssapi.DefaultBufferIdle, "return an idle connection's buffers to the pool after this long")
 	flag.Parse()
 
+	bufPool = gssapi.NewBufferPool(*bufIdle, gssapi.DefaultMaxPooled)
+
+	if *debugAddr != "" {
+		serveDebug(*debugAddr)
+	}
+
 	// Listen on port
 	addr := fmt.Sprintf(":%d", *port)
 	l, err := net.Listen("tcp", addr)
@@ -43,42 +53,43 @@ func main() {
 	}
 }
 
-func sendToken(conn net.Conn, token []byte) error {
-	szBuff := make([]byte, 4)
-	binary.BigEndian.PutUint32(szBuff, uint32(len(token)))
-	_, err := conn.Write(szBuff)
-	if err != nil {
-		return err
-	}
+// serveDebug publishes the memory statistics that the expvar package
+// registers itself, plus the number of goroutines and open connections, for
+// long running tests to sample
+func serveDebug(addr string) {
+	expvar.Publish("goroutines", expvar.Func(func() interface{} {
+		return runtime.NumGoroutine()
+	}))
+	expvar.Publish("connections", &openConns)
+	expvar.Publish("buffers", expvar.Func(func() interface{} {
+		return bufPool.Stats()
+	}))
+
+	go func() {
+		if err := http.ListenAndServe(addr, nil); err != nil {
+			fmt.Fprintln(os.Stderr, err)
+		}
+	}()
+}
 
-	n, err := conn.Write(token)
-	if err != nil {
+var openConns expvar.Int
+
+func sendToken(conn *gssapi.TokenConn, token []byte) error {
+	if err := conn.WriteToken(token); err != nil {
 		return err
 	}
-	debug("Wrote %d bytes to client", n)
+	debug("Wrote %d bytes to client", len(token)+4)
 	debug("Token bytes: [% x]", token)
 
 	return nil
 }
 
-func recvToken(conn net.Conn) (token []byte, err error) {
-	szBuff := make([]byte, 4)
-	_, err = io.ReadFull(conn, szBuff)
-	if err != nil {
+// recvToken returns a token that is only valid until the next call or conn.Done
+func recvToken(conn *gssapi.TokenConn) (token []byte, err error) {
+	if token, err = conn.ReadToken(); err != nil {
 		return
 	}
-	debug("Expecting 0x% x byte token from client", szBuff)
-
-	buf := bytes.NewBuffer(szBuff)
-	var tokenSize uint32
-	binary.Read(buf, binary.BigEndian, &tokenSize)
-
-	token = make([]byte, tokenSize)
-	n, err := io.ReadFull(conn, token)
-	if err != nil {
-		return
-	}
-	debug("Read %d byte token from client", n)
+	debug("Read %d byte token from client", len(token))
 	debug("Token bytes: [% x]", token)
 
 	return
@@ -93,25 +104,31 @@ func debug(format string, args ...interface{}) {
 }
 
 func handleConn(conn net.Conn) {
+	openConns.Add(1)
+	defer openConns.Add(-1)
 	defer conn.Close()
 
 	debug("Accepted connection from %s", conn.RemoteAddr())
 
+	tc := gssapi.NewTokenConn(conn, bufPool)
+	defer tc.Release()
+
 	server := gssapi.NewMech("kerberos_v5")
 	err := server.Accept("")
 
 	var inToken, outToken []byte
 
 	for !server.IsEstablished() {
-		inToken, err = recvToken(conn)
+		inToken, err = recvToken(tc)
 		if err != nil {
 			fmt.Fprintln(os.Stderr, err)
 			break
 		}
 
 		outToken, err = server.Continue(inToken)
+		tc.Done()
 		if len(outToken) > 0 {
-			if sendErr := sendToken(conn, outToken); sendErr != nil {
+			if sendErr := sendToken(tc, outToken); sendErr != nil {
 				err = sendErr
 				break
 			}
@@ -129,7 +146,7 @@ func handleConn(conn net.Conn) {
 		debug("  context flag: 0x%02x: %s", f, gssapi.FlagName(f))
 	}
 
-	inToken, err = recvToken(conn)
+	inToken, err = recvToken(tc)
 	if err != nil {
 		fmt.Fprintln(os.Stderr, err)
 		return
@@ -152,8 +169,9 @@ func handleConn(conn net.Conn) {
 		fmt.Fprintln(os.Stderr, err)
 		return
 	}
+	tc.Done()
 
-	if err = sendToken(conn, outToken); err != nil {
+	if err = sendToken(tc, outToken); err != nil {
 		fmt.Fprintln(os.Stderr, err)
 		return
 	}
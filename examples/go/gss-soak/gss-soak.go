@@ -0,0 +1,443 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+// gss-soak drives an example server with a long run of operations, some of
+// them deliberately broken, while sampling the server process, and reports
+// how its memory and descriptor use grow per million operations.
+//
+// An operation is one connection to the server: establish a context, send a
+// wrap token and verify the MIC that comes back, as the example clients do.
+// With -fail, that fraction of the operations instead exercises an error
+// path in the server:
+//
+//	hangup      send the first context token, then close the connection
+//	garbage     send random bytes as the first context token
+//	no-message  establish the context, then close without a message
+//	bad-wrap    send a wrap token with a corrupted checksum
+//
+// The server process named by -pid is sampled from /proc: resident and
+// anonymous memory, the data segment (the C heap and malloc arenas) and open
+// file descriptors.  If the Go server was started with -debug-addr, pass the
+// same address here to sample its heap, GC and goroutine counts as well.
+//
+// Growth is the least squares slope of each measure against operations
+// completed, ignoring the samples taken during -warmup, so a steady state
+// server reports figures close to zero however long the run.
+package main
+
+import (
+	"encoding/binary"
+	"encoding/json"
+	"errors"
+	"flag"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"math/rand"
+	"net"
+	"net/http"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/golang-auth/go-gssapi/v2"
+	"github.com/golang-auth/go-gssapi/v2/krb5"
+)
+
+var failModes = []string{"hangup", "garbage", "no-message", "bad-wrap"}
+
+type sample struct {
+	elapsed  time.Duration
+	ops      int64
+	failures int64
+	rssKB    float64
+	anonKB   float64
+	dataKB   float64
+	fds      float64
+
+	// from the Go server's expvar endpoint
+	haveGo     bool
+	heapKB     float64
+	heapObjs   float64
+	numGC      float64
+	goroutines float64
+}
+
+type driver struct {
+	addr    string
+	service string
+	seal    bool
+	failPct float64
+	msg     []byte
+
+	ops      int64 // completed operations, atomic
+	failures int64 // operations that failed unexpectedly, atomic
+}
+
+func main() {
+	host := flag.String("host", "localhost", "server host")
+	port := flag.Int("port", 1234, "server port")
+	service := flag.String("service", "host/localhost", "service principal of the server")
+	seal := flag.Bool("seal", false, "seal (encrypt) the message")
+	total := flag.Int64("n", 1000000, "operations to run")
+	duration := flag.Duration("duration", 0, "stop after this long, even if fewer than -n operations have run")
+	conc := flag.Int("conc", 8, "concurrent connections")
+	failPct := flag.Float64("fail", 0.05, "fraction of operations that inject a failure")
+	pid := flag.Int("pid", 0, "process ID of the server to sample")
+	debugAddr := flag.String("debug-addr", "", "address given to the Go server's -debug-addr")
+	interval := flag.Duration("interval", 10*time.Second, "time between samples")
+	warmup := flag.Int64("warmup", 50000, "operations before growth is measured")
+	msgSize := flag.Int("size", 64, "message size in bytes")
+	flag.IntVar(&krb5.KDCMaxConcurrent, "kdc-max", 0, "most service ticket requests outstanding at once (0 for no limit)")
+	flag.Float64Var(&krb5.KDCRate, "kdc-rate", 0, "service ticket requests per second (0 for no limit)")
+	flag.Parse()
+
+	if *pid == 0 {
+		fatal(errors.New("-pid is required"))
+	}
+
+	d := &driver{
+		addr:    net.JoinHostPort(*host, strconv.Itoa(*port)),
+		service: *service,
+		seal:    *seal,
+		failPct: *failPct,
+		msg:     make([]byte, *msgSize),
+	}
+	rand.Seed(time.Now().UnixNano())
+	_, _ = rand.Read(d.msg)
+
+	var stopping int32
+	if *duration > 0 {
+		time.AfterFunc(*duration, func() { atomic.StoreInt32(&stopping, 1) })
+	}
+
+	start := time.Now()
+	var samples []sample
+	take := func() {
+		s, err := takeSample(*pid, *debugAddr)
+		if err != nil {
+			fatal(err)
+		}
+		s.elapsed = time.Since(start)
+		s.ops = atomic.LoadInt64(&d.ops)
+		s.failures = atomic.LoadInt64(&d.failures)
+		samples = append(samples, s)
+		printSample(&s, len(samples) == 1)
+	}
+	take()
+
+	var next int64
+	var wg sync.WaitGroup
+	for i := 0; i < *conc; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for atomic.LoadInt32(&stopping) == 0 && atomic.AddInt64(&next, 1) <= *total {
+				d.operation()
+			}
+		}()
+	}
+
+	done := make(chan struct{})
+	go func() {
+		wg.Wait()
+		close(done)
+	}()
+
+	ticker := time.NewTicker(*interval)
+	defer ticker.Stop()
+
+loop:
+	for {
+		select {
+		case <-ticker.C:
+			take()
+		case <-done:
+			break loop
+		}
+	}
+
+	// let the server finish with the last connections before the final sample
+	time.Sleep(time.Second)
+	take()
+
+	printGrowth(samples, *warmup)
+}
+
+// operation runs one connection to the server, injecting a failure into a
+// fraction of them
+func (d *driver) operation() {
+	mode := ""
+	if d.failPct > 0 && rand.Float64() < d.failPct {
+		mode = failModes[rand.Intn(len(failModes))]
+	}
+
+	err := d.run(mode)
+	if err != nil {
+		atomic.AddInt64(&d.failures, 1)
+		fmt.Fprintf(os.Stderr, "%s: %v\n", nameOf(mode), err)
+	}
+	atomic.AddInt64(&d.ops, 1)
+}
+
+func nameOf(mode string) string {
+	if mode == "" {
+		return "normal"
+	}
+	return mode
+}
+
+func (d *driver) run(mode string) error {
+	conn, err := net.DialTimeout("tcp", d.addr, 10*time.Second)
+	if err != nil {
+		return err
+	}
+	defer conn.Close()
+
+	// a broken server must not hang the whole run
+	_ = conn.SetDeadline(time.Now().Add(30 * time.Second))
+
+	if mode == "garbage" {
+		junk := make([]byte, 16+rand.Intn(256))
+		_, _ = rand.Read(junk)
+		if err = sendToken(conn, junk); err != nil {
+			return err
+		}
+		// the server may send an error token before it hangs up
+		_, _ = io.Copy(ioutil.Discard, conn)
+		return nil
+	}
+
+	client := gssapi.NewMech("kerberos_v5")
+	flags := gssapi.ContextFlagInteg | gssapi.ContextFlagConf | gssapi.ContextFlagReplay |
+		gssapi.ContextFlagSequence | gssapi.ContextFlagMutual
+	if err = client.Initiate(d.service, flags, nil); err != nil {
+		return err
+	}
+
+	var inToken, outToken []byte
+	for !client.IsEstablished() {
+		if outToken, err = client.Continue(inToken); err != nil {
+			return err
+		}
+		if len(outToken) > 0 {
+			if err = sendToken(conn, outToken); err != nil {
+				return err
+			}
+		}
+		if mode == "hangup" {
+			return nil
+		}
+		if !client.IsEstablished() {
+			if inToken, err = recvToken(conn); err != nil {
+				return err
+			}
+		}
+	}
+
+	if mode == "no-message" {
+		return nil
+	}
+
+	if outToken, err = client.Wrap(d.msg, d.seal); err != nil {
+		return err
+	}
+	if mode == "bad-wrap" {
+		// the last byte is always part of the checksum
+		outToken[len(outToken)-1] ^= 0xff
+		if err = sendToken(conn, outToken); err != nil {
+			return err
+		}
+		if _, err = recvToken(conn); err == nil {
+			return errors.New("server accepted a corrupted wrap token")
+		}
+		return nil
+	}
+
+	if err = sendToken(conn, outToken); err != nil {
+		return err
+	}
+	if inToken, err = recvToken(conn); err != nil {
+		return err
+	}
+
+	return client.VerifySignature(d.msg, inToken)
+}
+
+func sendToken(conn net.Conn, token []byte) error {
+	buf := make([]byte, 4+len(token))
+	binary.BigEndian.PutUint32(buf, uint32(len(token)))
+	copy(buf[4:], token)
+
+	_, err := conn.Write(buf)
+	return err
+}
+
+func recvToken(conn net.Conn) ([]byte, error) {
+	var szBuff [4]byte
+	if _, err := io.ReadFull(conn, szBuff[:]); err != nil {
+		return nil, err
+	}
+
+	token := make([]byte, binary.BigEndian.Uint32(szBuff[:]))
+	if _, err := io.ReadFull(conn, token); err != nil {
+		return nil, err
+	}
+
+	return token, nil
+}
+
+// takeSample reads the server's memory and descriptor use from /proc, and
+// its Go runtime statistics if debugAddr is set
+func takeSample(pid int, debugAddr string) (s sample, err error) {
+	status, err := ioutil.ReadFile(fmt.Sprintf("/proc/%d/status", pid))
+	if err != nil {
+		return
+	}
+
+	for _, line := range strings.Split(string(status), "\n") {
+		fields := strings.Fields(line)
+		if len(fields) < 2 {
+			continue
+		}
+		var v float64
+		if v, err = strconv.ParseFloat(fields[1], 64); err != nil {
+			err = nil
+			continue
+		}
+
+		switch fields[0] {
+		case "VmRSS:":
+			s.rssKB = v
+		case "RssAnon:":
+			s.anonKB = v
+		case "VmData:":
+			s.dataKB = v
+		}
+	}
+
+	fds, err := ioutil.ReadDir(fmt.Sprintf("/proc/%d/fd", pid))
+	if err != nil {
+		return
+	}
+	s.fds = float64(len(fds))
+
+	if debugAddr != "" {
+		err = sampleGo(&s, debugAddr)
+	}
+
+	return
+}
+
+func sampleGo(s *sample, debugAddr string) error {
+	resp, err := http.Get("http://" + debugAddr + "/debug/vars")
+	if err != nil {
+		return err
+	}
+	defer resp.Body.Close()
+
+	var vars struct {
+		Memstats struct {
+			HeapAlloc   uint64
+			HeapObjects uint64
+			NumGC       uint32
+		} `json:"memstats"`
+		Goroutines int `json:"goroutines"`
+	}
+	if err = json.NewDecoder(resp.Body).Decode(&vars); err != nil {
+		return fmt.Errorf("decoding %s/debug/vars: %w", debugAddr, err)
+	}
+
+	s.haveGo = true
+	s.heapKB = float64(vars.Memstats.HeapAlloc) / 1024
+	s.heapObjs = float64(vars.Memstats.HeapObjects)
+	s.numGC = float64(vars.Memstats.NumGC)
+	s.goroutines = float64(vars.Goroutines)
+
+	return nil
+}
+
+func printSample(s *sample, header bool) {
+	if header {
+		fmt.Printf("%10s %10s %8s %10s %10s %10s %6s", "elapsed", "ops", "failed", "rss KiB", "anon KiB", "data KiB", "fds")
+		if s.haveGo {
+			fmt.Printf(" %10s %10s %8s %6s", "heap KiB", "objects", "gc", "gorout")
+		}
+		fmt.Println()
+	}
+
+	fmt.Printf("%10s %10d %8d %10.0f %10.0f %10.0f %6.0f", s.elapsed.Round(time.Second), s.ops, s.failures,
+		s.rssKB, s.anonKB, s.dataKB, s.fds)
+	if s.haveGo {
+		fmt.Printf(" %10.0f %10.0f %8.0f %6.0f", s.heapKB, s.heapObjs, s.numGC, s.goroutines)
+	}
+	fmt.Println()
+}
+
+type measure struct {
+	name string
+	get  func(*sample) float64
+}
+
+// printGrowth prints the growth of each measure per million operations,
+// fitted to the samples taken after warmup operations
+func printGrowth(samples []sample, warmup int64) {
+	var fit []sample
+	for _, s := range samples {
+		if s.ops >= warmup {
+			fit = append(fit, s)
+		}
+	}
+
+	last := samples[len(samples)-1]
+	fmt.Printf("\n%d operations, %d unexpected failures in %s\n", last.ops, last.failures, last.elapsed.Round(time.Second))
+	if len(fit) < 3 || fit[len(fit)-1].ops == fit[0].ops {
+		fmt.Println("not enough samples after warm-up to measure growth, run longer or lower -warmup or -interval")
+		return
+	}
+
+	measures := []measure{
+		{"rss KiB", func(s *sample) float64 { return s.rssKB }},
+		{"anon KiB", func(s *sample) float64 { return s.anonKB }},
+		{"data KiB", func(s *sample) float64 { return s.dataKB }},
+		{"fds", func(s *sample) float64 { return s.fds }},
+	}
+	if last.haveGo {
+		measures = append(measures, []measure{
+			{"go heap KiB", func(s *sample) float64 { return s.heapKB }},
+			{"go heap objects", func(s *sample) float64 { return s.heapObjs }},
+			{"goroutines", func(s *sample) float64 { return s.goroutines }},
+		}...)
+	}
+
+	fmt.Printf("growth per million operations, from %d samples after %d operations:\n", len(fit), fit[0].ops)
+	for _, m := range measures {
+		fmt.Printf("  %-16s %12.1f\n", m.name, slope(fit, m.get)*1e6)
+	}
+}
+
+// slope returns the least squares slope of get(s) against s.ops
+func slope(samples []sample, get func(*sample) float64) float64 {
+	var sx, sy, sxx, sxy float64
+	n := float64(len(samples))
+
+	for i := range samples {
+		x := float64(samples[i].ops)
+		y := get(&samples[i])
+		sx += x
+		sy += y
+		sxx += x * x
+		sxy += x * y
+	}
+
+	return (n*sxy - sx*sy) / (n*sxx - sx*sx)
+}
+
+func fatal(err error) {
+	fmt.Fprintln(os.Stderr, err)
+	os.Exit(1)
+}
@@ -42,6 +42,8 @@ import java.net.Socket;
 import java.io.IOException;
 import java.io.DataInputStream;
 import java.io.DataOutputStream;
+import java.nio.file.Files;
+import java.nio.file.Paths;
 
 /**
  * A sample client application that uses JGSS to do mutual authentication
@@ -69,15 +71,42 @@ public class SampleClient {
 
         // Obtain the command-line arguments and parse the port number
 
-        if (args.length < 3) {
+        boolean seal = true;
+        boolean useFile = false;
+        int argi = 0;
+
+        while (argi < args.length && args[argi].startsWith("-")) {
+            if (args[argi].equals("-sign")) {
+                seal = false;
+            } else if (args[argi].equals("-f")) {
+                useFile = true;
+            } else {
+                break;
+            }
+            argi++;
+        }
+
+        if (args.length - argi < 3) {
             System.err.println("Usage: java <options> Login SampleClient "
-                               + " <server> <hostName> <port>");
+                               + " [-sign] [-f] <server> <hostName> <port>"
+                               + " [message]");
             System.exit(-1);
         }
 
-        String server = args[0];
-        String hostName = args[1];
-        int port = Integer.parseInt(args[2]);
+        String server = args[argi];
+        String hostName = args[argi + 1];
+        int port = Integer.parseInt(args[argi + 2]);
+
+        /*
+         * The message defaults to the original greeting.  With -f the
+         * message argument names a file whose contents are sent instead.
+         */
+        byte[] messageBytes = "Hello There!\0".getBytes();
+        if (args.length - argi > 3) {
+            String message = args[argi + 3];
+            messageBytes = useFile ? Files.readAllBytes(Paths.get(message))
+                                   : message.getBytes();
+        }
 
         Socket socket = new Socket(hostName, port);
         DataInputStream inStream =
@@ -178,15 +207,13 @@ public class SampleClient {
         if (context.getMutualAuthState())
             System.out.println("Mutual authentication took place!");
 
-        byte[] messageBytes = "Hello There!\0".getBytes();
-
         /*
          * The first MessageProp argument is 0 to request
          * the default Quality-of-Protection.
          * The second argument is true to request
-         * privacy (encryption of the message).
+         * privacy (encryption of the message), unless -sign was given.
          */
-        MessageProp prop =  new MessageProp(0, true);
+        MessageProp prop =  new MessageProp(0, seal);
 
         /*
          * Encrypt the data and send it across. Integrity protection
@@ -0,0 +1,254 @@
+import org.ietf.jgss.*;
+import java.io.*;
+import java.net.Socket;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+import java.util.Random;
+import java.util.concurrent.atomic.AtomicInteger;
+
+/**
+ * A multi-threaded load driver for the sample servers.  It speaks the same
+ * protocol as SampleClient, so it can be pointed at the C, Go or Java
+ * server:
+ *
+ *    1.  Context establishment loop, as for SampleClient.
+ *    2.  client sends a wrap token to the server.
+ *    3.  server sends a MIC token for the message, which the client
+ *        verifies.
+ *    4.  steps 2 and 3 are repeated -messages times over the same context,
+ *        then the connection is closed.
+ *
+ * SampleServer serves any number of messages per session.  The C and Go
+ * servers handle a single message per connection, so leave -messages at
+ * its default of 1 when driving them.
+ *
+ * Initiator credentials are acquired once and shared by every thread, so
+ * the measurement covers context establishment and per-message protection
+ * rather than reading the ticket cache.
+ *
+ * Usage: java <options> SampleLoad [-threads n] [-connections n]
+ *            [-messages n] [-size bytes] [-sign] <server> <hostName> <port>
+ */
+
+public class SampleLoad {
+
+    private static String server;
+    private static String hostName;
+    private static int port;
+    private static int messages = 1;
+    private static boolean seal = true;
+    private static byte[] payload;
+
+    private static final Oid krb5Oid;
+    static {
+        try {
+            krb5Oid = new Oid("1.2.840.113554.1.2.2");
+        } catch (GSSException e) {
+            throw new ExceptionInInitializerError(e);
+        }
+    }
+
+    private static GSSManager manager;
+    private static GSSCredential creds;
+    private static GSSName serverName;
+
+    private static final AtomicInteger remaining = new AtomicInteger();
+    private static final AtomicInteger failures = new AtomicInteger();
+    private static final AtomicInteger completed = new AtomicInteger();
+
+    // the largest token accepted from the server, as in SampleServer
+    private static final int MAX_TOKEN_SIZE = 16 * 1024 * 1024;
+
+    public static void main(String[] args) throws Exception {
+        int threads = 4;
+        int connections = 100;
+        int size = 64;
+        int argi = 0;
+
+        while (argi < args.length && args[argi].startsWith("-")) {
+            String opt = args[argi];
+            if (opt.equals("-sign")) {
+                seal = false;
+            } else if (argi + 1 < args.length && opt.equals("-threads")) {
+                threads = Integer.parseInt(args[++argi]);
+            } else if (argi + 1 < args.length && opt.equals("-connections")) {
+                connections = Integer.parseInt(args[++argi]);
+            } else if (argi + 1 < args.length && opt.equals("-messages")) {
+                messages = Integer.parseInt(args[++argi]);
+            } else if (argi + 1 < args.length && opt.equals("-size")) {
+                size = Integer.parseInt(args[++argi]);
+            } else {
+                usage();
+            }
+            argi++;
+        }
+
+        if (args.length - argi != 3 || threads < 1 || messages < 1) {
+            usage();
+        }
+
+        server = args[argi];
+        hostName = args[argi + 1];
+        port = Integer.parseInt(args[argi + 2]);
+
+        payload = new byte[size];
+        new Random().nextBytes(payload);
+
+        manager = GSSManager.getInstance();
+        serverName = manager.createName(server, null);
+        creds = manager.createCredential(null, GSSCredential.DEFAULT_LIFETIME,
+                                         krb5Oid, GSSCredential.INITIATE_ONLY);
+
+        remaining.set(connections);
+
+        Worker[] workers = new Worker[threads];
+        long start = System.nanoTime();
+
+        for (int i = 0; i < threads; i++) {
+            workers[i] = new Worker();
+            workers[i].start();
+        }
+
+        List<Long> handshakes = new ArrayList<Long>();
+        List<Long> exchanges = new ArrayList<Long>();
+        for (Worker w : workers) {
+            w.join();
+            handshakes.addAll(w.handshakes);
+            exchanges.addAll(w.exchanges);
+        }
+
+        double elapsed = (System.nanoTime() - start) / 1e9;
+
+        System.out.printf("threads %d, connections %d completed, %d failed, "
+                          + "messages per connection %d, payload %d bytes, %s%n",
+                          threads, completed.get(), failures.get(),
+                          messages, size, seal ? "sealed" : "signed");
+        System.out.printf("elapsed %.2f s, %.1f handshakes/s, %.1f messages/s%n",
+                          elapsed, handshakes.size() / elapsed,
+                          exchanges.size() / elapsed);
+        report("handshake", handshakes);
+        report("message", exchanges);
+
+        creds.dispose();
+
+        if (failures.get() > 0)
+            System.exit(1);
+    }
+
+    private static void usage() {
+        System.err.println("Usage: java <options> SampleLoad [-threads n] "
+                           + "[-connections n] [-messages n] [-size bytes] "
+                           + "[-sign] <server> <hostName> <port>");
+        System.exit(-1);
+    }
+
+    private static void report(String what, List<Long> nanos) {
+        if (nanos.isEmpty())
+            return;
+
+        long[] sorted = new long[nanos.size()];
+        for (int i = 0; i < sorted.length; i++)
+            sorted[i] = nanos.get(i);
+        Arrays.sort(sorted);
+
+        System.out.printf("%-9s latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f%n",
+                          what,
+                          percentile(sorted, 0.50) / 1e6,
+                          percentile(sorted, 0.90) / 1e6,
+                          percentile(sorted, 0.99) / 1e6,
+                          sorted[sorted.length - 1] / 1e6);
+    }
+
+    private static long percentile(long[] sorted, double p) {
+        int idx = (int)Math.ceil(p * sorted.length) - 1;
+        return sorted[Math.max(0, Math.min(idx, sorted.length - 1))];
+    }
+
+    private static class Worker extends Thread {
+        final List<Long> handshakes = new ArrayList<Long>();
+        final List<Long> exchanges = new ArrayList<Long>();
+
+        public void run() {
+            while (remaining.getAndDecrement() > 0) {
+                try {
+                    connection();
+                    completed.incrementAndGet();
+                } catch (Exception e) {
+                    failures.incrementAndGet();
+                    System.err.println("Connection failed: " + e);
+                }
+            }
+        }
+
+        private void connection() throws IOException, GSSException {
+            Socket socket = new Socket(hostName, port);
+            GSSContext context = null;
+
+            try {
+                socket.setTcpNoDelay(true);
+                DataInputStream inStream = new DataInputStream(
+                    new BufferedInputStream(socket.getInputStream()));
+                DataOutputStream outStream = new DataOutputStream(
+                    new BufferedOutputStream(socket.getOutputStream()));
+
+                long t0 = System.nanoTime();
+
+                context = manager.createContext(serverName, krb5Oid, creds,
+                                                GSSContext.DEFAULT_LIFETIME);
+                context.requestMutualAuth(true);
+                context.requestConf(true);
+                context.requestInteg(true);
+
+                byte[] token = new byte[0];
+                while (!context.isEstablished()) {
+                    token = context.initSecContext(token, 0, token.length);
+                    if (token != null)
+                        send(outStream, token);
+
+                    if (!context.isEstablished())
+                        token = receive(inStream);
+                }
+
+                handshakes.add(System.nanoTime() - t0);
+
+                MessageProp prop = new MessageProp(0, seal);
+                for (int i = 0; i < messages; i++) {
+                    t0 = System.nanoTime();
+
+                    prop.setQOP(0);
+                    prop.setPrivacy(seal);
+                    token = context.wrap(payload, 0, payload.length, prop);
+                    send(outStream, token);
+
+                    token = receive(inStream);
+                    context.verifyMIC(token, 0, token.length,
+                                      payload, 0, payload.length, prop);
+
+                    exchanges.add(System.nanoTime() - t0);
+                }
+            } finally {
+                if (context != null)
+                    context.dispose();
+                socket.close();
+            }
+        }
+
+        private void send(DataOutputStream out, byte[] token)
+            throws IOException {
+            out.writeInt(token.length);
+            out.write(token);
+            out.flush();
+        }
+
+        private byte[] receive(DataInputStream in) throws IOException {
+            int length = in.readInt();
+            if (length < 0 || length > MAX_TOKEN_SIZE)
+                throw new IOException("Bad token length " + length);
+
+            byte[] token = new byte[length];
+            in.readFully(token);
+            return token;
+        }
+    }
+}
@@ -41,6 +41,8 @@ import org.ietf.jgss.*;
 import java.io.*;
 import java.net.Socket;
 import java.net.ServerSocket;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
 
 /**
  * A sample server application that uses JGSS to do mutual authentication
@@ -59,111 +61,195 @@ import java.net.ServerSocket;
  *    2. client sends a wrap token to the server.
  *    3. server sends a mic token to the client for the application
  *       message that was contained in the wrap token.
+ *    4. steps 2 and 3 repeat until the client closes the connection.
+ *
+ * By default connections are handled one at a time on the main thread.
+ * With -threads N each connection is handed to a pool of N threads, so
+ * that many persistent sessions can be served at once.  -q turns off the
+ * per-token logging, which otherwise dominates when measuring throughput.
  */
 
 public class SampleServer  {
 
+    private static volatile boolean verbose = true;
+
+    // the largest token accepted from a client, as in the C server
+    private static final int MAX_TOKEN_SIZE = 16 * 1024 * 1024;
+
     public static void main(String[] args)
         throws IOException, GSSException {
 
         // Obtain the command-line arguments and parse the port number
 
-        if (args.length != 1) {
-            System.err.println("Usage: java <options> Login SampleServer <localPort>");
+        int threads = 0;
+        int argi = 0;
+
+        while (argi < args.length && args[argi].startsWith("-")) {
+            if (args[argi].equals("-threads") && argi + 1 < args.length) {
+                threads = Integer.parseInt(args[++argi]);
+            } else if (args[argi].equals("-q")) {
+                verbose = false;
+            } else {
+                break;
+            }
+            argi++;
+        }
+
+        if (args.length - argi != 1) {
+            System.err.println("Usage: java <options> Login SampleServer "
+                               + "[-threads <n>] [-q] <localPort>");
             System.exit(-1);
         }
 
-        int localPort = Integer.parseInt(args[0]);
+        int localPort = Integer.parseInt(args[argi]);
+
+        ServerSocket ss = new ServerSocket(localPort, 128);
 
-        ServerSocket ss = new ServerSocket(localPort);
+        final GSSManager manager = GSSManager.getInstance();
 
-        GSSManager manager = GSSManager.getInstance();
+        ExecutorService pool = null;
+        if (threads > 0) {
+            pool = Executors.newFixedThreadPool(threads);
+        }
 
         while (true) {
 
-            System.out.println("Waiting for incoming connection...");
+            log("Waiting for incoming connection...");
 
-            Socket socket = ss.accept();
-            DataInputStream inStream =
-                new DataInputStream(socket.getInputStream());
-            DataOutputStream outStream =
-                new DataOutputStream(socket.getOutputStream());
+            final Socket socket = ss.accept();
 
-            System.out.println("Got connection from client "
-                               + socket.getInetAddress());
+            if (pool == null) {
+                serve(manager, socket);
+                continue;
+            }
 
-            /*
-             * Create a GSSContext to receive the incoming request
-             * from the client. Use null for the server credentials
-             * passed in. This tells the underlying mechanism
-             * to use whatever credentials it has available that
-             * can be used to accept this connection.
-             */
-            GSSContext context = manager.createContext((GSSCredential)null);
+            pool.execute(new Runnable() {
+                public void run() {
+                    serve(manager, socket);
+                }
+            });
+        }
+    }
 
-            // Do the context eastablishment loop
+    /*
+     * Serve one client connection, reporting rather than propagating
+     * errors so that one bad client does not stop the server.
+     */
+    private static void serve(GSSManager manager, Socket socket) {
+        GSSContext context = null;
 
-            byte[] token = null;
+        try {
+            context = manager.createContext((GSSCredential)null);
+            session(context, socket);
+        } catch (IOException e) {
+            System.err.println("Connection with client "
+                               + socket.getInetAddress() + " failed: " + e);
+        } catch (GSSException e) {
+            System.err.println("GSS-API error with client "
+                               + socket.getInetAddress() + ": " + e);
+        } finally {
+            log("Closing connection with client "
+                + socket.getInetAddress());
+            try {
+                if (context != null)
+                    context.dispose();
+            } catch (GSSException e) {
+                // nothing more to do with the context
+            }
+            try {
+                socket.close();
+            } catch (IOException e) {
+                // nothing more to do with the socket
+            }
+        }
+    }
 
-            while (!context.isEstablished()) {
+    private static void session(GSSContext context, Socket socket)
+        throws IOException, GSSException {
 
-                token = new byte[inStream.readInt()];
-                System.out.println("Will read input token of size "
-                                   + token.length
-                                   + " for processing by acceptSecContext");
-                inStream.readFully(token);
+        DataInputStream inStream =
+            new DataInputStream(new BufferedInputStream(socket.getInputStream()));
+        DataOutputStream outStream =
+            new DataOutputStream(new BufferedOutputStream(socket.getOutputStream()));
 
-                token = context.acceptSecContext(token, 0, token.length);
+        log("Got connection from client " + socket.getInetAddress());
 
-                // Send a token to the peer if one was generated by
-                // acceptSecContext
-                if (token != null) {
-                    System.out.println("Will send token of size "
-                                       + token.length
-                                       + " from acceptSecContext.");
-                    outStream.writeInt(token.length);
-                    outStream.write(token);
-                    outStream.flush();
-                }
+        /*
+         * The context was created with null server credentials.  This
+         * tells the underlying mechanism to use whatever credentials it
+         * has available that can be used to accept this connection.
+         */
+
+        // Do the context eastablishment loop
+
+        byte[] token = null;
+
+        while (!context.isEstablished()) {
+
+            token = newToken(inStream.readInt());
+            log("Will read input token of size "
+                + token.length
+                + " for processing by acceptSecContext");
+            inStream.readFully(token);
+
+            token = context.acceptSecContext(token, 0, token.length);
+
+            // Send a token to the peer if one was generated by
+            // acceptSecContext
+            if (token != null) {
+                log("Will send token of size "
+                    + token.length
+                    + " from acceptSecContext.");
+                outStream.writeInt(token.length);
+                outStream.write(token);
+                outStream.flush();
             }
+        }
 
-            System.out.print("Context Established! ");
-            System.out.println("Client is " + context.getSrcName());
-            System.out.println("Server is " + context.getTargName());
-            /*
-             * If mutual authentication did not take place, then
-             * only the client was authenticated to the
-             * server. Otherwise, both client and server were
-             * authenticated to each other.
-             */
-            if (context.getMutualAuthState())
-                System.out.println("Mutual authentication took place!");
+        log("Context Established! Client is " + context.getSrcName()
+            + ", Server is " + context.getTargName());
+        /*
+         * If mutual authentication did not take place, then
+         * only the client was authenticated to the
+         * server. Otherwise, both client and server were
+         * authenticated to each other.
+         */
+        if (context.getMutualAuthState())
+            log("Mutual authentication took place!");
 
-            /*
-             * Create a MessageProp which unwrap will use to return
-             * information such as the Quality-of-Protection that was
-             * applied to the wrapped token, whether or not it was
-             * encrypted, etc. Since the initial MessageProp values
-             * are ignored, just set them to the defaults of 0 and false.
-             */
-            MessageProp prop = new MessageProp(0, false);
+        /*
+         * Create a MessageProp which unwrap will use to return
+         * information such as the Quality-of-Protection that was
+         * applied to the wrapped token, whether or not it was
+         * encrypted, etc. Since the initial MessageProp values
+         * are ignored, just set them to the defaults of 0 and false.
+         */
+        MessageProp prop = new MessageProp(0, false);
 
+        while (true) {
             /*
-             * Read the token. This uses the same token byte array
-             * as that used during context establishment.
+             * Read the next token.  A client that has finished with
+             * the session simply closes the connection.
              */
-            token = new byte[inStream.readInt()];
-            System.out.println("Will read token of size "
-                               + token.length);
+            int length;
+            try {
+                length = inStream.readInt();
+            } catch (EOFException e) {
+                return;
+            }
+
+            token = newToken(length);
+            log("Will read token of size " + token.length);
             inStream.readFully(token);
 
             byte[] bytes = context.unwrap(token, 0, token.length, prop);
-            String str = new String(bytes);
-            System.out.println("Received data \""
-                               + str + "\" of length " + str.length());
+            if (verbose) {
+                String str = new String(bytes);
+                log("Received data \""
+                    + str + "\" of length " + str.length());
 
-            System.out.println("Confidentiality applied: "
-                               + prop.getPrivacy());
+                log("Confidentiality applied: " + prop.getPrivacy());
+            }
 
             /*
              * Now generate a MIC and send it to the client. This is
@@ -181,16 +267,25 @@ public class SampleServer  {
 
             token = context.getMIC(bytes, 0, bytes.length, prop);
 
-            System.out.println("Will send MIC token of size "
-                               + token.length);
+            log("Will send MIC token of size " + token.length);
             outStream.writeInt(token.length);
             outStream.write(token);
             outStream.flush();
-
-            System.out.println("Closing connection with client "
-                               + socket.getInetAddress());
-            context.dispose();
-            socket.close();
         }
     }
+
+    /*
+     * Allocate a buffer for a token of the length the client sent,
+     * rejecting a length that no token could have.
+     */
+    private static byte[] newToken(int length) throws IOException {
+        if (length < 0 || length > MAX_TOKEN_SIZE)
+            throw new IOException("Bad token length " + length);
+        return new byte[length];
+    }
+
+    private static void log(String msg) {
+        if (verbose)
+            System.out.println(msg);
+    }
 }
@@ -0,0 +1,216 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package gssapi
+
+import (
+	"sync"
+	"time"
+)
+
+// buffers are pooled in power of two sizes from 512 bytes to 1 MiB; larger
+// ones are allocated to size and left to the garbage collector
+const (
+	minBufferShift = 9
+	maxBufferShift = 20
+)
+
+// DefaultBufferIdle is how long a TokenConn using the default pool may be
+// idle before its buffers are reclaimed
+const DefaultBufferIdle = 30 * time.Second
+
+// DefaultMaxPooled is the most free buffer space the default pool keeps
+const DefaultMaxPooled = 64 << 20
+
+// BufferPool lends read and write buffers to TokenConns and takes them
+// back once a connection has been idle for a while, so that the memory
+// held by a server with many mostly idle connections follows its traffic
+// rather than its connection count.
+type BufferPool struct {
+	idle      time.Duration
+	maxPooled int64
+
+	mu        sync.Mutex
+	free      [maxBufferShift - minBufferShift + 1][][]byte
+	conns     map[*TokenConn]struct{}
+	held      int64
+	pooled    int64
+	reclaimed uint64
+	done      chan struct{}
+	closeOnce sync.Once
+}
+
+// BufferStats is a snapshot of a BufferPool's memory
+type BufferStats struct {
+	// Held is the size in bytes of the buffers held by connections
+	Held int64
+	// Pooled is the size in bytes of the free buffers kept for reuse
+	Pooled int64
+	// Connections is the number of connections using the pool
+	Connections int
+	// Reclaimed counts the buffers taken back from idle connections
+	Reclaimed uint64
+}
+
+var (
+	defaultPool     *BufferPool
+	defaultPoolOnce sync.Once
+)
+
+// DefaultBufferPool returns the pool that TokenConns use when they are
+// not given one, which reclaims buffers after DefaultBufferIdle and keeps
+// up to DefaultMaxPooled bytes of free buffers
+func DefaultBufferPool() *BufferPool {
+	defaultPoolOnce.Do(func() {
+		defaultPool = NewBufferPool(DefaultBufferIdle, DefaultMaxPooled)
+	})
+	return defaultPool
+}
+
+// NewBufferPool returns a pool that reclaims the buffers of connections
+// idle for longer than idle, and keeps at most maxPooled bytes of free
+// buffers; anything beyond that is left to the garbage collector.  The
+// pool checks its connections from a goroutine that runs until Close.
+func NewBufferPool(idle time.Duration, maxPooled int64) *BufferPool {
+	p := &BufferPool{
+		idle:      idle,
+		maxPooled: maxPooled,
+		conns:     make(map[*TokenConn]struct{}),
+		done:      make(chan struct{}),
+	}
+
+	go p.reclaimIdle()
+
+	return p
+}
+
+// Stats returns the pool's current memory use
+func (p *BufferPool) Stats() BufferStats {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	return BufferStats{
+		Held:        p.held,
+		Pooled:      p.pooled,
+		Connections: len(p.conns),
+		Reclaimed:   p.reclaimed,
+	}
+}
+
+// Close stops reclaiming buffers from idle connections
+func (p *BufferPool) Close() {
+	p.closeOnce.Do(func() {
+		close(p.done)
+	})
+}
+
+func bufferShift(n int) uint {
+	s := uint(minBufferShift)
+	for s <= maxBufferShift && 1<<s < n {
+		s++
+	}
+	return s
+}
+
+// get returns a buffer of at least n bytes
+func (p *BufferPool) get(n int) []byte {
+	s := bufferShift(n)
+
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	if s > maxBufferShift {
+		p.held += int64(n)
+		return make([]byte, n)
+	}
+
+	var b []byte
+	if free := p.free[s-minBufferShift]; len(free) > 0 {
+		b = free[len(free)-1]
+		free[len(free)-1] = nil
+		p.free[s-minBufferShift] = free[:len(free)-1]
+		p.pooled -= int64(cap(b))
+	} else {
+		b = make([]byte, 1<<s)
+	}
+
+	p.held += int64(cap(b))
+	return b[:cap(b)]
+}
+
+// put returns a buffer from get
+func (p *BufferPool) put(b []byte) {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	p.held -= int64(cap(b))
+
+	s := bufferShift(cap(b))
+	if s > maxBufferShift || 1<<s != cap(b) || p.pooled+int64(cap(b)) > p.maxPooled {
+		return
+	}
+
+	p.free[s-minBufferShift] = append(p.free[s-minBufferShift], b[:cap(b)])
+	p.pooled += int64(cap(b))
+}
+
+// forget stops counting a buffer from get without pooling it, because it
+// may still be in use
+func (p *BufferPool) forget(b []byte) {
+	p.mu.Lock()
+	p.held -= int64(cap(b))
+	p.mu.Unlock()
+}
+
+func (p *BufferPool) register(c *TokenConn) {
+	p.mu.Lock()
+	p.conns[c] = struct{}{}
+	p.mu.Unlock()
+}
+
+func (p *BufferPool) unregister(c *TokenConn) {
+	p.mu.Lock()
+	delete(p.conns, c)
+	p.mu.Unlock()
+}
+
+// reclaimIdle checks the connections twice per idle period
+func (p *BufferPool) reclaimIdle() {
+	tick := p.idle / 2
+	if tick < time.Millisecond {
+		tick = time.Millisecond
+	}
+
+	t := time.NewTicker(tick)
+	defer t.Stop()
+
+	var conns []*TokenConn
+	for {
+		select {
+		case <-p.done:
+			return
+		case <-t.C:
+		}
+
+		p.mu.Lock()
+		conns = conns[:0]
+		for c := range p.conns {
+			conns = append(conns, c)
+		}
+		p.mu.Unlock()
+
+		deadline := time.Now().Add(-p.idle)
+		n := 0
+		for i, c := range conns {
+			n += c.reclaim(deadline)
+			conns[i] = nil
+		}
+
+		if n > 0 {
+			p.mu.Lock()
+			p.reclaimed += uint64(n)
+			p.mu.Unlock()
+		}
+	}
+}
@@ -1,6 +1,15 @@
 package common
 
-import "net"
+import (
+	"crypto"
+	"crypto/md5"
+	"crypto/tls"
+	"crypto/x509"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"net"
+)
 
 type gssAddressFamily int
 
@@ -29,8 +38,163 @@ const (
 	GssAddrFamilyX25
 )
 
+// ChannelBinding holds the information used to bind a security context
+// to the underlying communication channel (RFC 2743 § 1.1.6).
 type ChannelBinding struct {
 	InitiatorAddr net.Addr
 	AcceptorAddr  net.Addr
 	Data          []byte
 }
+
+// TLS channel binding types (RFC 5929 § 4, RFC 9266 § 2)
+const (
+	tlsServerEndPointPrefix = "tls-server-end-point:"
+	tlsExporterPrefix       = "tls-exporter:"
+	tlsExporterLabel        = "EXPORTER-Channel-Binding"
+	tlsExporterLength       = 32
+)
+
+// NewTLSServerEndPointBinding returns the tls-server-end-point channel binding
+// for the server certificate cert (RFC 5929 § 4.1).  The binding only depends
+// on the certificate, so a server can create one per listener.
+func NewTLSServerEndPointBinding(cert *x509.Certificate) (*ChannelBinding, error) {
+	if cert == nil {
+		return nil, errors.New("gssapi: no certificate for tls-server-end-point channel binding")
+	}
+
+	// MD5 and SHA-1 are upgraded to SHA-256, otherwise use the hash
+	// from the certificate signature algorithm
+	var h crypto.Hash
+	switch cert.SignatureAlgorithm {
+	case x509.MD5WithRSA, x509.SHA1WithRSA, x509.DSAWithSHA1, x509.ECDSAWithSHA1,
+		x509.SHA256WithRSA, x509.SHA256WithRSAPSS, x509.DSAWithSHA256, x509.ECDSAWithSHA256:
+		h = crypto.SHA256
+	case x509.SHA384WithRSA, x509.SHA384WithRSAPSS, x509.ECDSAWithSHA384:
+		h = crypto.SHA384
+	case x509.SHA512WithRSA, x509.SHA512WithRSAPSS, x509.ECDSAWithSHA512:
+		h = crypto.SHA512
+	default:
+		return nil, fmt.Errorf("gssapi: unsupported certificate signature algorithm for channel binding: %s", cert.SignatureAlgorithm)
+	}
+
+	hash := h.New()
+	_, _ = hash.Write(cert.Raw)
+
+	data := make([]byte, 0, len(tlsServerEndPointPrefix)+h.Size())
+	data = append(data, tlsServerEndPointPrefix...)
+	data = hash.Sum(data)
+
+	return &ChannelBinding{Data: data}, nil
+}
+
+// NewTLSExporterBinding returns the tls-exporter channel binding for a TLS
+// session (RFC 9266).  The binding is unique to the session.
+func NewTLSExporterBinding(cs *tls.ConnectionState) (*ChannelBinding, error) {
+	if cs == nil || !cs.HandshakeComplete {
+		return nil, errors.New("gssapi: TLS handshake is not complete, cannot create tls-exporter channel binding")
+	}
+
+	ekm, err := cs.ExportKeyingMaterial(tlsExporterLabel, nil, tlsExporterLength)
+	if err != nil {
+		return nil, fmt.Errorf("gssapi: tls-exporter channel binding: %w", err)
+	}
+
+	data := make([]byte, 0, len(tlsExporterPrefix)+len(ekm))
+	data = append(data, tlsExporterPrefix...)
+	data = append(data, ekm...)
+
+	return &ChannelBinding{Data: data}, nil
+}
+
+// Digest returns the MD5 hash of the encoded channel bindings, as carried
+// in the Kerberos authenticator checksum (RFC 4121 § 4.1.1.2)
+func (cb *ChannelBinding) Digest() [md5.Size]byte {
+	return md5.Sum(cb.encode())
+}
+
+func (cb *ChannelBinding) encode() []byte {
+	bufSz := 5*4 + len(cb.Data) // 5 x 32 bit length fields plus the data
+
+	// .. plus the length of the address types, if not null
+	for _, addr := range []net.Addr{cb.InitiatorAddr, cb.AcceptorAddr} {
+		if addr == nil {
+			continue
+		}
+
+		switch c := addr.(type) {
+		case *net.IPAddr:
+			bufSz += ipLength(c.IP)
+		case *net.TCPAddr:
+			bufSz += ipLength(c.IP)
+		case *net.UDPAddr:
+			bufSz += ipLength(c.IP)
+		case *net.UnixAddr:
+			bufSz += len(c.Name)
+		}
+	}
+
+	buf := make([]byte, 0, bufSz)
+
+	// write the address types and address data
+	for _, addr := range []net.Addr{cb.InitiatorAddr, cb.AcceptorAddr} {
+		addrType := 0
+		addrData := []byte{}
+
+		if addr != nil {
+			switch c := addr.(type) {
+			case *net.IPAddr:
+				addrType = int(GssAddrFamilyINET)
+				addrData = ipData(c.IP)
+			case *net.TCPAddr:
+				addrType = int(GssAddrFamilyINET)
+				addrData = ipData(c.IP)
+			case *net.UDPAddr:
+				addrType = int(GssAddrFamilyINET)
+				addrData = ipData(c.IP)
+			case *net.UnixAddr:
+				addrType = int(GssAddrFamilyLOCAL)
+				addrData = []byte(c.Name)
+			}
+		}
+
+		// write little endian 32-bit address type and address size
+		bufTmp := [8]byte{}
+		binary.LittleEndian.PutUint32(bufTmp[:], uint32(addrType))
+		binary.LittleEndian.PutUint32(bufTmp[4:], uint32(len(addrData)))
+		buf = append(buf, bufTmp[:]...)
+
+		// write the address data
+		buf = append(buf, addrData...)
+	}
+
+	// write the data
+	bufTmp := [4]byte{}
+	binary.LittleEndian.PutUint32(bufTmp[:], uint32(len(cb.Data)))
+	buf = append(buf, bufTmp[:]...)
+	buf = append(buf, cb.Data...)
+
+	return buf
+}
+
+func ipLength(addr net.IP) int {
+	if addr.To4() != nil {
+		return 4
+	}
+	if addr.To16() != nil {
+		return 16
+	}
+
+	return 0
+}
+
+func ipData(addr net.IP) (ret net.IP) {
+	if ret = addr.To4(); ret != nil {
+		return ret
+	}
+
+	if ret = addr.To16(); ret != nil {
+		return ret
+	}
+
+	return nil
+}
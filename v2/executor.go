@@ -0,0 +1,279 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package gssapi
+
+import (
+	"runtime"
+	"sync"
+	"sync/atomic"
+)
+
+// DefaultSmallJob is the size in bytes at or below which an Executor treats
+// a Wrap payload or Unwrap token as a small message
+const DefaultSmallJob = 16 * 1024
+
+// Executor runs Wrap and Unwrap calls from many connections on a fixed set
+// of worker goroutines, so that the operator can cap the number of cores
+// spent on message protection and small, latency sensitive messages are
+// not held up behind bulk transfers.
+//
+// Small messages go to a shared fast lane that every worker checks first.
+// Larger ones are spread over per-worker queues, and an idle worker steals
+// from the others.  With more than one worker, at most one less than the
+// number of workers run large jobs at once, so there is always a worker
+// free for the fast lane.
+//
+// A single Wrap or Unwrap cannot be split: the RFC 4121 tokens are one
+// CBC-CTS encryption and one HMAC over the whole message.  Applications
+// that can carry a message as several tokens can use WrapChunks so that
+// other connections' work is interleaved between the chunks.
+//
+// One Executor is meant to be shared by the whole process.  The usual rules
+// for a context apply: calls for one context must not overlap, just as if
+// they were made directly.
+type Executor struct {
+	small    chan *cryptoJob
+	workers  []*execWorker
+	wake     chan struct{}
+	done     chan struct{}
+	maxBulk  int32
+	bulkBusy int32
+	next     uint32
+
+	smallJob int
+
+	mu     sync.RWMutex
+	closed bool
+	wg     sync.WaitGroup
+}
+
+type execWorker struct {
+	mu sync.Mutex
+	q  []*cryptoJob
+}
+
+type cryptoJob struct {
+	run  func()
+	done chan struct{}
+}
+
+// NewExecutor starts an Executor with the given number of workers, or
+// GOMAXPROCS workers if workers is zero or less.  Payloads and tokens of up
+// to smallJob bytes use the fast lane; DefaultSmallJob is used if smallJob
+// is zero or less.
+func NewExecutor(workers, smallJob int) *Executor {
+	if workers <= 0 {
+		workers = runtime.GOMAXPROCS(0)
+	}
+	if smallJob <= 0 {
+		smallJob = DefaultSmallJob
+	}
+
+	e := &Executor{
+		small:    make(chan *cryptoJob, 64*workers),
+		workers:  make([]*execWorker, workers),
+		wake:     make(chan struct{}, workers),
+		done:     make(chan struct{}),
+		maxBulk:  int32(workers - 1),
+		smallJob: smallJob,
+	}
+	if e.maxBulk < 1 {
+		e.maxBulk = 1
+	}
+
+	for i := range e.workers {
+		e.workers[i] = &execWorker{}
+	}
+
+	e.wg.Add(workers)
+	for i := range e.workers {
+		go e.work(i)
+	}
+
+	return e
+}
+
+// Wrap calls mech.Wrap on one of the executor's workers
+func (e *Executor) Wrap(mech Mech, payload []byte, confidentiality bool) (tokenOut []byte, err error) {
+	e.do(len(payload), func() {
+		tokenOut, err = mech.Wrap(payload, confidentiality)
+	})
+	return
+}
+
+// Unwrap calls mech.Unwrap on one of the executor's workers
+func (e *Executor) Unwrap(mech Mech, tokenIn []byte) (tokenOut []byte, isSealed bool, err error) {
+	e.do(len(tokenIn), func() {
+		tokenOut, isSealed, err = mech.Unwrap(tokenIn)
+	})
+	return
+}
+
+// WrapChunks wraps payload as a series of tokens of at most chunkSize bytes
+// of payload each, queuing each chunk only once the one before it is done.
+// The peer must unwrap the tokens in order and join the payloads.
+func (e *Executor) WrapChunks(mech Mech, payload []byte, confidentiality bool, chunkSize int) (tokens [][]byte, err error) {
+	if chunkSize <= 0 {
+		chunkSize = len(payload)
+	}
+
+	for {
+		n := chunkSize
+		if n > len(payload) {
+			n = len(payload)
+		}
+
+		var tok []byte
+		if tok, err = e.Wrap(mech, payload[:n], confidentiality); err != nil {
+			return nil, err
+		}
+		tokens = append(tokens, tok)
+
+		if payload = payload[n:]; len(payload) == 0 {
+			return tokens, nil
+		}
+	}
+}
+
+// Close stops the workers once the jobs already queued are done.  Jobs
+// submitted after Close run on the caller's goroutine.
+func (e *Executor) Close() {
+	e.mu.Lock()
+	if !e.closed {
+		e.closed = true
+		close(e.done)
+	}
+	e.mu.Unlock()
+
+	e.wg.Wait()
+}
+
+// do queues a job of size bytes and waits for it to finish
+func (e *Executor) do(size int, run func()) {
+	j := &cryptoJob{run: run, done: make(chan struct{})}
+
+	e.mu.RLock()
+	if e.closed {
+		e.mu.RUnlock()
+		run()
+		return
+	}
+
+	if size <= e.smallJob {
+		e.small <- j
+	} else {
+		w := e.workers[atomic.AddUint32(&e.next, 1)%uint32(len(e.workers))]
+		w.mu.Lock()
+		w.q = append(w.q, j)
+		w.mu.Unlock()
+
+		select {
+		case e.wake <- struct{}{}:
+		default:
+		}
+	}
+	e.mu.RUnlock()
+
+	<-j.done
+}
+
+func (e *Executor) work(me int) {
+	defer e.wg.Done()
+
+	for {
+		// the fast lane first
+		select {
+		case j := <-e.small:
+			e.run(j)
+			continue
+		default:
+		}
+
+		if j := e.bulkJob(me); j != nil {
+			e.run(j)
+			atomic.AddInt32(&e.bulkBusy, -1)
+
+			// another worker may have been held back by maxBulk
+			select {
+			case e.wake <- struct{}{}:
+			default:
+			}
+			continue
+		}
+
+		select {
+		case <-e.done:
+			if e.drained() {
+				return
+			}
+		default:
+		}
+
+		select {
+		case j := <-e.small:
+			e.run(j)
+		case <-e.wake:
+		case <-e.done:
+		}
+	}
+}
+
+func (e *Executor) run(j *cryptoJob) {
+	j.run()
+	close(j.done)
+}
+
+// bulkJob takes the oldest job from the worker's own queue, or steals the
+// oldest from another worker, if fewer than maxBulk large jobs are running
+func (e *Executor) bulkJob(me int) *cryptoJob {
+	if atomic.AddInt32(&e.bulkBusy, 1) > e.maxBulk && !e.closing() {
+		atomic.AddInt32(&e.bulkBusy, -1)
+		return nil
+	}
+
+	for i := 0; i < len(e.workers); i++ {
+		w := e.workers[(me+i)%len(e.workers)]
+
+		w.mu.Lock()
+		if len(w.q) > 0 {
+			j := w.q[0]
+			w.q[0] = nil
+			w.q = w.q[1:]
+			w.mu.Unlock()
+			return j
+		}
+		w.mu.Unlock()
+	}
+
+	atomic.AddInt32(&e.bulkBusy, -1)
+	return nil
+}
+
+func (e *Executor) closing() bool {
+	select {
+	case <-e.done:
+		return true
+	default:
+		return false
+	}
+}
+
+// drained reports whether every queue is empty
+func (e *Executor) drained() bool {
+	if len(e.small) > 0 {
+		return false
+	}
+
+	for _, w := range e.workers {
+		w.mu.Lock()
+		n := len(w.q)
+		w.mu.Unlock()
+		if n > 0 {
+			return false
+		}
+	}
+
+	return true
+}
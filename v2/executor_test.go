@@ -0,0 +1,143 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package gssapi
+
+import (
+	"bytes"
+	"errors"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+// xorMech "wraps" by prefixing a sequence number and inverting the
+// payload, and blocks while wrapping anything in its hold list
+type xorMech struct {
+	Mech
+	sent, received byte
+	hold           map[int]chan struct{}
+}
+
+func (m *xorMech) Wrap(payload []byte, confidentiality bool) ([]byte, error) {
+	if c, ok := m.hold[len(payload)]; ok {
+		<-c
+	}
+
+	tok := []byte{m.sent}
+	for _, b := range payload {
+		tok = append(tok, ^b)
+	}
+	m.sent++
+	return tok, nil
+}
+
+func (m *xorMech) Unwrap(tokenIn []byte) ([]byte, bool, error) {
+	if len(tokenIn) == 0 || tokenIn[0] != m.received {
+		return nil, false, errors.New("bad sequence number")
+	}
+	m.received++
+
+	msg := make([]byte, 0, len(tokenIn)-1)
+	for _, b := range tokenIn[1:] {
+		msg = append(msg, ^b)
+	}
+	return msg, true, nil
+}
+
+func TestExecutor(t *testing.T) {
+	e := NewExecutor(3, 100)
+	defer e.Close()
+
+	// connections each using the executor from their own goroutine, with
+	// a mixture of small and large messages
+	var wg sync.WaitGroup
+	for c := 0; c < 8; c++ {
+		wg.Add(1)
+		go func(c int) {
+			defer wg.Done()
+			sender, receiver := &xorMech{}, &xorMech{}
+
+			for i := 0; i < 50; i++ {
+				payload := bytes.Repeat([]byte{byte(c), byte(i)}, 1+(i%3)*100)
+
+				tok, err := e.Wrap(sender, payload, true)
+				if !assert.NoError(t, err) {
+					return
+				}
+				msg, _, err := e.Unwrap(receiver, tok)
+				if !assert.NoError(t, err) {
+					return
+				}
+				assert.Equal(t, payload, msg)
+			}
+		}(c)
+	}
+	wg.Wait()
+}
+
+func TestExecutorFastLane(t *testing.T) {
+	e := NewExecutor(2, 100)
+	defer e.Close()
+
+	// two bulk jobs that don't finish until released
+	release := make(chan struct{})
+	hold := map[int]chan struct{}{1000: release}
+	var wg sync.WaitGroup
+	for i := 0; i < 2; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			_, err := e.Wrap(&xorMech{hold: hold}, make([]byte, 1000), true)
+			assert.NoError(t, err)
+		}()
+	}
+	time.Sleep(time.Millisecond * 20)
+
+	// small messages still get through
+	done := make(chan struct{})
+	go func() {
+		for i := 0; i < 10; i++ {
+			_, err := e.Wrap(&xorMech{}, []byte("ping"), true)
+			assert.NoError(t, err)
+		}
+		close(done)
+	}()
+
+	select {
+	case <-done:
+	case <-time.After(time.Second * 5):
+		t.Error("small messages starved by bulk jobs")
+	}
+
+	close(release)
+	wg.Wait()
+}
+
+func TestExecutorWrapChunks(t *testing.T) {
+	e := NewExecutor(2, 0)
+
+	sender, receiver := &xorMech{}, &xorMech{}
+	payload := bytes.Repeat([]byte("0123456789"), 25)
+
+	tokens, err := e.WrapChunks(sender, payload, true, 100)
+	require.NoError(t, err)
+	require.Len(t, tokens, 3)
+
+	var joined []byte
+	for _, tok := range tokens {
+		msg, _, err := e.Unwrap(receiver, tok)
+		require.NoError(t, err)
+		joined = append(joined, msg...)
+	}
+	assert.Equal(t, payload, joined)
+
+	// still works, on the caller's goroutine, after Close
+	e.Close()
+	_, err = e.Wrap(sender, payload, true)
+	assert.NoError(t, err)
+}
@@ -93,3 +93,13 @@ type Mech interface {
 	// using a local copy of the payloads.
 	VerifySignature(payload []byte, tokenIn []byte) (err error)
 }
+
+// ChannelBindingAcceptor is implemented by mechanisms whose Acceptors can
+// verify the channel binding that the Initiator used
+type ChannelBindingAcceptor interface {
+	// AcceptWithBinding is used in place of Accept by an Acceptor that
+	// knows the channel binding data the Initiator is expected to have
+	// used.  The context fails to establish if the Initiator used
+	// different bindings.
+	AcceptWithBinding(serviceName string, cb *common.ChannelBinding) (err error)
+}
@@ -0,0 +1,243 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"fmt"
+	"sync"
+	"time"
+
+	"github.com/jcmturner/gokrb5/v8/messages"
+	"github.com/jcmturner/gokrb5/v8/types"
+
+	"github.com/golang-auth/go-gssapi/v2"
+)
+
+// APReqPoolSize is the number of ready-to-send initial context tokens kept
+// for each service and set of request flags.  Building an initial token
+// means fetching the service ticket and creating and encrypting a new
+// authenticator; with a pool, a background goroutine does that ahead of
+// time and Initiate and the first Continue just take a token from the pool.
+//
+// The pool is disabled by default (zero).  Pooled tokens are only used for
+// contexts without channel bindings, each one is used at most once, and
+// they are rebuilt once they are half of ClockSkew old so that the acceptor
+// never sees an authenticator it would consider stale.  Initiate falls back
+// to building the token itself when the pool is empty.
+//
+// A pool takes its size from APReqPoolSize when it is created; changes
+// apply to pools created afterwards.
+var APReqPoolSize = 0
+
+// APReqPoolIdle is how long the background goroutine keeps a service's pool
+// filled after the last Initiate for that service.  Like APReqPoolSize, it is
+// read when the pool is created.
+var APReqPoolIdle = time.Minute * 5
+
+// apReqPoolRetry is how long the background goroutine waits after failing
+// to build a token
+var apReqPoolRetry = time.Second * 5
+
+// pooledAPReq is a pre-built initial context token and the state that
+// Initiate would otherwise have stashed while building it
+type pooledAPReq struct {
+	ticket     messages.Ticket
+	sessionKey types.EncryptionKey
+	peerName   string
+	token      []byte
+	seqNum     uint64
+	cTime      time.Time
+	cusec      int
+	built      time.Time
+}
+
+type apReqPoolKey struct {
+	service string
+	flags   gssapi.ContextFlag
+	cfgFile string
+	ccFile  string
+}
+
+type apReqPool struct {
+	key   apReqPoolKey
+	size  int
+	idle  time.Duration
+	build func() (*pooledAPReq, error)
+	wake  chan struct{}
+
+	mu       sync.Mutex
+	ready    []*pooledAPReq // oldest first
+	lastUsed time.Time
+}
+
+var (
+	apReqPoolsMu sync.Mutex
+	apReqPools   = make(map[apReqPoolKey]*apReqPool)
+
+	// apReqBuilder returns the function that the background goroutine
+	// uses to build tokens for a pool
+	apReqBuilder = newAPReqBuilder
+)
+
+// takePooledAPReq returns a pre-built token for the service, or nil if there
+// isn't one yet.  The first call for a service starts filling its pool.
+func takePooledAPReq(service string, flags gssapi.ContextFlag) *pooledAPReq {
+	key := apReqPoolKey{service: service, flags: flags, cfgFile: krbConfFile(), ccFile: krbCCFile()}
+
+	apReqPoolsMu.Lock()
+	p, ok := apReqPools[key]
+	if !ok {
+		p = &apReqPool{
+			key:      key,
+			size:     APReqPoolSize,
+			idle:     APReqPoolIdle,
+			build:    apReqBuilder(key),
+			wake:     make(chan struct{}, 1),
+			lastUsed: time.Now(),
+		}
+		apReqPools[key] = p
+		go p.run()
+	}
+	apReqPoolsMu.Unlock()
+
+	return p.take()
+}
+
+// apReqMaxAge is the age at which pooled tokens are discarded
+func apReqMaxAge() time.Duration {
+	return ClockSkew / 2
+}
+
+func (p *apReqPool) take() (e *pooledAPReq) {
+	now := time.Now()
+
+	p.mu.Lock()
+	p.lastUsed = now
+	for len(p.ready) > 0 && e == nil {
+		e = p.ready[0]
+		p.ready[0] = nil
+		p.ready = p.ready[1:]
+		if now.Sub(e.built) > apReqMaxAge() {
+			e = nil
+		}
+	}
+	p.mu.Unlock()
+
+	// let the producer replace it
+	select {
+	case p.wake <- struct{}{}:
+	default:
+	}
+
+	return e
+}
+
+// run keeps the pool filled until it has been idle for a while
+func (p *apReqPool) run() {
+	for {
+		now := time.Now()
+		maxAge := apReqMaxAge()
+
+		apReqPoolsMu.Lock()
+		p.mu.Lock()
+		i := 0
+		for i < len(p.ready) && now.Sub(p.ready[i].built) > maxAge {
+			p.ready[i] = nil
+			i++
+		}
+		p.ready = p.ready[i:]
+		need := p.size - len(p.ready)
+
+		if p.size <= 0 || now.Sub(p.lastUsed) > p.idle {
+			p.ready = nil
+			p.mu.Unlock()
+			delete(apReqPools, p.key)
+			apReqPoolsMu.Unlock()
+			return
+		}
+
+		// sleep until the oldest token goes stale, or the pool goes idle
+		wait := p.lastUsed.Add(p.idle).Sub(now)
+		if len(p.ready) > 0 {
+			if stale := p.ready[0].built.Add(maxAge).Sub(now); stale < wait {
+				wait = stale
+			}
+		}
+		p.mu.Unlock()
+		apReqPoolsMu.Unlock()
+
+		if need > 0 {
+			e, err := p.build()
+			if err == nil {
+				p.mu.Lock()
+				p.ready = append(p.ready, e)
+				p.mu.Unlock()
+				continue
+			}
+			if apReqPoolRetry < wait {
+				wait = apReqPoolRetry
+			}
+		}
+
+		timer := time.NewTimer(wait)
+		select {
+		case <-p.wake:
+			timer.Stop()
+		case <-timer.C:
+		}
+	}
+}
+
+// newAPReqBuilder returns a function that builds tokens for the pool using
+// the shared client, so that the service ticket is fetched once and then
+// served from the client's cache
+func newAPReqBuilder(key apReqPoolKey) func() (*pooledAPReq, error) {
+	var lastCTime time.Time
+	var lastCusec int
+
+	return func() (e *pooledAPReq, err error) {
+		rc, err := sharedKrbClient(key.cfgFile, key.ccFile)
+		if err != nil {
+			return
+		}
+		cl := rc.cl
+
+		tkt, sessionKey, err := rc.serviceTicket(key.service)
+		if err != nil {
+			return
+		}
+
+		apreq, auth, err := newAPReq(cl.Credentials, tkt, sessionKey, key.flags, nil)
+		if err != nil {
+			return
+		}
+
+		// the acceptor's replay cache identifies authenticators by their
+		// time, so two tokens from the pool must never share one
+		if auth.CTime.Unix() == lastCTime.Unix() && auth.Cusec == lastCusec {
+			time.Sleep(time.Microsecond)
+			if apreq, auth, err = newAPReq(cl.Credentials, tkt, sessionKey, key.flags, nil); err != nil {
+				return
+			}
+		}
+		lastCTime, lastCusec = auth.CTime, auth.Cusec
+
+		token, err := marshalAPReqToken(&apreq)
+		if err != nil {
+			return
+		}
+
+		return &pooledAPReq{
+			ticket:     tkt,
+			sessionKey: sessionKey,
+			peerName:   fmt.Sprintf("%s@%s", tkt.SName.PrincipalNameString(), tkt.Realm),
+			token:      token,
+			seqNum:     uint64(auth.SeqNumber),
+			cTime:      auth.CTime,
+			cusec:      auth.Cusec,
+			built:      time.Now(),
+		}, nil
+	}
+}
@@ -0,0 +1,110 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/golang-auth/go-gssapi/v2"
+)
+
+// fakeAPReqBuilder builds numbered tokens without a KDC
+func fakeAPReqBuilder(built chan<- int) func(apReqPoolKey) func() (*pooledAPReq, error) {
+	var n int32
+	return func(apReqPoolKey) func() (*pooledAPReq, error) {
+		return func() (*pooledAPReq, error) {
+			i := int(atomic.AddInt32(&n, 1))
+			built <- i
+			return &pooledAPReq{token: []byte{byte(i)}, seqNum: uint64(i), built: time.Now()}, nil
+		}
+	}
+}
+
+// setupAPReqPool makes new pools use the fake builder, returning the channel
+// that it reports builds on and a function to restore the defaults
+func setupAPReqPool(size int, idle time.Duration) (built chan int, restore func()) {
+	built = make(chan int, 100)
+
+	oldSize, oldIdle, oldBuilder := APReqPoolSize, APReqPoolIdle, apReqBuilder
+	APReqPoolSize, APReqPoolIdle, apReqBuilder = size, idle, fakeAPReqBuilder(built)
+
+	return built, func() {
+		APReqPoolSize, APReqPoolIdle, apReqBuilder = oldSize, oldIdle, oldBuilder
+	}
+}
+
+func waitBuilt(t *testing.T, built <-chan int, n int) {
+	for i := 0; i < n; i++ {
+		select {
+		case <-built:
+		case <-time.After(time.Second * 5):
+			t.Fatalf("pool built %d of %d tokens", i, n)
+		}
+	}
+}
+
+// waitNoPools waits for the pools to go idle and stop
+func waitNoPools(t *testing.T) {
+	assert.Eventually(t, func() bool {
+		apReqPoolsMu.Lock()
+		defer apReqPoolsMu.Unlock()
+		return len(apReqPools) == 0
+	}, time.Second*5, time.Millisecond*10)
+}
+
+func TestAPReqPool(t *testing.T) {
+	built, restore := setupAPReqPool(2, time.Millisecond*500)
+	defer restore()
+	service := "test/pool.example.com"
+
+	// the first call only starts the producer
+	assert.Nil(t, takePooledAPReq(service, gssapi.ContextFlagMutual))
+	waitBuilt(t, built, 2)
+	time.Sleep(time.Millisecond * 10)
+
+	// each token is handed out once, oldest first
+	seen := map[uint64]bool{}
+	for i := 0; i < 2; i++ {
+		e := takePooledAPReq(service, gssapi.ContextFlagMutual)
+		require.NotNil(t, e)
+		assert.False(t, seen[e.seqNum], "token %d handed out twice", e.seqNum)
+		seen[e.seqNum] = true
+	}
+
+	// other flags get their own pool
+	assert.Nil(t, takePooledAPReq(service, 0))
+
+	// the used tokens are replaced and the new pool filled
+	waitBuilt(t, built, 4)
+	waitNoPools(t)
+}
+
+func TestAPReqPoolStale(t *testing.T) {
+	p := &apReqPool{wake: make(chan struct{}, 1)}
+	p.ready = []*pooledAPReq{
+		{seqNum: 1, built: time.Now().Add(-ClockSkew)},
+		{seqNum: 2, built: time.Now().Add(-ClockSkew / 4)},
+	}
+
+	e := p.take()
+	require.NotNil(t, e)
+	assert.Equal(t, uint64(2), e.seqNum)
+	assert.Nil(t, p.take())
+}
+
+func TestAPReqPoolIdle(t *testing.T) {
+	built, restore := setupAPReqPool(1, time.Millisecond*50)
+	defer restore()
+
+	takePooledAPReq("test/idle.example.com", 0)
+	waitBuilt(t, built, 1)
+
+	waitNoPools(t)
+}
@@ -0,0 +1,147 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"fmt"
+	"testing"
+
+	"github.com/golang-auth/go-gssapi/v2"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+// mkBatchPair returns an established initiator and acceptor sharing a
+// session key that differs for each n
+func mkBatchPair(n int, flags gssapi.ContextFlag) (initiator, acceptor *Krb5Mech) {
+	key := mkSampleAESKey()
+	key.KeyValue = append([]byte(nil), key.KeyValue...)
+	key.KeyValue[0] ^= byte(n)
+
+	initiator = &Krb5Mech{isInitiator: true, isEstablished: true, sessionKey: &key, sessionFlags: flags}
+	acceptor = &Krb5Mech{isInitiator: false, isEstablished: true, sessionKey: &key, sessionFlags: flags}
+	return
+}
+
+func TestVerifyBatch(t *testing.T) {
+	const contexts, perContext = 4, 6
+
+	var items []BatchItem
+	var scalar []*Krb5Mech
+	acceptors := make([]*Krb5Mech, contexts)
+	tokens := make([][]BatchItem, contexts)
+
+	for c := 0; c < contexts; c++ {
+		initiator, acceptor := mkBatchPair(c+1, gssapi.ContextFlagSequence)
+		acceptors[c] = acceptor
+		copied := *acceptor
+		scalar = append(scalar, &copied)
+
+		for i := 0; i < perContext; i++ {
+			payload := []byte(fmt.Sprintf("context %d message %d", c, i))
+
+			var tok []byte
+			var err error
+			switch i % 3 {
+			case 0:
+				tok, err = initiator.MakeSignature(payload)
+			case 1:
+				tok, err = initiator.Wrap(payload, false)
+			case 2:
+				tok, err = initiator.Wrap(payload, true)
+			}
+			require.NoError(t, err)
+
+			// a corrupt token, which also puts the next one out of sequence
+			if c == 2 && i == 3 {
+				tok[len(tok)-1] ^= 0xff
+			}
+
+			tokens[c] = append(tokens[c], BatchItem{Context: acceptor, Token: tok, Payload: payload})
+		}
+	}
+
+	// interleave the contexts' tokens, as a server would receive them
+	for i := 0; i < perContext; i++ {
+		for c := 0; c < contexts; c++ {
+			items = append(items, tokens[c][i])
+		}
+	}
+
+	VerifyBatch(items, 3)
+
+	for n, it := range items {
+		c := n % contexts
+		want := BatchItem{}
+		if it.Token[0] == 0x04 {
+			want.Err = scalar[c].VerifySignature(it.Payload, it.Token)
+		} else {
+			want.Message, want.IsSealed, want.Err = scalar[c].Unwrap(it.Token)
+		}
+
+		assert.Equal(t, want.Err, it.Err, "item %d", n)
+		assert.Equal(t, want.Message, it.Message, "item %d", n)
+		assert.Equal(t, want.IsSealed, it.IsSealed, "item %d", n)
+
+		if c == 2 && n/contexts >= 3 {
+			assert.Error(t, it.Err, "item %d should fail", n)
+		} else {
+			assert.NoError(t, it.Err, "item %d", n)
+		}
+	}
+}
+
+func TestVerifyBatchEmpty(t *testing.T) {
+	VerifyBatch(nil, 0)
+
+	items := []BatchItem{{Token: []byte{0x04, 0x04}}, {Context: &Krb5Mech{}, Token: []byte{0x05}}}
+	VerifyBatch(items, 0)
+	assert.Error(t, items[0].Err)
+	assert.Error(t, items[1].Err)
+}
+
+func benchmarkMICs(b *testing.B) []BatchItem {
+	const contexts, perContext = 64, 16
+	payload := []byte(TestWrapPayload)
+
+	var items []BatchItem
+	for c := 0; c < contexts; c++ {
+		initiator, acceptor := mkBatchPair(c+1, 0)
+		for i := 0; i < perContext; i++ {
+			tok, err := initiator.MakeSignature(payload)
+			if err != nil {
+				b.Fatal(err)
+			}
+			items = append(items, BatchItem{Context: acceptor, Token: tok, Payload: payload})
+		}
+	}
+
+	return items
+}
+
+func BenchmarkVerifyMICScalar(b *testing.B) {
+	items := benchmarkMICs(b)
+	b.ResetTimer()
+
+	for n := 0; n < b.N; n++ {
+		for i := range items {
+			if err := items[i].Context.VerifySignature(items[i].Payload, items[i].Token); err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+}
+
+func BenchmarkVerifyMICBatch(b *testing.B) {
+	items := benchmarkMICs(b)
+	b.ResetTimer()
+
+	for n := 0; n < b.N; n++ {
+		VerifyBatch(items, 0)
+		if items[0].Err != nil {
+			b.Fatal(items[0].Err)
+		}
+	}
+}
@@ -0,0 +1,117 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"bytes"
+	"crypto/hmac"
+	"fmt"
+	"hash"
+
+	"github.com/jcmturner/gokrb5/v8/crypto"
+	krbcommon "github.com/jcmturner/gokrb5/v8/crypto/common"
+	"github.com/jcmturner/gokrb5/v8/crypto/etype"
+	"github.com/jcmturner/gokrb5/v8/types"
+)
+
+// checksumVerifier checks the keyed checksum of received MIC and signed
+// Wrap tokens for one key and key usage.
+//
+// For the simplified profile encryption types (RFC 3961 § 5.3, RFC 8009 § 5)
+// the checksum is an HMAC using a key derived from the base key and usage.
+// The derived key, the keyed HMAC state and the scratch buffers are created
+// once, so verifying a token streams payload||header through the HMAC without
+// allocating and compares the result in constant time.  Other encryption types
+// (RC4-HMAC) fall back to the gokrb5 checksum implementation.
+//
+// A checksumVerifier must not be used by more than one goroutine at a time.
+type checksumVerifier struct {
+	keyType  int32
+	keyValue []byte
+	usage    uint32
+	encType  etype.EType
+	mac      hash.Hash
+	cksumLen int
+	hdr      [msgTokenHdrLen]byte
+	sum      []byte
+}
+
+func newChecksumVerifier(key types.EncryptionKey, usage uint32) (v *checksumVerifier, err error) {
+	encType, err := crypto.GetEtype(key.KeyType)
+	if err != nil {
+		return nil, fmt.Errorf("gssapi: %s", err)
+	}
+
+	v = &checksumVerifier{
+		keyType:  key.KeyType,
+		keyValue: key.KeyValue,
+		usage:    usage,
+		encType:  encType,
+		cksumLen: encType.GetHMACBitLength() / 8,
+	}
+
+	if _, isRC4 := encType.(crypto.RC4HMAC); isRC4 {
+		return v, nil
+	}
+
+	kc, err := encType.DeriveKey(key.KeyValue, krbcommon.GetUsageKc(usage))
+	if err != nil {
+		return nil, fmt.Errorf("gssapi: %s", err)
+	}
+
+	v.mac = hmac.New(encType.GetHashFunc(), kc)
+	v.sum = make([]byte, 0, v.mac.Size())
+
+	return v, nil
+}
+
+// matches returns true if the verifier was created for key and usage
+func (v *checksumVerifier) matches(key types.EncryptionKey, usage uint32) bool {
+	return v.keyType == key.KeyType && v.usage == usage && bytes.Equal(v.keyValue, key.KeyValue)
+}
+
+// verify returns true if cksum is the checksum of payload followed by the
+// token header that the caller has written to v.hdr
+func (v *checksumVerifier) verify(payload, cksum []byte) (ok bool, err error) {
+	if v.mac == nil {
+		cksumData := make([]byte, 0, len(payload)+msgTokenHdrLen)
+		cksumData = append(cksumData, payload...)
+		cksumData = append(cksumData, v.hdr[:]...)
+
+		var computed []byte
+		computed, err = v.encType.GetChecksumHash(v.keyValue, cksumData, v.usage)
+		if err != nil {
+			return false, fmt.Errorf("gssapi: %s", err)
+		}
+
+		return hmac.Equal(cksum, computed), nil
+	}
+
+	v.mac.Reset()
+	_, _ = v.mac.Write(payload)
+	_, _ = v.mac.Write(v.hdr[:])
+	v.sum = v.mac.Sum(v.sum[:0])
+
+	return hmac.Equal(cksum, v.sum[:v.cksumLen]), nil
+}
+
+// verifier returns the context's cached checksumVerifier for key and usage,
+// creating it on first use.  A context only ever sees a handful of key and
+// usage combinations so the cache is a short list.
+func (m *Krb5Mech) verifier(key types.EncryptionKey, usage uint32) (*checksumVerifier, error) {
+	for _, v := range m.verifiers {
+		if v.matches(key, usage) {
+			return v, nil
+		}
+	}
+
+	v, err := newChecksumVerifier(key, usage)
+	if err != nil {
+		return nil, err
+	}
+
+	m.verifiers = append(m.verifiers, v)
+	return v, nil
+}
@@ -13,11 +13,11 @@ package krb5
  */
 
 import (
-	"crypto/md5"
+	"crypto/subtle"
 	"encoding/binary"
 	"encoding/hex"
+	"errors"
 	"fmt"
-	"net"
 
 	"github.com/jcmturner/gofork/encoding/asn1"
 	"github.com/jcmturner/gokrb5/v8/asn1tools"
@@ -123,7 +123,7 @@ func (m *kRB5Token) unmarshal(b []byte) error {
 // Create the GSSAPI checksum for the authenticator.  This isn't really
 // a checksum, it is a way to carry GSSAPI level context information in
 // the Kerberos AP-RREQ message. See RFC 4121 § 4.1.1
-func newAuthenticatorChksum(flags gssapi.ContextFlag, cb *common.ChannelBinding) []byte {
+func newAuthenticatorChksum(flags gssapi.ContextFlag, bnd *[16]byte) []byte {
 	// 24 octet minimum length, up to and including context-establishment flags
 	a := make([]byte, 24)
 
@@ -131,8 +131,8 @@ func newAuthenticatorChksum(flags gssapi.ContextFlag, cb *common.ChannelBinding)
 	binary.LittleEndian.PutUint32(a[:4], 16)
 
 	// Octets 4..19: Channel binding info
-	if cb != nil {
-		copy(a[4:20], cbChecksum(cb))
+	if bnd != nil {
+		copy(a[4:20], bnd[:])
 	}
 
 	// Context-establishment flags
@@ -141,89 +141,37 @@ func newAuthenticatorChksum(flags gssapi.ContextFlag, cb *common.ChannelBinding)
 	return a
 }
 
-func cbChecksum(cb *common.ChannelBinding) []byte {
-	bufSz := 5*4 + len(cb.Data) // 5 x 32 bit length fields plus the data
-
-	// .. plus the length of the address types, if not null
-	for _, addr := range []net.Addr{cb.InitiatorAddr, cb.AcceptorAddr} {
-		if addr == nil {
-			continue
-		}
-
-		switch c := addr.(type) {
-		case *net.IPAddr:
-			bufSz += ipLength(c.IP)
-		case *net.TCPAddr:
-			bufSz += ipLength(c.IP)
-		case *net.UDPAddr:
-			bufSz += ipLength(c.IP)
-		case *net.UnixAddr:
-			bufSz += len(c.Name)
-		}
+// channelBindingHash returns the hash of the channel bindings that is
+// carried in the authenticator checksum, or nil without bindings
+func channelBindingHash(cb *common.ChannelBinding) *[16]byte {
+	if cb == nil {
+		return nil
 	}
 
-	buf := make([]byte, 0, bufSz)
-
-	// write the address types and address data
-	for _, addr := range []net.Addr{cb.InitiatorAddr, cb.AcceptorAddr} {
-		addrType := 0
-		addrData := []byte{}
-
-		if addr != nil {
-			switch c := addr.(type) {
-			case *net.IPAddr:
-				addrType = int(common.GssAddrFamilyINET)
-				addrData = ipData(c.IP)
-			case *net.TCPAddr:
-				addrType = int(common.GssAddrFamilyINET)
-				addrData = ipData(c.IP)
-			case *net.UDPAddr:
-				addrType = int(common.GssAddrFamilyINET)
-				addrData = ipData(c.IP)
-			case *net.UnixAddr:
-				addrType = int(common.GssAddrFamilyLOCAL)
-				addrData = []byte(c.Name)
-			}
-		}
-
-		// write little endian 32-bit address type and address size
-		bufTmp := [8]byte{}
-		binary.LittleEndian.PutUint32(bufTmp[:], uint32(addrType))
-		binary.LittleEndian.PutUint32(bufTmp[4:], uint32(len(addrData)))
-		buf = append(buf, bufTmp[:]...)
-
-		// write the address data
-		buf = append(buf, addrData...)
-	}
-
-	// write the data
-	bufTmp := [4]byte{}
-	binary.LittleEndian.PutUint32(bufTmp[:], uint32(len(cb.Data)))
-	buf = append(buf, bufTmp[:]...)
-	buf = append(buf, cb.Data...)
-
-	hashed := md5.Sum(buf)
-	return hashed[:]
+	bnd := cb.Digest()
+	return &bnd
 }
 
-func ipLength(addr net.IP) int {
-	if addr.To4() != nil {
-		return 4
-	}
-	if addr.To16() != nil {
-		return 16
+// Verify the channel binding info in the authenticator checksum received
+// by an Acceptor against the hash of the Acceptor's own bindings.  Like MIT
+// and Heimdal, an all-zero value from the Initiator means that it did not
+// supply bindings, which is accepted.  See RFC 4121 § 4.1.1.2
+func verifyChannelBinding(chksum []byte, bnd *[16]byte) error {
+	if bnd == nil {
+		return nil
 	}
 
-	return 0
-}
+	if len(chksum) < 24 || binary.LittleEndian.Uint32(chksum[:4]) != 16 {
+		return errors.New("gssapi: bad channel binding length in authenticator checksum")
+	}
 
-func ipData(addr net.IP) (ret net.IP) {
-	if ret = addr.To4(); ret != nil {
-		return ret
+	var zero [16]byte
+	if subtle.ConstantTimeCompare(chksum[4:20], zero[:]) == 1 {
+		return nil
 	}
 
-	if ret = addr.To16(); ret != nil {
-		return ret
+	if subtle.ConstantTimeCompare(chksum[4:20], bnd[:]) != 1 {
+		return errors.New("gssapi: channel binding mismatch")
 	}
 
 	return nil
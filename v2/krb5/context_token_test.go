@@ -6,10 +6,14 @@ package krb5
 
 import (
 	"encoding/hex"
+	"net"
 	"testing"
 
 	"github.com/jcmturner/gokrb5/v8/iana/msgtype"
 	"github.com/stretchr/testify/assert"
+
+	"github.com/golang-auth/go-gssapi/v2"
+	"github.com/golang-auth/go-gssapi/v2/common"
 )
 
 const (
@@ -160,3 +164,62 @@ func TestKrb5TokenKrberror_Marshal(t *testing.T) {
 
 	assert.Equal(t, ref, tok)
 }
+
+func TestAuthenticatorChksum(t *testing.T) {
+	t.Parallel()
+
+	flags := gssapi.ContextFlagConf | gssapi.ContextFlagInteg
+	want, _ := hex.DecodeString(AuthChksum)
+	assert.Equal(t, want, newAuthenticatorChksum(flags, nil))
+
+	cb := &common.ChannelBinding{Data: []byte("tls-server-end-point:abc")}
+	bnd := cb.Digest()
+	chksum := newAuthenticatorChksum(flags, channelBindingHash(cb))
+	assert.Equal(t, bnd[:], chksum[4:20])
+	assert.Equal(t, want[20:], chksum[20:])
+}
+
+func TestVerifyChannelBinding(t *testing.T) {
+	t.Parallel()
+
+	flags := gssapi.ContextFlagConf | gssapi.ContextFlagInteg
+	cb := &common.ChannelBinding{
+		InitiatorAddr: &net.TCPAddr{IP: net.ParseIP("192.0.2.1"), Port: 1234},
+		AcceptorAddr:  &net.TCPAddr{IP: net.ParseIP("192.0.2.2"), Port: 4444},
+		Data:          []byte("tls-exporter:0123456789"),
+	}
+	other := &common.ChannelBinding{Data: []byte("tls-exporter:9876543210")}
+	bnd, otherBnd := channelBindingHash(cb), channelBindingHash(other)
+
+	// acceptor without bindings accepts anything
+	assert.NoError(t, verifyChannelBinding(newAuthenticatorChksum(flags, bnd), nil))
+
+	// initiator without bindings is accepted
+	assert.NoError(t, verifyChannelBinding(newAuthenticatorChksum(flags, nil), bnd))
+
+	assert.NoError(t, verifyChannelBinding(newAuthenticatorChksum(flags, bnd), bnd))
+	assert.Error(t, verifyChannelBinding(newAuthenticatorChksum(flags, otherBnd), bnd))
+
+	// bad binding length
+	chksum := newAuthenticatorChksum(flags, bnd)
+	chksum[0] = 15
+	assert.Error(t, verifyChannelBinding(chksum, bnd))
+}
+
+func TestAcceptWithBinding(t *testing.T) {
+	t.Parallel()
+
+	cb := &common.ChannelBinding{Data: []byte("tls-exporter:0123456789")}
+	want := cb.Digest()
+
+	m := &Krb5Mech{}
+	assert.NoError(t, m.AcceptWithBinding("", cb))
+	assert.Equal(t, &want, m.channelBinding)
+
+	// the context keeps the hash it was given, whatever happens to cb
+	cb.Data = []byte("tls-exporter:9876543210")
+	assert.Equal(t, &want, m.channelBinding)
+
+	assert.NoError(t, m.Accept(""))
+	assert.Nil(t, m.channelBinding)
+}
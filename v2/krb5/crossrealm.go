@@ -0,0 +1,373 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"bufio"
+	"fmt"
+	"io"
+	"os"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/jcmturner/gokrb5/v8/client"
+	"github.com/jcmturner/gokrb5/v8/config"
+	"github.com/jcmturner/gokrb5/v8/credentials"
+	"github.com/jcmturner/gokrb5/v8/iana/nametype"
+	"github.com/jcmturner/gokrb5/v8/messages"
+	"github.com/jcmturner/gokrb5/v8/types"
+)
+
+// realmClient is a Kerberos client shared by the initiators that use the
+// same configuration and credentials cache.  Sharing it keeps the service
+// tickets and the ticket-granting tickets (TGTs) for other realms that it
+// collects from one context to the next.  It makes its own TGS requests,
+// for the principal and realm from its spnCache, rather than have gokrb5
+// work them out again from the service name.
+//
+// Getting a ticket for a service in another realm means first getting a TGT
+// for that realm, which may take several TGS exchanges as the KDCs refer the
+// request from realm to realm, or as the client follows the path configured
+// in the [capaths] section of krb5.conf.  The TGT for each realm along the
+// way is kept until it expires, so once they are in hand a new context for a
+// service in another realm costs one TGS exchange, with that realm's KDC.
+// The TGTs for the realms named in [capaths] are fetched in the background
+// when the client is created.  Callers that need the TGT for the same realm
+// at the same time share one fetch; fetches for different realms go ahead
+// independently.
+type realmClient struct {
+	cl      *client.Client
+	realm   string
+	capaths map[string][]string // the intermediate realms to each realm
+	stamp   [2]time.Time        // when the files were modified
+	spns    *spnCache
+
+	// exchange makes a TGS request to the KDC of kdcRealm; see tgs
+	exchange func(spn types.PrincipalName, kdcRealm string, tgt *cachedTicket) (*cachedTicket, error)
+
+	mu      sync.Mutex
+	tgts    map[string]*cachedTicket // TGTs by the realm that accepts them
+	tickets map[string]*cachedTicket // service tickets by principal@realm
+	fetches map[string]*tgtFetch     // TGT fetches in progress, by realm
+}
+
+// tgtFetch is a fetch of the TGT for one realm; done is closed once tgt and
+// err are set
+type tgtFetch struct {
+	done chan struct{}
+	tgt  *cachedTicket
+	err  error
+}
+
+type cachedTicket struct {
+	ticket messages.Ticket
+	key    types.EncryptionKey
+	end    time.Time
+}
+
+type realmClientKey struct {
+	cfgFile string
+	ccFile  string
+}
+
+var (
+	realmClientsMu sync.Mutex
+	realmClients   = make(map[realmClientKey]*realmClient)
+)
+
+// valid reports whether the ticket can still be used; the acceptor will
+// reject it once it has expired by its own clock
+func (t *cachedTicket) valid(now time.Time) bool {
+	return t != nil && now.Add(ClockSkew).Before(t.end)
+}
+
+// sharedKrbClient returns the client for the configuration and credentials
+// cache files, creating a new one if either file has changed since the last
+// one was made, as it will have been if the TGT was renewed
+func sharedKrbClient(cfgFile, ccFile string) (*realmClient, error) {
+	key := realmClientKey{cfgFile, ccFile}
+	stamp := [2]time.Time{modTime(cfgFile), modTime(ccFile)}
+
+	realmClientsMu.Lock()
+	defer realmClientsMu.Unlock()
+
+	if rc, ok := realmClients[key]; ok && rc.stamp == stamp {
+		return rc, nil
+	}
+
+	rc, err := newRealmClient(cfgFile, ccFile)
+	if err != nil {
+		return nil, err
+	}
+	rc.stamp = stamp
+	realmClients[key] = rc
+
+	go rc.preload()
+
+	return rc, nil
+}
+
+func modTime(file string) time.Time {
+	fi, err := os.Stat(file)
+	if err != nil {
+		return time.Time{}
+	}
+	return fi.ModTime()
+}
+
+// newRealmClient creates a Kerberos client from the configuration and
+// credentials cache files
+func newRealmClient(cfgFile, ccFile string) (*realmClient, error) {
+	cfg, err := config.Load(cfgFile)
+	if err != nil {
+		return nil, fmt.Errorf("gssapi: loading krb5.conf: %w", err)
+	}
+
+	ccache, err := credentials.LoadCCache(ccFile)
+	if err != nil {
+		return nil, fmt.Errorf("gssapi: loading credentials cache: %w", err)
+	}
+
+	cl, err := client.NewFromCCache(ccache, cfg)
+	if err != nil {
+		return nil, fmt.Errorf("gssapi: creating krb5 client: %w", err)
+	}
+
+	if err := cl.AffirmLogin(); err != nil {
+		return nil, fmt.Errorf("gssapi: checking TGT: %s", err)
+	}
+
+	rc := &realmClient{
+		cl:      cl,
+		realm:   cl.Credentials.Domain(),
+		tgts:    make(map[string]*cachedTicket),
+		tickets: make(map[string]*cachedTicket),
+		fetches: make(map[string]*tgtFetch),
+		spns:    newSPNCache(cfg.ResolveRealm),
+	}
+	rc.exchange = rc.tgsExchange
+
+	// config.Load does not keep the [capaths] section
+	if f, err := os.Open(cfgFile); err == nil {
+		rc.capaths = parseCAPaths(f)[rc.realm]
+		f.Close()
+	}
+
+	// the TGT for our own realm comes from the credentials cache
+	if cred, ok := ccache.GetEntry(krbtgtName(rc.realm)); ok {
+		t := &cachedTicket{key: cred.Key, end: cred.EndTime}
+		if err := t.ticket.Unmarshal(cred.Ticket); err == nil {
+			rc.tgts[rc.realm] = t
+		}
+	}
+
+	return rc, nil
+}
+
+func krbtgtName(realm string) types.PrincipalName {
+	return types.PrincipalName{NameType: nametype.KRB_NT_SRV_INST, NameString: []string{"krbtgt", realm}}
+}
+
+// serviceTicket returns a ticket for the service, from the cache if there
+// is a current one there
+func (rc *realmClient) serviceTicket(service string) (tkt messages.Ticket, key types.EncryptionKey, err error) {
+	c := rc.spns.canonicalize(service)
+
+	id := c.name + "@" + c.realm
+	rc.mu.Lock()
+	t := rc.tickets[id]
+	rc.mu.Unlock()
+
+	if !t.valid(time.Now()) {
+		var tgt *cachedTicket
+		if tgt, err = rc.realmTGT(c.realm); err != nil {
+			return
+		}
+		if t, err = rc.tgs(c.spn, c.realm, tgt); err != nil {
+			return
+		}
+
+		rc.mu.Lock()
+		if len(rc.tickets) >= maxCachedSPNs {
+			rc.tickets = make(map[string]*cachedTicket)
+		}
+		rc.tickets[id] = t
+		rc.mu.Unlock()
+	}
+
+	return t.ticket, t.key, nil
+}
+
+// path returns the realms that we get TGTs for on the way to realm, ending
+// with realm itself.  Without a [capaths] entry, we ask our own KDC for the
+// TGT and let it refer us along the way.
+func (rc *realmClient) path(realm string) []string {
+	if realm == rc.realm {
+		return nil
+	}
+
+	var path []string
+	for _, r := range rc.capaths[realm] {
+		if r != "." && r != realm {
+			path = append(path, r)
+		}
+	}
+
+	return append(path, realm)
+}
+
+// realmTGT returns a TGT for realm, from the cache if there is a current
+// one there, or else by joining the fetch for realm that is in progress or
+// starting a new one
+func (rc *realmClient) realmTGT(realm string) (*cachedTicket, error) {
+	rc.mu.Lock()
+	if tgt := rc.tgts[realm]; tgt.valid(time.Now()) {
+		rc.mu.Unlock()
+		return tgt, nil
+	}
+	if f, ok := rc.fetches[realm]; ok {
+		rc.mu.Unlock()
+		<-f.done
+		return f.tgt, f.err
+	}
+	f := &tgtFetch{done: make(chan struct{})}
+	rc.fetches[realm] = f
+	rc.mu.Unlock()
+
+	f.tgt, f.err = rc.fetchTGT(realm)
+
+	rc.mu.Lock()
+	delete(rc.fetches, realm)
+	rc.mu.Unlock()
+	close(f.done)
+
+	return f.tgt, f.err
+}
+
+// fetchTGT gets a TGT for realm from the KDCs, starting from the furthest
+// realm along the path for which we still hold one
+func (rc *realmClient) fetchTGT(realm string) (*cachedTicket, error) {
+	hops := append([]string{rc.realm}, rc.path(realm)...)
+
+	now := time.Now()
+	var tgt *cachedTicket
+	i := len(hops) - 1
+
+	rc.mu.Lock()
+	for ; i >= 0; i-- {
+		if t := rc.tgts[hops[i]]; t.valid(now) {
+			tgt = t
+			break
+		}
+	}
+	rc.mu.Unlock()
+
+	if tgt == nil {
+		return nil, fmt.Errorf("gssapi: TGT for %s has expired", rc.realm)
+	}
+
+	for ; i < len(hops)-1; i++ {
+		t, err := rc.tgs(krbtgtName(hops[i+1]), hops[i], tgt)
+		if err != nil {
+			return nil, fmt.Errorf("gssapi: getting TGT for %s from %s: %w", hops[i+1], hops[i], err)
+		}
+
+		rc.mu.Lock()
+		rc.tgts[hops[i+1]] = t
+		rc.mu.Unlock()
+
+		tgt = t
+	}
+
+	return tgt, nil
+}
+
+// preload fetches TGTs for the realms in our [capaths] entry
+func (rc *realmClient) preload() {
+	for realm := range rc.capaths {
+		_, _ = rc.realmTGT(realm)
+	}
+}
+
+// tgs makes a TGS request, subject to the limits on requests to kdcRealm;
+// see KDCMaxConcurrent and KDCRate.  Only requests that go to the KDC are
+// limited, never tickets that come from the cache.
+func (rc *realmClient) tgs(spn types.PrincipalName, kdcRealm string, tgt *cachedTicket) (t *cachedTicket, err error) {
+	err = kdcRequest(kdcRealm, func() (err error) {
+		t, err = rc.exchange(spn, kdcRealm, tgt)
+		return
+	})
+
+	return
+}
+
+func (rc *realmClient) tgsExchange(spn types.PrincipalName, kdcRealm string, tgt *cachedTicket) (*cachedTicket, error) {
+	_, rep, err := rc.cl.TGSREQGenerateAndExchange(spn, kdcRealm, tgt.ticket, tgt.key, false)
+	if err != nil {
+		return nil, err
+	}
+
+	return &cachedTicket{ticket: rep.Ticket, key: rep.DecryptedEncPart.Key, end: rep.DecryptedEncPart.EndTime}, nil
+}
+
+// parseCAPaths reads the [capaths] section of a krb5.conf file, returning
+// the intermediate realms for each pair of client and server realms.  An
+// entry may list several realms on one line, or on several lines with the
+// same tag; a "." means that the realms share a key directly.
+//
+//	[capaths]
+//	    ANL.GOV = {
+//	        TEST.ANL.GOV = .
+//	        PNL.GOV = ES.NET
+//	    }
+func parseCAPaths(r io.Reader) map[string]map[string][]string {
+	capaths := make(map[string]map[string][]string)
+
+	var inSection bool
+	var client string
+	sc := bufio.NewScanner(r)
+	for sc.Scan() {
+		line := strings.TrimSpace(sc.Text())
+		if line == "" || line[0] == '#' || line[0] == ';' {
+			continue
+		}
+
+		if strings.HasPrefix(line, "[") {
+			inSection = line == "[capaths]"
+			client = ""
+			continue
+		}
+		if !inSection {
+			continue
+		}
+
+		if line == "}" {
+			client = ""
+			continue
+		}
+
+		eq := strings.Index(line, "=")
+		if eq < 0 {
+			continue
+		}
+		tag := strings.TrimSpace(line[:eq])
+		value := strings.TrimSpace(line[eq+1:])
+
+		if client == "" {
+			if value == "{" {
+				client = tag
+				if capaths[client] == nil {
+					capaths[client] = make(map[string][]string)
+				}
+			}
+			continue
+		}
+
+		capaths[client][tag] = append(capaths[client][tag], strings.Fields(value)...)
+	}
+
+	return capaths
+}
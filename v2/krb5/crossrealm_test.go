@@ -0,0 +1,290 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"errors"
+	"strings"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/jcmturner/gokrb5/v8/messages"
+	"github.com/jcmturner/gokrb5/v8/types"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+const testCAPaths = `
+[libdefaults]
+    default_realm = ANL.GOV
+
+[capaths]
+    ANL.GOV = {
+        TEST.ANL.GOV = .
+        PNL.GOV = ES.NET
+        NERSC.GOV = ES.NET
+        DIST.GOV = ES.NET
+        DIST.GOV = PNL.GOV
+        ES.NET = .
+    }
+    # comment
+    TEST.ANL.GOV = {
+        ANL.GOV = .
+    }
+
+[domain_realm]
+    .anl.gov = ANL.GOV
+`
+
+func TestParseCAPaths(t *testing.T) {
+	capaths := parseCAPaths(strings.NewReader(testCAPaths))
+
+	assert.Equal(t, map[string]map[string][]string{
+		"ANL.GOV": {
+			"TEST.ANL.GOV": {"."},
+			"PNL.GOV":      {"ES.NET"},
+			"NERSC.GOV":    {"ES.NET"},
+			"DIST.GOV":     {"ES.NET", "PNL.GOV"},
+			"ES.NET":       {"."},
+		},
+		"TEST.ANL.GOV": {
+			"ANL.GOV": {"."},
+		},
+	}, capaths)
+}
+
+// fakeTGS records the exchanges made and issues tickets valid for lifetime.
+// If before is set it is called with each request first, as the network
+// round trip would be.
+type fakeTGS struct {
+	mu       sync.Mutex
+	lifetime time.Duration
+	calls    []string
+	before   func(req string)
+}
+
+func (f *fakeTGS) exchange(spn types.PrincipalName, kdcRealm string, tgt *cachedTicket) (*cachedTicket, error) {
+	req := strings.Join(spn.NameString, "/") + "@" + kdcRealm
+	if f.before != nil {
+		f.before(req)
+	}
+
+	f.mu.Lock()
+	defer f.mu.Unlock()
+
+	f.calls = append(f.calls, req)
+	return &cachedTicket{
+		ticket: messages.Ticket{Realm: kdcRealm, SName: spn},
+		end:    time.Now().Add(f.lifetime),
+	}, nil
+}
+
+func (f *fakeTGS) made() []string {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+
+	calls := f.calls
+	f.calls = nil
+	return calls
+}
+
+func newTestRealmClient(tgs *fakeTGS) *realmClient {
+	rc := &realmClient{
+		realm:   "ANL.GOV",
+		capaths: parseCAPaths(strings.NewReader(testCAPaths))["ANL.GOV"],
+		tgts: map[string]*cachedTicket{
+			"ANL.GOV": {end: time.Now().Add(time.Hour)},
+		},
+		tickets:  make(map[string]*cachedTicket),
+		fetches:  make(map[string]*tgtFetch),
+		exchange: tgs.exchange,
+		spns: newSPNCache(func(host string) string {
+			if strings.HasSuffix(host, ".anl.gov") {
+				return "ANL.GOV"
+			}
+			return "OTHER.ORG"
+		}),
+	}
+
+	return rc
+}
+
+func TestRealmTGT(t *testing.T) {
+	tgs := &fakeTGS{lifetime: time.Hour}
+	rc := newTestRealmClient(tgs)
+
+	// along the configured path, keeping the TGT for each realm
+	tgt, err := rc.realmTGT("DIST.GOV")
+	require.NoError(t, err)
+	assert.Equal(t, "DIST.GOV", tgt.ticket.SName.NameString[1])
+	assert.Equal(t, []string{"krbtgt/ES.NET@ANL.GOV", "krbtgt/PNL.GOV@ES.NET", "krbtgt/DIST.GOV@PNL.GOV"}, tgs.made())
+
+	// then from the cache
+	_, err = rc.realmTGT("DIST.GOV")
+	require.NoError(t, err)
+	assert.Empty(t, tgs.made())
+
+	// starting from the furthest realm along the way
+	_, err = rc.realmTGT("NERSC.GOV")
+	require.NoError(t, err)
+	assert.Equal(t, []string{"krbtgt/NERSC.GOV@ES.NET"}, tgs.made())
+
+	// and straight from our own KDC without a path
+	_, err = rc.realmTGT("OTHER.ORG")
+	require.NoError(t, err)
+	assert.Equal(t, []string{"krbtgt/OTHER.ORG@ANL.GOV"}, tgs.made())
+}
+
+func TestRealmTGTConcurrent(t *testing.T) {
+	entered := make(chan struct{}, 1)
+	release := make(chan struct{})
+	tgs := &fakeTGS{lifetime: time.Hour}
+	tgs.before = func(req string) {
+		if req == "krbtgt/OTHER.ORG@ANL.GOV" {
+			select {
+			case entered <- struct{}{}:
+			default:
+			}
+			<-release
+		}
+	}
+	rc := newTestRealmClient(tgs)
+
+	// two callers for a realm whose KDC exchange is held up
+	var wg sync.WaitGroup
+	tgts := make([]*cachedTicket, 2)
+	errs := make([]error, 2)
+	for i := range tgts {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			tgts[i], errs[i] = rc.realmTGT("OTHER.ORG")
+		}(i)
+		if i == 0 {
+			<-entered
+		}
+	}
+
+	// do not hold up a fetch for another realm
+	_, err := rc.realmTGT("TEST.ANL.GOV")
+	require.NoError(t, err)
+	assert.Equal(t, []string{"krbtgt/TEST.ANL.GOV@ANL.GOV"}, tgs.made())
+
+	// and share the one exchange
+	close(release)
+	wg.Wait()
+	require.NoError(t, errs[0])
+	require.NoError(t, errs[1])
+	assert.Equal(t, tgts[0], tgts[1])
+	assert.Equal(t, []string{"krbtgt/OTHER.ORG@ANL.GOV"}, tgs.made())
+	assert.Empty(t, rc.fetches)
+}
+
+func TestRealmTGTExpiry(t *testing.T) {
+	// tickets that are already within ClockSkew of expiring
+	tgs := &fakeTGS{lifetime: ClockSkew / 2}
+	rc := newTestRealmClient(tgs)
+
+	_, err := rc.realmTGT("PNL.GOV")
+	require.NoError(t, err)
+	assert.Len(t, tgs.made(), 2)
+
+	_, err = rc.realmTGT("PNL.GOV")
+	require.NoError(t, err)
+	assert.Len(t, tgs.made(), 2)
+
+	// nothing can be fetched once our own TGT has expired
+	rc.tgts["ANL.GOV"].end = time.Now()
+	_, err = rc.realmTGT("PNL.GOV")
+	assert.EqualError(t, err, "gssapi: TGT for ANL.GOV has expired")
+}
+
+func TestServiceTicket(t *testing.T) {
+	tgs := &fakeTGS{lifetime: time.Hour}
+	rc := newTestRealmClient(tgs)
+
+	// in our own realm, with the TGT from the credentials cache
+	_, _, err := rc.serviceTicket("host/www.anl.gov")
+	require.NoError(t, err)
+	assert.Equal(t, []string{"host/www.anl.gov@ANL.GOV"}, tgs.made())
+
+	// an explicit realm wins over domain_realm
+	tkt, _, err := rc.serviceTicket("host/db.other.org@ANL.GOV")
+	require.NoError(t, err)
+	assert.Equal(t, "ANL.GOV", tkt.Realm)
+	assert.Equal(t, []string{"host/db.other.org@ANL.GOV"}, tgs.made())
+
+	// and without one the host's realm is used, by way of its TGT
+	tkt, _, err = rc.serviceTicket("host@db.other.org")
+	require.NoError(t, err)
+	assert.Equal(t, "OTHER.ORG", tkt.Realm)
+	assert.Equal(t, []string{"krbtgt/OTHER.ORG@ANL.GOV", "host/db.other.org@OTHER.ORG"}, tgs.made())
+
+	// then all three come from the cache
+	for _, service := range []string{"host/www.anl.gov", "host/db.other.org@ANL.GOV", "host/db.other.org"} {
+		_, _, err = rc.serviceTicket(service)
+		require.NoError(t, err)
+	}
+	assert.Empty(t, tgs.made())
+}
+
+func TestServiceTicketLimits(t *testing.T) {
+	defer setupKDCLimits(1, 0, 1, time.Millisecond*50)()
+
+	tgs := &fakeTGS{lifetime: time.Hour}
+	rc := newTestRealmClient(tgs)
+
+	_, _, err := rc.serviceTicket("host/www.anl.gov")
+	require.NoError(t, err)
+	_, _, err = rc.serviceTicket("host/db.other.org")
+	require.NoError(t, err)
+	assert.Len(t, tgs.made(), 3)
+
+	// with a request holding the only slot, cached tickets still come
+	// straight back, and nothing is counted against either realm
+	held := make(chan struct{})
+	release := make(chan struct{})
+	defer close(release)
+	go func() {
+		_ = kdcRequest("ANL.GOV", func() error {
+			close(held)
+			<-release
+			return nil
+		})
+	}()
+	<-held
+
+	for _, service := range []string{"host/www.anl.gov", "host/db.other.org"} {
+		_, _, err = rc.serviceTicket(service)
+		require.NoError(t, err)
+	}
+
+	stats := KDCGovernorStats()
+	assert.Equal(t, uint64(3), stats["ANL.GOV"].Requests)
+	assert.Equal(t, uint64(1), stats["OTHER.ORG"].Requests)
+	assert.Equal(t, uint64(0), stats["ANL.GOV"].Rejected)
+
+	// a request that needs the KDC waits its turn
+	_, _, err = rc.serviceTicket("host/ftp.anl.gov")
+	assert.True(t, errors.Is(err, ErrKDCBusy))
+}
+
+func TestRealmPreload(t *testing.T) {
+	tgs := &fakeTGS{lifetime: time.Hour}
+	rc := newTestRealmClient(tgs)
+
+	rc.preload()
+	assert.Len(t, tgs.made(), 5)
+
+	for _, realm := range []string{"TEST.ANL.GOV", "ES.NET", "PNL.GOV", "NERSC.GOV", "DIST.GOV"} {
+		assert.NotNil(t, rc.tgts[realm], realm)
+	}
+
+	// everything is in hand
+	_, err := rc.realmTGT("DIST.GOV")
+	require.NoError(t, err)
+	assert.Empty(t, tgs.made())
+}
@@ -0,0 +1,244 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"errors"
+	"sync"
+	"time"
+)
+
+// KDCMaxConcurrent caps the number of service ticket requests that may be
+// outstanding at once to each realm's KDCs.  Zero, the default, means no
+// limit.
+var KDCMaxConcurrent = 0
+
+// KDCRate limits the rate of service ticket requests to each realm, in
+// requests per second, with bursts of up to KDCBurst requests.  Zero, the
+// default, means no limit.
+var KDCRate float64 = 0
+
+// KDCBurst is the number of requests that may be made at once, ahead of
+// KDCRate.  It is treated as one if it is less than one.
+var KDCBurst = 1
+
+// KDCQueueTimeout is how long a request waits for its turn under
+// KDCMaxConcurrent and KDCRate before Initiate gives up with ErrKDCBusy.
+//
+// The limits protect the KDCs from bursts of new contexts, for example
+// when a freshly started process opens connections from thousands of
+// goroutines: requests beyond the limits queue in order and are spread out
+// rather than all reaching the KDC at once, and then timing out and being
+// retried.  Each realm's limits are read from these variables the first
+// time the realm is used; changes apply to realms first used afterwards.
+var KDCQueueTimeout = time.Second * 30
+
+// ErrKDCBusy is returned by Initiate when a service ticket request waited
+// KDCQueueTimeout without being allowed to contact the KDC
+var ErrKDCBusy = errors.New("gssapi: timed out waiting to contact the KDC")
+
+// KDCStats is a snapshot of the service ticket requests to one realm
+type KDCStats struct {
+	// Requests counts the requests allowed to contact the KDC
+	Requests uint64
+	// Rejected counts the requests that gave up waiting
+	Rejected uint64
+	// InFlight is the number of requests contacting the KDC now
+	InFlight int
+	// Waiting is the number of requests queued now
+	Waiting int
+	// WaitTime is the total time that requests have spent queued
+	WaitTime time.Duration
+}
+
+type kdcGovernor struct {
+	maxConcurrent int
+	rate          float64
+	burst         float64
+
+	mu      sync.Mutex
+	tokens  float64
+	refill  time.Time
+	waiters []chan struct{} // first come, first served
+	stats   KDCStats
+}
+
+var (
+	kdcGovernorsMu sync.Mutex
+	kdcGovernors   = make(map[string]*kdcGovernor)
+)
+
+// KDCGovernorStats returns the statistics for each realm that has been
+// contacted for a service ticket
+func KDCGovernorStats() map[string]KDCStats {
+	kdcGovernorsMu.Lock()
+	defer kdcGovernorsMu.Unlock()
+
+	stats := make(map[string]KDCStats, len(kdcGovernors))
+	for realm, g := range kdcGovernors {
+		g.mu.Lock()
+		stats[realm] = g.stats
+		g.mu.Unlock()
+	}
+
+	return stats
+}
+
+// kdcRequest runs req, which contacts the KDCs of realm, once the realm's
+// limits allow
+func kdcRequest(realm string, req func() error) error {
+	g := realmGovernor(realm)
+	if err := g.acquire(KDCQueueTimeout); err != nil {
+		return err
+	}
+	defer g.release()
+
+	return req()
+}
+
+func realmGovernor(realm string) *kdcGovernor {
+	kdcGovernorsMu.Lock()
+	defer kdcGovernorsMu.Unlock()
+
+	g, ok := kdcGovernors[realm]
+	if !ok {
+		burst := float64(KDCBurst)
+		if burst < 1 {
+			burst = 1
+		}
+		g = &kdcGovernor{
+			maxConcurrent: KDCMaxConcurrent,
+			rate:          KDCRate,
+			burst:         burst,
+			tokens:        burst,
+			refill:        time.Now(),
+		}
+		kdcGovernors[realm] = g
+	}
+
+	return g
+}
+
+// acquire waits until the request at the head of the queue is allowed to
+// contact the KDC, for up to timeout.  It returns ErrKDCBusy if it gave up.
+func (g *kdcGovernor) acquire(timeout time.Duration) error {
+	start := time.Now()
+	deadline := time.NewTimer(timeout)
+	defer deadline.Stop()
+
+	g.mu.Lock()
+	defer g.mu.Unlock()
+
+	var me chan struct{}
+	for {
+		now := time.Now()
+		wait := g.ready(now)
+		if wait == 0 && (len(g.waiters) == 0 || g.waiters[0] == me) {
+			if me != nil {
+				g.dequeue(me)
+				g.stats.WaitTime += now.Sub(start)
+			}
+			g.stats.Requests++
+			g.stats.InFlight++
+			if g.rate > 0 {
+				g.tokens--
+			}
+			g.wakeNext()
+			return nil
+		}
+
+		if me == nil {
+			me = make(chan struct{}, 1)
+			g.waiters = append(g.waiters, me)
+			g.stats.Waiting++
+		}
+
+		// only the head of the queue needs to watch the rate
+		var refill *time.Timer
+		var refillC <-chan time.Time
+		if wait > 0 && g.waiters[0] == me {
+			refill = time.NewTimer(wait)
+			refillC = refill.C
+		}
+
+		g.mu.Unlock()
+		var timedOut bool
+		select {
+		case <-me:
+		case <-refillC:
+		case <-deadline.C:
+			timedOut = true
+		}
+		if refill != nil {
+			refill.Stop()
+		}
+		g.mu.Lock()
+
+		if timedOut {
+			g.dequeue(me)
+			g.stats.Rejected++
+			g.stats.WaitTime += time.Since(start)
+			g.wakeNext()
+			return ErrKDCBusy
+		}
+	}
+}
+
+func (g *kdcGovernor) release() {
+	g.mu.Lock()
+	g.stats.InFlight--
+	g.wakeNext()
+	g.mu.Unlock()
+}
+
+// ready returns zero if a request may contact the KDC now, or else how long
+// until the rate allows one; g.mu must be held
+func (g *kdcGovernor) ready(now time.Time) time.Duration {
+	if g.maxConcurrent > 0 && g.stats.InFlight >= g.maxConcurrent {
+		// a release will wake the queue
+		return -1
+	}
+
+	if g.rate <= 0 {
+		return 0
+	}
+
+	g.tokens += now.Sub(g.refill).Seconds() * g.rate
+	if g.tokens > g.burst {
+		g.tokens = g.burst
+	}
+	g.refill = now
+
+	if g.tokens >= 1 {
+		return 0
+	}
+	if d := time.Duration((1 - g.tokens) / g.rate * float64(time.Second)); d > 0 {
+		return d
+	}
+	return 1
+}
+
+// dequeue removes a waiter from the queue; g.mu must be held
+func (g *kdcGovernor) dequeue(me chan struct{}) {
+	for i, c := range g.waiters {
+		if c == me {
+			copy(g.waiters[i:], g.waiters[i+1:])
+			g.waiters[len(g.waiters)-1] = nil
+			g.waiters = g.waiters[:len(g.waiters)-1]
+			g.stats.Waiting--
+			return
+		}
+	}
+}
+
+// wakeNext tells the head of the queue to check again; g.mu must be held
+func (g *kdcGovernor) wakeNext() {
+	if len(g.waiters) > 0 {
+		select {
+		case g.waiters[0] <- struct{}{}:
+		default:
+		}
+	}
+}
@@ -0,0 +1,126 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+)
+
+// setupKDCLimits forgets the realms used so far and sets the limits for
+// those used from now on, returning a function to restore the defaults
+func setupKDCLimits(maxConcurrent int, rate float64, burst int, timeout time.Duration) (restore func()) {
+	kdcGovernorsMu.Lock()
+	kdcGovernors = make(map[string]*kdcGovernor)
+	kdcGovernorsMu.Unlock()
+
+	oldMax, oldRate, oldBurst, oldTimeout := KDCMaxConcurrent, KDCRate, KDCBurst, KDCQueueTimeout
+	KDCMaxConcurrent, KDCRate, KDCBurst, KDCQueueTimeout = maxConcurrent, rate, burst, timeout
+
+	return func() {
+		KDCMaxConcurrent, KDCRate, KDCBurst, KDCQueueTimeout = oldMax, oldRate, oldBurst, oldTimeout
+	}
+}
+
+func TestKDCMaxConcurrent(t *testing.T) {
+	defer setupKDCLimits(2, 0, 1, time.Second*10)()
+
+	var inFlight, most int32
+	var wg sync.WaitGroup
+	for i := 0; i < 10; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			err := kdcRequest("CONCURRENT.TEST", func() error {
+				n := atomic.AddInt32(&inFlight, 1)
+				for {
+					m := atomic.LoadInt32(&most)
+					if n <= m || atomic.CompareAndSwapInt32(&most, m, n) {
+						break
+					}
+				}
+				time.Sleep(time.Millisecond * 10)
+				atomic.AddInt32(&inFlight, -1)
+				return nil
+			})
+			assert.NoError(t, err)
+		}()
+	}
+	wg.Wait()
+
+	assert.Equal(t, int32(2), most)
+
+	st := KDCGovernorStats()["CONCURRENT.TEST"]
+	assert.Equal(t, uint64(10), st.Requests)
+	assert.Equal(t, uint64(0), st.Rejected)
+	assert.Equal(t, 0, st.InFlight)
+	assert.Equal(t, 0, st.Waiting)
+	assert.NotZero(t, st.WaitTime)
+}
+
+func TestKDCRate(t *testing.T) {
+	defer setupKDCLimits(0, 100, 2, time.Second*10)()
+
+	// a burst of two, then one every 10ms, in the order they arrived
+	var order []int
+	var mu sync.Mutex
+	var wg sync.WaitGroup
+	start := time.Now()
+	for i := 0; i < 7; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			err := kdcRequest("RATE.TEST", func() error {
+				mu.Lock()
+				order = append(order, i)
+				mu.Unlock()
+				return nil
+			})
+			assert.NoError(t, err)
+		}(i)
+		time.Sleep(time.Millisecond)
+	}
+	wg.Wait()
+
+	assert.True(t, time.Since(start) >= time.Millisecond*45)
+	assert.Equal(t, []int{0, 1, 2, 3, 4, 5, 6}, order)
+	assert.Equal(t, uint64(7), KDCGovernorStats()["RATE.TEST"].Requests)
+}
+
+func TestKDCBusy(t *testing.T) {
+	defer setupKDCLimits(1, 0, 1, time.Millisecond*50)()
+
+	held := make(chan struct{})
+	release := make(chan struct{})
+	go func() {
+		_ = kdcRequest("BUSY.TEST", func() error {
+			close(held)
+			<-release
+			return nil
+		})
+	}()
+	<-held
+
+	called := false
+	err := kdcRequest("BUSY.TEST", func() error {
+		called = true
+		return nil
+	})
+	assert.Equal(t, ErrKDCBusy, err)
+	assert.False(t, called)
+
+	st := KDCGovernorStats()["BUSY.TEST"]
+	assert.Equal(t, uint64(1), st.Rejected)
+	assert.Equal(t, 1, st.InFlight)
+	assert.Equal(t, 0, st.Waiting)
+
+	// the queue moves on once the request in flight is done
+	close(release)
+	assert.NoError(t, kdcRequest("BUSY.TEST", func() error { return nil }))
+}
@@ -126,7 +126,7 @@ type Krb5Mech struct {
 	isEstablished       bool
 	waitingForMutual    bool
 	service             string
-	channelBinding      *common.ChannelBinding
+	channelBinding      *[16]byte // hash of the channel bindings, or nil
 	ticket              *messages.Ticket
 	sessionKey          *types.EncryptionKey
 	clientCTime         time.Time
@@ -138,6 +138,8 @@ type Krb5Mech struct {
 	initiatorSubKey     *types.EncryptionKey
 	acceptorSubKey      *types.EncryptionKey
 	peerName            string
+	verifiers           []*checksumVerifier
+	pooledAPReq         *pooledAPReq
 }
 
 // NewMech returns a new Kerberos V mechanism context.  This function is
@@ -238,10 +240,21 @@ func (m Krb5Mech) WrapSizeLimit(requestedOutputSize uint32, confidentiality bool
 //
 // See: RFC 4121 § 4.1
 func (m *Krb5Mech) Accept(serviceName string) (err error) {
+	return m.AcceptWithBinding(serviceName, nil)
+}
+
+// AcceptWithBinding is Accept for an Acceptor that verifies the channel
+// binding used by the Initiator.
+//
+// cb is the channel binding data, or nil to disable verification.  Its
+// hash is calculated here, so cb may be changed or reused once
+// AcceptWithBinding returns.
+func (m *Krb5Mech) AcceptWithBinding(serviceName string, cb *common.ChannelBinding) (err error) {
 	m.isEstablished = false
 	m.waitingForMutual = false
 	m.isInitiator = false
 	m.service = serviceName
+	m.channelBinding = channelBindingHash(cb)
 
 	// Stash the subset of the request flags that we can support, except mutual
 	// which we won't know about until we receive a token
@@ -272,12 +285,8 @@ func (m *Krb5Mech) Initiate(serviceName string, requestFlags gssapi.ContextFlag,
 	m.isEstablished = false
 	m.waitingForMutual = false
 	m.isInitiator = true
-	m.channelBinding = cb
-
-	// Obtain a Kerberos ticket for the service
-	if err = m.krbClientInit(serviceName); err != nil {
-		return
-	}
+	m.channelBinding = channelBindingHash(cb)
+	m.pooledAPReq = nil
 
 	// Stash the subset of the request flags that we can support minus mutual until that completes
 	m.sessionFlags = gssapi.ContextFlagConf | gssapi.ContextFlagInteg |
@@ -289,7 +298,18 @@ func (m *Krb5Mech) Initiate(serviceName string, requestFlags gssapi.ContextFlag,
 	m.requestFlags = requestFlags & (gssapi.ContextFlagConf | gssapi.ContextFlagInteg |
 		gssapi.ContextFlagMutual | gssapi.ContextFlagReplay | gssapi.ContextFlagSequence)
 
-	return
+	// A pooled AP-REQ carries its own ticket, see APReqPoolSize
+	if APReqPoolSize > 0 && cb == nil {
+		if e := takePooledAPReq(serviceName, m.requestFlags); e != nil {
+			m.ticket, m.sessionKey, m.service = &e.ticket, &e.sessionKey, serviceName
+			m.peerName = e.peerName
+			m.pooledAPReq = e
+			return
+		}
+	}
+
+	// Obtain a Kerberos ticket for the service
+	return m.krbClientInit(serviceName)
 }
 
 // Continue is called in a loop by Initiators and Acceptors after
@@ -316,25 +336,23 @@ func (m *Krb5Mech) continueInitiator(tokenIn []byte) (tokenOut []byte, err error
 	// first time, create the first context-establishment token
 	//
 	if len(tokenIn) == 0 {
-		// Create a Kerberos AP-REQ message with GSSAPI checksum
-		var apreq messages.APReq
-		apreq, err = m.getAPReqMessage()
-		if err != nil {
-			return
-		}
-
-		// Create the GSSAPI token
-		tb, _ := hex.DecodeString(tokenIDKrbAPReq)
-		gssToken := kRB5Token{
-			oID:   oID(),
-			tokID: tb,
-			aPReq: &apreq,
-		}
+		if e := m.pooledAPReq; e != nil {
+			// built in advance, and only ever used once
+			m.pooledAPReq = nil
+			tokenOut = e.token
+			m.ourSequenceNumber = e.seqNum
+			m.clientCTime, m.clientCusec = e.cTime, e.cusec
+		} else {
+			// Create a Kerberos AP-REQ message with GSSAPI checksum
+			var apreq messages.APReq
+			apreq, err = m.getAPReqMessage()
+			if err != nil {
+				return
+			}
 
-		tokenOut, err = gssToken.marshal()
-		if err != nil {
-			err = fmt.Errorf("gssapi: %s", err)
-			return
+			if tokenOut, err = marshalAPReqToken(&apreq); err != nil {
+				return
+			}
 		}
 
 		// we need another round if we're doing mutual auth - we will receive an AP-REP from the server
@@ -444,6 +462,12 @@ func (m *Krb5Mech) continueAcceptor(tokenIn []byte) (tokenOut []byte, err error)
 		return
 	}
 
+	// check the initiator used the same channel bindings as us
+	if err = verifyChannelBinding(gssInToken.aPReq.Authenticator.Cksum.Checksum, m.channelBinding); err != nil {
+		tokenOut, _ = mkGssErrKrbCode(ianaerrcode.KRB_AP_ERR_BADMATCH, "channel binding mismatch")
+		return
+	}
+
 	// stash the sequence number for use in GSS Wrap
 	// Authenticator.SeqNumber is actually a 32 bit number (in the protocol), so the cast here is safe
 	m.theirSequenceNumber = uint64(gssInToken.aPReq.Authenticator.SeqNumber)
@@ -556,8 +580,16 @@ func (m *Krb5Mech) Unwrap(tokenIn []byte) (tokenOut []byte, isSealed bool, err e
 		key = *m.sessionKey
 	}
 
+	// signed tokens are checked with the context's cached verifier
+	var v *checksumVerifier
+	if wt.Flags&gSSMessageTokenFlagSealed == 0 {
+		if v, err = m.verifier(key, wt.usage()); err != nil {
+			return
+		}
+	}
+
 	// Verify the token's integrity and get the unsealed / unsigned payload
-	if isSealed, err = wt.VerifyAndDecode(key, m.isInitiator); err != nil {
+	if isSealed, err = wt.VerifyAndDecode(key, m.isInitiator, v); err != nil {
 		err = fmt.Errorf("gssapi: %s", err)
 		return
 	}
@@ -605,7 +637,10 @@ func (m *Krb5Mech) MakeSignature(payload []byte) (tokenOut []byte, err error) {
 		return
 	}
 
-	tokenOut, err = mt.Marshal()
+	if tokenOut, err = mt.Marshal(); err == nil {
+		// MIC and wrap tokens share one sequence (RFC 4121)
+		m.ourSequenceNumber++
+	}
 	return
 }
 
@@ -632,7 +667,12 @@ func (m *Krb5Mech) VerifySignature(payload []byte, tokenIn []byte) (err error) {
 		key = *m.sessionKey
 	}
 
-	if err = mt.Verify(payload, key, m.isInitiator); err != nil {
+	v, err := m.verifier(key, mt.usage())
+	if err != nil {
+		return
+	}
+
+	if err = mt.verifyWith(payload, v, m.isInitiator); err != nil {
 		return
 	}
 
@@ -649,7 +689,27 @@ func (m *Krb5Mech) VerifySignature(payload []byte, tokenIn []byte) (err error) {
 }
 
 func (m *Krb5Mech) getAPReqMessage() (apreq messages.APReq, err error) {
-	auth, err := types.NewAuthenticator(m.krbClient.Credentials.Domain(), m.krbClient.Credentials.CName())
+	apreq, auth, err := newAPReq(m.krbClient.Credentials, *m.ticket, *m.sessionKey, m.requestFlags, m.channelBinding)
+	if err != nil {
+		return
+	}
+
+	// stash the sequence number for use in GSS Wrap
+	// Authenticator.SeqNumber is actually a 32 bit number (in the protocol), so the cast here is safe
+	m.ourSequenceNumber = uint64(auth.SeqNumber)
+
+	// stash the APReq time flags for use in mutual authentication
+	m.clientCTime = auth.CTime
+	m.clientCusec = auth.Cusec
+
+	return apreq, err
+}
+
+// newAPReq creates an AP-REQ message for ticket, with a new authenticator
+// carrying the GSSAPI checksum for flags and cb
+func newAPReq(creds *credentials.Credentials, ticket messages.Ticket, sessionKey types.EncryptionKey,
+	flags gssapi.ContextFlag, bnd *[16]byte) (apreq messages.APReq, auth types.Authenticator, err error) {
+	auth, err = types.NewAuthenticator(creds.Domain(), creds.CName())
 	if err != nil {
 		err = fmt.Errorf("gssapi: generating new authenticator: %s", err)
 		return
@@ -660,29 +720,36 @@ func (m *Krb5Mech) getAPReqMessage() (apreq messages.APReq, err error) {
 
 	auth.Cksum = types.Checksum{
 		CksumType: chksumtype.GSSAPI,
-		Checksum:  newAuthenticatorChksum(m.requestFlags, m.channelBinding),
+		Checksum:  newAuthenticatorChksum(flags, bnd),
 	}
 
-	apreq, err = messages.NewAPReq(*m.ticket, *m.sessionKey, auth)
+	apreq, err = messages.NewAPReq(ticket, sessionKey, auth)
 	if err != nil {
 		err = fmt.Errorf("gssapi: %s", err)
 		return
 	}
 
 	// set the Kerberos APREQ MUTUAL-REQUIRED option if we've been asked to perform mutual auth
-	if m.requestFlags&gssapi.ContextFlagMutual != 0 {
+	if flags&gssapi.ContextFlagMutual != 0 {
 		types.SetFlag(&apreq.APOptions, ianaflags.APOptionMutualRequired)
 	}
 
-	// stash the sequence number for use in GSS Wrap
-	// Authenticator.SeqNumber is actually a 32 bit number (in the protocol), so the cast here is safe
-	m.ourSequenceNumber = uint64(auth.SeqNumber)
+	return
+}
 
-	// stash the APReq time flags for use in mutual authentication
-	m.clientCTime = auth.CTime
-	m.clientCusec = auth.Cusec
+// marshalAPReqToken wraps an AP-REQ in the initial context token
+func marshalAPReqToken(apreq *messages.APReq) (token []byte, err error) {
+	tb, _ := hex.DecodeString(tokenIDKrbAPReq)
+	gssToken := kRB5Token{
+		oID:   oID(),
+		tokID: tb,
+		aPReq: apreq,
+	}
 
-	return apreq, err
+	if token, err = gssToken.marshal(); err != nil {
+		err = fmt.Errorf("gssapi: %s", err)
+	}
+	return
 }
 
 func (m *Krb5Mech) getAPRepMessage() (aprep aPRep, err error) {
@@ -719,31 +786,15 @@ func (m *Krb5Mech) getAPRepMessage() (aprep aPRep, err error) {
 }
 
 func (m *Krb5Mech) krbClientInit(service string) (err error) {
-	cfgFile := krbConfFile()
-	ccFile := krbCCFile()
-
-	cfg, err := config.Load(cfgFile)
+	rc, err := sharedKrbClient(krbConfFile(), krbCCFile())
 	if err != nil {
-		return fmt.Errorf("gssapi: loading krb5.conf: %w", err)
-	}
-
-	ccache, err := credentials.LoadCCache(ccFile)
-	if err != nil {
-		return fmt.Errorf("gssapi: loading credentials cache: %w", err)
-	}
-
-	m.krbClient, err = client.NewFromCCache(ccache, cfg)
-	if err != nil {
-		return fmt.Errorf("gssapi: creating krb5 client: %w", err)
-	}
-
-	if err := m.krbClient.AffirmLogin(); err != nil {
-		return fmt.Errorf("gssapi: checking TGT: %s", err)
+		return
 	}
+	m.krbClient = rc.cl
 
-	tkt, key, err := m.krbClient.GetServiceTicket(service)
+	tkt, key, err := rc.serviceTicket(service)
 	if err != nil {
-		return fmt.Errorf("gssapi: getting service ticket for '%s': %s", m.service, err)
+		return fmt.Errorf("gssapi: getting service ticket for '%s': %w", service, err)
 	}
 	m.ticket, m.sessionKey, m.service = &tkt, &key, service
 	m.peerName = fmt.Sprintf("%s@%s", tkt.SName.PrincipalNameString(), tkt.Realm)
@@ -0,0 +1,145 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"time"
+
+	"github.com/jcmturner/gokrb5/v8/crypto"
+	"github.com/jcmturner/gokrb5/v8/types"
+
+	"github.com/golang-auth/go-gssapi/v2"
+)
+
+// lucidSerialVersion is the version of the serialized context format
+// written by lucid_serialize in the C examples
+const lucidSerialVersion = 1
+
+var errLucidShort = errors.New("gssapi: serialized lucid context is truncated")
+
+// lucidReader decodes the big-endian fields of a serialized lucid context
+type lucidReader struct {
+	b   []byte
+	err error
+}
+
+func (r *lucidReader) next(n int) []byte {
+	if r.err != nil {
+		return nil
+	}
+	if n < 0 || len(r.b) < n {
+		r.err = errLucidShort
+		return nil
+	}
+
+	p := r.b[:n]
+	r.b = r.b[n:]
+	return p
+}
+
+func (r *lucidReader) uint32() uint32 {
+	if p := r.next(4); p != nil {
+		return binary.BigEndian.Uint32(p)
+	}
+	return 0
+}
+
+func (r *lucidReader) uint64() uint64 {
+	if p := r.next(8); p != nil {
+		return binary.BigEndian.Uint64(p)
+	}
+	return 0
+}
+
+func (r *lucidReader) bytes() []byte {
+	n := r.uint32()
+	if n > uint32(len(r.b)) {
+		r.err = errLucidShort
+		return nil
+	}
+	return r.next(int(n))
+}
+
+func (r *lucidReader) key() *types.EncryptionKey {
+	keyType := int32(r.uint32())
+	value := r.bytes()
+	if r.err != nil {
+		return nil
+	}
+
+	et, err := crypto.GetEtype(keyType)
+	if err != nil {
+		r.err = fmt.Errorf("gssapi: serialized lucid context: %s", err)
+		return nil
+	}
+	if len(value) != et.GetKeyByteSize() {
+		r.err = fmt.Errorf("gssapi: serialized lucid context: bad length %d for key type %d", len(value), keyType)
+		return nil
+	}
+
+	return &types.EncryptionKey{KeyType: keyType, KeyValue: append([]byte(nil), value...)}
+}
+
+// ImportLucidContext returns an established context from a Kerberos
+// context that was established by another GSS-API implementation and
+// serialized from its lucid form (see lucid_serialize in the C examples,
+// which documents the format).  This lets a front end complete the
+// handshake with MIT Kerberos and hand the session to a Go process, which
+// carries on with Wrap, Unwrap, MakeSignature and VerifySignature using the
+// same keys and sequence numbers.
+//
+// Only contexts using the RFC 4121 token format can be serialized, and the
+// key types must be supported by gokrb5.  The token holds the session
+// keys, so it must be passed between processes as carefully as the keys
+// themselves.
+func ImportLucidContext(token []byte) (*Krb5Mech, error) {
+	r := &lucidReader{b: token}
+
+	if v := r.uint32(); r.err == nil && v != lucidSerialVersion {
+		return nil, fmt.Errorf("gssapi: unsupported serialized lucid context version %d", v)
+	}
+
+	initiate := r.uint32() != 0
+	flags := gssapi.ContextFlag(r.uint32())
+	endTime := r.uint32()
+	sendSeq := r.uint64()
+	recvSeq := r.uint64()
+	haveAcceptorSubKey := r.uint32() != 0
+	ctxKey := r.key()
+
+	var acceptorSubKey *types.EncryptionKey
+	if haveAcceptorSubKey {
+		acceptorSubKey = r.key()
+	}
+	peerName := r.bytes()
+
+	if r.err != nil {
+		return nil, r.err
+	}
+	if len(r.b) != 0 {
+		return nil, errors.New("gssapi: trailing data after serialized lucid context")
+	}
+
+	if endTime != 0 && time.Now().After(time.Unix(int64(endTime), 0)) {
+		return nil, errors.New("gssapi: serialized lucid context has expired")
+	}
+
+	m := &Krb5Mech{
+		isInitiator:         initiate,
+		isEstablished:       true,
+		sessionKey:          ctxKey,
+		acceptorSubKey:      acceptorSubKey,
+		ourSequenceNumber:   sendSeq,
+		theirSequenceNumber: recvSeq,
+		peerName:            string(peerName),
+		sessionFlags: flags & (gssapi.ContextFlagMutual | gssapi.ContextFlagReplay |
+			gssapi.ContextFlagSequence | gssapi.ContextFlagConf | gssapi.ContextFlagInteg),
+	}
+
+	return m, nil
+}
@@ -0,0 +1,126 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"encoding/binary"
+	"testing"
+	"time"
+
+	"github.com/jcmturner/gokrb5/v8/types"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/golang-auth/go-gssapi/v2"
+)
+
+// serializeLucid encodes a context the way lucid_serialize does
+func serializeLucid(m *Krb5Mech, flags gssapi.ContextFlag, endTime time.Time) []byte {
+	u32 := func(b []byte, v uint32) []byte {
+		return append(b, byte(v>>24), byte(v>>16), byte(v>>8), byte(v))
+	}
+	key := func(b []byte, k *types.EncryptionKey) []byte {
+		b = u32(b, uint32(k.KeyType))
+		b = u32(b, uint32(len(k.KeyValue)))
+		return append(b, k.KeyValue...)
+	}
+	bool32 := func(v bool) uint32 {
+		if v {
+			return 1
+		}
+		return 0
+	}
+
+	b := u32(nil, lucidSerialVersion)
+	b = u32(b, bool32(m.isInitiator))
+	b = u32(b, uint32(flags))
+	b = u32(b, uint32(endTime.Unix()))
+	b = append(b, make([]byte, 16)...)
+	binary.BigEndian.PutUint64(b[len(b)-16:], m.ourSequenceNumber)
+	binary.BigEndian.PutUint64(b[len(b)-8:], m.theirSequenceNumber)
+	b = u32(b, bool32(m.acceptorSubKey != nil))
+	b = key(b, m.sessionKey)
+	if m.acceptorSubKey != nil {
+		b = key(b, m.acceptorSubKey)
+	}
+	b = u32(b, uint32(len(m.peerName)))
+	return append(b, m.peerName...)
+}
+
+func TestImportLucidContext(t *testing.T) {
+	flags := gssapi.ContextFlagMutual | gssapi.ContextFlagSequence | gssapi.ContextFlagConf | gssapi.ContextFlagInteg
+
+	for _, withSubKey := range []bool{false, true} {
+		initiator, acceptor := mkBatchPair(1, flags)
+		if withSubKey {
+			subKey := mkSampleAESKey()
+			subKey.KeyValue = append([]byte(nil), subKey.KeyValue...)
+			subKey.KeyValue[1] ^= 0x55
+			initiator.acceptorSubKey, acceptor.acceptorSubKey = &subKey, &subKey
+		}
+		acceptor.peerName = "client@EXAMPLE.COM"
+
+		// some traffic before the context is handed over
+		for i := 0; i < 3; i++ {
+			tok, err := initiator.Wrap([]byte("before"), true)
+			require.NoError(t, err)
+			_, _, err = acceptor.Unwrap(tok)
+			require.NoError(t, err)
+		}
+		_, err := acceptor.MakeSignature([]byte("before"))
+		require.NoError(t, err)
+
+		// the DELEG flag is not supported and is dropped
+		imported, err := ImportLucidContext(serializeLucid(acceptor, flags|gssapi.ContextFlagDeleg, time.Now().Add(time.Hour)))
+		require.NoError(t, err)
+
+		assert.True(t, imported.IsEstablished())
+		assert.False(t, imported.isInitiator)
+		assert.Equal(t, flags, imported.ContextFlags())
+		assert.Equal(t, "client@EXAMPLE.COM", imported.PeerName())
+		assert.Equal(t, acceptor.SSF(), imported.SSF())
+
+		// the imported context carries on where the original left off
+		tok, err := initiator.Wrap([]byte("after"), true)
+		require.NoError(t, err)
+		msg, sealed, err := imported.Unwrap(tok)
+		require.NoError(t, err)
+		assert.True(t, sealed)
+		assert.Equal(t, []byte("after"), msg)
+
+		tok, err = imported.MakeSignature([]byte("reply"))
+		require.NoError(t, err)
+		assert.NoError(t, initiator.VerifySignature([]byte("reply"), tok))
+	}
+}
+
+func TestImportLucidContextErrors(t *testing.T) {
+	_, acceptor := mkBatchPair(1, 0)
+	good := serializeLucid(acceptor, 0, time.Now().Add(time.Hour))
+
+	_, err := ImportLucidContext(good)
+	require.NoError(t, err)
+
+	for n := 0; n < len(good); n++ {
+		_, err := ImportLucidContext(good[:n])
+		assert.Error(t, err, "truncated to %d bytes", n)
+	}
+
+	_, err = ImportLucidContext(append(append([]byte(nil), good...), 0))
+	assert.Error(t, err, "trailing data")
+
+	badVersion := append([]byte(nil), good...)
+	badVersion[3] = 2
+	_, err = ImportLucidContext(badVersion)
+	assert.Error(t, err, "version")
+
+	badKeyLen := append([]byte(nil), good...)
+	badKeyLen[43]--
+	_, err = ImportLucidContext(badKeyLen)
+	assert.Error(t, err, "key length")
+
+	_, err = ImportLucidContext(serializeLucid(acceptor, 0, time.Now().Add(-time.Minute)))
+	assert.Error(t, err, "expired")
+}
@@ -6,7 +6,6 @@ package krb5
 
 import (
 	"bytes"
-	"crypto/hmac"
 	"encoding/binary"
 	"errors"
 	"fmt"
@@ -115,18 +114,13 @@ func (wt *wrapToken) Seal(key types.EncryptionKey) (err error) {
 	toEncrypt = append(toEncrypt, wt.Payload...)
 	toEncrypt = append(toEncrypt, wt.header()...)
 
-	usage := keyusage.GSSAPI_INITIATOR_SEAL
-	if wt.Flags&gSSMessageTokenFlagSentByAcceptor != 0 {
-		usage = keyusage.GSSAPI_ACCEPTOR_SEAL
-	}
-
 	encType, err := crypto.GetEtype(key.KeyType)
 	if err != nil {
 		err = fmt.Errorf("gssapi: %s", err)
 		return
 	}
 	var encData []byte
-	_, encData, err = encType.EncryptMessage(key.KeyValue, toEncrypt, uint32(usage))
+	_, encData, err = encType.EncryptMessage(key.KeyValue, toEncrypt, wt.usage())
 	if err != nil {
 		err = fmt.Errorf("gssapi: %s", err)
 	}
@@ -141,29 +135,33 @@ func (wt *wrapToken) Seal(key types.EncryptionKey) (err error) {
 
 func (wt *wrapToken) header() (hdr []byte) {
 	hdr = make([]byte, msgTokenHdrLen)
+	wt.putHeader(hdr)
 
-	tokID := getGssWrapTokenID()
-	hdr1 := []byte{
-		tokID[0], tokID[1], // token ID
-		byte(wt.Flags), // flags
-		0xFF,           // filler
-		0x00, 0x00,     // EC
-		0x00, 0x00, // RRC
-	}
+	return
+}
 
-	copy(hdr, hdr1)
+// putHeader writes the token header with EC and RRC set to zero to hdr,
+// which must be at least msgTokenHdrLen bytes long
+func (wt *wrapToken) putHeader(hdr []byte) {
+	tokID := getGssWrapTokenID()
+	hdr[0], hdr[1] = tokID[0], tokID[1] // token ID
+	hdr[2] = byte(wt.Flags)             // flags
+	hdr[3] = msgTokenFillerByte         // filler
+	hdr[4], hdr[5] = 0x00, 0x00         // EC
+	hdr[6], hdr[7] = 0x00, 0x00         // RRC
 	binary.BigEndian.PutUint64(hdr[8:], wt.SequenceNumber)
-
-	return
 }
 
-func (wt *wrapToken) computeChecksum(key types.EncryptionKey) (cksum []byte, err error) {
-	// wrap tokens always use the Seal key usage (RFC 4121 § 2)
-	usage := keyusage.GSSAPI_INITIATOR_SEAL
+// wrap tokens always use the Seal key usage (RFC 4121 § 2)
+func (wt *wrapToken) usage() uint32 {
 	if wt.Flags&gSSMessageTokenFlagSentByAcceptor != 0 {
-		usage = keyusage.GSSAPI_ACCEPTOR_SEAL
+		return keyusage.GSSAPI_ACCEPTOR_SEAL
 	}
 
+	return keyusage.GSSAPI_INITIATOR_SEAL
+}
+
+func (wt *wrapToken) computeChecksum(key types.EncryptionKey) (cksum []byte, err error) {
 	plLen := len(wt.Payload)
 
 	// Build a slice containing { payload | header }
@@ -177,7 +175,7 @@ func (wt *wrapToken) computeChecksum(key types.EncryptionKey) (cksum []byte, err
 		return
 	}
 
-	cksum, err = encType.GetChecksumHash(key.KeyValue, cksumData, uint32(usage))
+	cksum, err = encType.GetChecksumHash(key.KeyValue, cksumData, wt.usage())
 	if err != nil {
 		err = fmt.Errorf("gssapi: %s", err)
 		return
@@ -249,7 +247,10 @@ func (wt *wrapToken) Unmarshal(token []byte) (err error) {
 	return nil
 }
 
-func (wt *wrapToken) VerifyAndDecode(key types.EncryptionKey, expectFromAcceptor bool) (isSealed bool, err error) {
+// VerifyAndDecode decrypts a sealed token or checks the signature of a signed
+// token.  v is the verifier used for signed tokens; if nil, a verifier is
+// created for key.
+func (wt *wrapToken) VerifyAndDecode(key types.EncryptionKey, expectFromAcceptor bool, v *checksumVerifier) (isSealed bool, err error) {
 	if !wt.signedOrSealed {
 		return false, errors.New("gssapi: wrap token is not signed or sealed")
 	}
@@ -264,24 +265,25 @@ func (wt *wrapToken) VerifyAndDecode(key types.EncryptionKey, expectFromAcceptor
 
 	if wt.Flags&gSSMessageTokenFlagSealed != 0 {
 		return true, wt.decrypt(key)
-	} else {
-		return false, wt.checkSig(key)
 	}
-}
 
-func (wt *wrapToken) decrypt(key types.EncryptionKey) (err error) {
-	usage := keyusage.GSSAPI_INITIATOR_SEAL
-	if wt.Flags&gSSMessageTokenFlagSentByAcceptor != 0 {
-		usage = keyusage.GSSAPI_ACCEPTOR_SEAL
+	if v == nil {
+		if v, err = newChecksumVerifier(key, wt.usage()); err != nil {
+			return false, fmt.Errorf("gssapi: wrap token: %s", err)
+		}
 	}
 
+	return false, wt.checkSig(v)
+}
+
+func (wt *wrapToken) decrypt(key types.EncryptionKey) (err error) {
 	encType, err := crypto.GetEtype(key.KeyType)
 	if err != nil {
 		return fmt.Errorf("gssapi: wrap token: %s", err)
 	}
 
 	var decrypted []byte
-	decrypted, err = encType.DecryptMessage(key.KeyValue, wt.Payload, uint32(usage))
+	decrypted, err = encType.DecryptMessage(key.KeyValue, wt.Payload, wt.usage())
 	if err != nil {
 		return fmt.Errorf("gssapi: wrap token: %s", err)
 	}
@@ -312,14 +314,9 @@ func (wt *wrapToken) decrypt(key types.EncryptionKey) (err error) {
 	return err
 }
 
-func (wt *wrapToken) checkSig(key types.EncryptionKey) (err error) {
-	encType, err := crypto.GetEtype(key.KeyType)
-	if err != nil {
-		return fmt.Errorf("gssapi: wrap token: %s", err)
-	}
-
+func (wt *wrapToken) checkSig(v *checksumVerifier) (err error) {
 	// extra-count should be the crypto checksum length
-	if wt.EC != uint16(encType.GetHMACBitLength()/8) {
+	if int(wt.EC) != v.cksumLen {
 		return errors.New("gssapi: bad wrap token checksum length")
 	}
 
@@ -328,24 +325,24 @@ func (wt *wrapToken) checkSig(key types.EncryptionKey) (err error) {
 		return errors.New("gssapi: signed wrap token payload is too short")
 	}
 
-	tokCksum := wt.Payload[len(wt.Payload)-int(wt.EC):]
+	plLen := len(wt.Payload) - int(wt.EC)
 
-	wt2 := *wt
-	wt2.Payload = wt.Payload[0 : len(wt.Payload)-int(wt.EC)]
-	computedCksum, err := wt2.computeChecksum(key)
+	// the checksum covers { payload | header }, with EC and RRC set to zero
+	wt.putHeader(v.hdr[:])
+	ok, err := v.verify(wt.Payload[:plLen], wt.Payload[plLen:])
 	if err != nil {
-		return fmt.Errorf("gssapi: %s", err)
+		return err
 	}
 
-	if !hmac.Equal(tokCksum, computedCksum) {
+	if !ok {
 		return errors.New("gssapi: invalid wrap token checksum")
 	}
 
 	// remove the signature from the payload
-	wt.Payload = wt.Payload[0 : len(wt.Payload)-int(wt.EC)]
+	wt.Payload = wt.Payload[:plLen]
 	wt.signedOrSealed = false
 
-	return err
+	return nil
 }
 
 // Ported from MIT source code (gss_krb5int_rotate_left)
@@ -375,12 +372,6 @@ func rotateLeft(buf []byte, rc uint) (out []byte) {
 // Checksum is calculated over the plaintext (supplied token payload), and
 // the token header
 func (mt *mICToken) Sign(payload []byte, key types.EncryptionKey) (err error) {
-	// mic tokens always use the Sign key usage
-	usage := keyusage.GSSAPI_INITIATOR_SIGN
-	if mt.Flags&gSSMessageTokenFlagSentByAcceptor != 0 {
-		usage = keyusage.GSSAPI_ACCEPTOR_SIGN
-	}
-
 	cksumData := make([]byte, 0, msgTokenHdrLen+len(payload))
 	cksumData = append(cksumData, payload...)
 	cksumData = append(cksumData, mt.header()...)
@@ -391,7 +382,7 @@ func (mt *mICToken) Sign(payload []byte, key types.EncryptionKey) (err error) {
 		return
 	}
 
-	mt.Checksum, err = encType.GetChecksumHash(key.KeyValue, cksumData, uint32(usage))
+	mt.Checksum, err = encType.GetChecksumHash(key.KeyValue, cksumData, mt.usage())
 	if err != nil {
 		err = fmt.Errorf("gssapi: %s", err)
 		return
@@ -404,20 +395,30 @@ func (mt *mICToken) Sign(payload []byte, key types.EncryptionKey) (err error) {
 
 func (mt *mICToken) header() (hdr []byte) {
 	hdr = make([]byte, msgTokenHdrLen)
+	mt.putHeader(hdr)
 
+	return
+}
+
+// putHeader writes the token header to hdr, which must be at least
+// msgTokenHdrLen bytes long
+func (mt *mICToken) putHeader(hdr []byte) {
 	tokID := getGssMICTokenID()
-	hdr1 := []byte{
-		tokID[0], tokID[1], // token ID
-		byte(mt.Flags),               // flags
-		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // filler
-		0x00, 0x00, // EC
-		0x00, 0x00, // RRC
+	hdr[0], hdr[1] = tokID[0], tokID[1] // token ID
+	hdr[2] = byte(mt.Flags)             // flags
+	for i := 3; i < 8; i++ {
+		hdr[i] = msgTokenFillerByte // filler
 	}
-
-	copy(hdr, hdr1)
 	binary.BigEndian.PutUint64(hdr[8:], mt.SequenceNumber)
+}
 
-	return
+// mic tokens always use the Sign key usage
+func (mt *mICToken) usage() uint32 {
+	if mt.Flags&gSSMessageTokenFlagSentByAcceptor != 0 {
+		return keyusage.GSSAPI_ACCEPTOR_SIGN
+	}
+
+	return keyusage.GSSAPI_INITIATOR_SIGN
 }
 
 func (mt *mICToken) Marshal() (token []byte, err error) {
@@ -478,6 +479,17 @@ func (mt *mICToken) Unmarshal(token []byte) (err error) {
 }
 
 func (mt *mICToken) Verify(payload []byte, key types.EncryptionKey, expectFromAcceptor bool) (err error) {
+	v, err := newChecksumVerifier(key, mt.usage())
+	if err != nil {
+		return err
+	}
+
+	return mt.verifyWith(payload, v, expectFromAcceptor)
+}
+
+// verifyWith checks the token's checksum using a verifier created for the
+// token's key usage, allocating nothing for the simplified profile encryption types
+func (mt *mICToken) verifyWith(payload []byte, v *checksumVerifier, expectFromAcceptor bool) (err error) {
 	if !mt.signed {
 		return errors.New("gssapi: MIC token is not signed")
 	}
@@ -491,16 +503,16 @@ func (mt *mICToken) Verify(payload []byte, key types.EncryptionKey, expectFromAc
 		return fmt.Errorf("gssapi: MIC token from acceptor: %t, expect from acceptor: %t", isFromAcceptor, expectFromAcceptor)
 	}
 
-	// copy the token and use it to sign the supplied payload
-	wt2 := *mt
-	if err = wt2.Sign(payload, key); err != nil {
+	// check the token's checksum against { payload | header }
+	mt.putHeader(v.hdr[:])
+	ok, err := v.verify(payload, mt.Checksum)
+	if err != nil {
 		return err
 	}
 
-	// check the token's checksums
-	if !bytes.Equal(mt.Checksum, wt2.Checksum) {
+	if !ok {
 		return errors.New("gssapi: invalid MIC token checksum")
 	}
 
-	return
+	return nil
 }
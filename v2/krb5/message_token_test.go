@@ -9,6 +9,8 @@ import (
 	"fmt"
 	"testing"
 
+	"github.com/golang-auth/go-gssapi/v2"
+	"github.com/jcmturner/gokrb5/v8/crypto"
 	"github.com/jcmturner/gokrb5/v8/iana/etypeID"
 	"github.com/stretchr/testify/assert"
 
@@ -206,3 +208,125 @@ func TestMICTokenUnmarshal(t *testing.T) {
 	assert.Equal(t, uint64(123), tok.SequenceNumber, "bad sequence number")
 	assert.Equal(t, true, tok.signed, "token is not signed/sealed")
 }
+
+func TestChecksumVerifier(t *testing.T) {
+	var tests = []string{
+		"des3-cbc-sha1-kd",
+		"aes128-cts-hmac-sha1-96",
+		"aes256-cts-hmac-sha1-96",
+		"aes128-cts-hmac-sha256-128",
+		"aes256-cts-hmac-sha384-192",
+		"rc4-hmac",
+	}
+
+	payload := []byte(TestWrapPayload)
+
+	for _, keyTypeName := range tests {
+		t.Run(keyTypeName, func(t *testing.T) {
+			etype, _ := crypto.GetEtype(etypeID.EtypeSupported(keyTypeName))
+			key, err := GenerateBaseKey(etype)
+			assert.NoError(t, err, "failed to generate encryption key")
+
+			// the verifier must agree with the signing code
+			mt := mkSampleMICToken()
+			assert.NoError(t, mt.Sign(payload, key), "signing operation failed")
+
+			v, err := newChecksumVerifier(key, mt.usage())
+			assert.NoError(t, err, "failed to create verifier")
+			assert.True(t, v.matches(key, mt.usage()))
+
+			assert.NoError(t, mt.verifyWith(payload, v, false), "signature should verify")
+			assert.Error(t, mt.verifyWith([]byte("testing 124"), v, false), "modified payload should not verify")
+
+			mt.SequenceNumber++
+			assert.Error(t, mt.verifyWith(payload, v, false), "modified header should not verify")
+		})
+	}
+}
+
+func TestMICTokenVerify(t *testing.T) {
+	key := mkSampleAESKey()
+	tokBytes, _ := hex.DecodeString(SampleMICToken)
+
+	tok := mICToken{}
+	assert.NoError(t, tok.Unmarshal(tokBytes), "Unmarshal of MIC token failed")
+	assert.NoError(t, tok.Verify([]byte(TestWrapPayload), key, false), "sample MIC token should verify")
+	assert.Error(t, tok.Verify([]byte(TestWrapPayload), key, true), "MIC token should not be from the acceptor")
+
+	tokBytes[len(tokBytes)-1] ^= 0x01
+	assert.NoError(t, tok.Unmarshal(tokBytes), "Unmarshal of MIC token failed")
+	assert.Error(t, tok.Verify([]byte(TestWrapPayload), key, false), "corrupt MIC token should not verify")
+}
+
+func TestWrapTokenCheckSig(t *testing.T) {
+	key := mkSampleAESKey()
+	tok := mkSampleWrapToken()
+	assert.NoError(t, tok.Sign(key), "signing operation failed")
+
+	tokBytes, err := tok.Marshal()
+	assert.NoError(t, err, "Marshal of signed token should succeed")
+
+	tok2 := wrapToken{}
+	assert.NoError(t, tok2.Unmarshal(tokBytes), "Unmarshal of signed token failed")
+	isSealed, err := tok2.VerifyAndDecode(key, false, nil)
+	assert.NoError(t, err, "signed token should verify")
+	assert.False(t, isSealed)
+	assert.Equal(t, []byte(TestWrapPayload), tok2.Payload, "corrupt payload")
+
+	tokBytes[msgTokenHdrLen] ^= 0x01
+	assert.NoError(t, tok2.Unmarshal(tokBytes), "Unmarshal of signed token failed")
+	_, err = tok2.VerifyAndDecode(key, false, nil)
+	assert.Error(t, err, "corrupt signed token should not verify")
+}
+
+func TestVerifyAllocs(t *testing.T) {
+	key := mkSampleAESKey()
+	payload := []byte(TestWrapPayload)
+
+	initiator := &Krb5Mech{isInitiator: true, isEstablished: true, sessionKey: &key}
+	acceptor := &Krb5Mech{isInitiator: false, isEstablished: true, sessionKey: &key}
+
+	micToken, err := initiator.MakeSignature(payload)
+	assert.NoError(t, err, "MakeSignature failed")
+	wrapToken, err := initiator.Wrap(payload, false)
+	assert.NoError(t, err, "Wrap failed")
+
+	micAllocs := testing.AllocsPerRun(100, func() {
+		if err := acceptor.VerifySignature(payload, micToken); err != nil {
+			t.Fatal(err)
+		}
+	})
+	assert.Zero(t, micAllocs, "MIC verification should not allocate")
+
+	wrapAllocs := testing.AllocsPerRun(100, func() {
+		if _, _, err := acceptor.Unwrap(wrapToken); err != nil {
+			t.Fatal(err)
+		}
+	})
+	assert.Zero(t, wrapAllocs, "signed wrap token verification should not allocate")
+}
+
+func TestMICTokenSequence(t *testing.T) {
+	key := mkSampleAESKey()
+	payload := []byte(TestWrapPayload)
+
+	initiator := &Krb5Mech{isInitiator: true, isEstablished: true, sessionKey: &key, sessionFlags: gssapi.ContextFlagSequence}
+	acceptor := &Krb5Mech{isInitiator: false, isEstablished: true, sessionKey: &key, sessionFlags: gssapi.ContextFlagSequence}
+
+	// MIC and wrap tokens take their sequence numbers from the same counter
+	mic1, err := initiator.MakeSignature(payload)
+	assert.NoError(t, err, "MakeSignature failed")
+	wrapToken, err := initiator.Wrap(payload, false)
+	assert.NoError(t, err, "Wrap failed")
+	mic2, err := initiator.MakeSignature(payload)
+	assert.NoError(t, err, "MakeSignature failed")
+	assert.Equal(t, uint64(3), initiator.ourSequenceNumber, "bad sequence number")
+
+	assert.NoError(t, acceptor.VerifySignature(payload, mic1), "first MIC token")
+	_, _, err = acceptor.Unwrap(wrapToken)
+	assert.NoError(t, err, "wrap token")
+	assert.NoError(t, acceptor.VerifySignature(payload, mic2), "second MIC token")
+
+	// and a replayed MIC token is out of sequence
+	assert.Error(t, acceptor.VerifySignature(payload, mic1), "replayed MIC token should fail")
+}
@@ -0,0 +1,137 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"net"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/jcmturner/gokrb5/v8/iana/nametype"
+	"github.com/jcmturner/gokrb5/v8/types"
+)
+
+// CanonicalizeHostnames makes Initiate replace the host in a service name
+// with its canonical name from DNS, as MIT Kerberos does when
+// dns_canonicalize_hostname is set.  It is off by default, so the host
+// name is used as given.
+var CanonicalizeHostnames = false
+
+// SPNCacheTTL is how long Initiate reuses what it worked out from a service
+// name: the Kerberos principal, the realm from the domain_realm mapping, and
+// with CanonicalizeHostnames the answer from DNS.  Once an entry expires it
+// is still used while it is refreshed in the background, so only the first
+// context for a service name waits for DNS.
+var SPNCacheTTL = time.Minute * 5
+
+// maxCachedSPNs bounds the size of the cache; it is emptied when full
+const maxCachedSPNs = 4096
+
+// lookupCNAME finds the canonical name of a host
+var lookupCNAME = net.LookupCNAME
+
+// canonicalSPN is the principal and realm for a service name
+type canonicalSPN struct {
+	name    string // service/host
+	spn     types.PrincipalName
+	realm   string
+	expires time.Time
+
+	refreshing bool // guarded by spnCache.mu
+}
+
+// spnCache memoises the canonical form of service names
+type spnCache struct {
+	resolveRealm func(host string) string
+
+	mu    sync.Mutex
+	names map[string]*canonicalSPN
+}
+
+func newSPNCache(resolveRealm func(host string) string) *spnCache {
+	return &spnCache{
+		resolveRealm: resolveRealm,
+		names:        make(map[string]*canonicalSPN),
+	}
+}
+
+// canonicalize returns the principal and realm for a service name, which
+// may be a Kerberos name such as "HTTP/www.example.com", optionally with a
+// realm, or a GSS-API host-based service name such as "HTTP@www.example.com"
+func (c *spnCache) canonicalize(service string) *canonicalSPN {
+	c.mu.Lock()
+	e, ok := c.names[service]
+	if ok {
+		if !e.refreshing && time.Now().After(e.expires) {
+			e.refreshing = true
+			go c.refresh(service, e)
+		}
+		c.mu.Unlock()
+		return e
+	}
+	c.mu.Unlock()
+
+	e, _ = c.resolve(service)
+	c.store(service, e)
+
+	return e
+}
+
+func (c *spnCache) refresh(service string, old *canonicalSPN) {
+	e, ok := c.resolve(service)
+	if !ok {
+		// keep the last good answer rather than the name as given
+		e = &canonicalSPN{name: old.name, spn: old.spn, realm: old.realm, expires: e.expires}
+	}
+	c.store(service, e)
+}
+
+func (c *spnCache) store(service string, e *canonicalSPN) {
+	c.mu.Lock()
+	if len(c.names) >= maxCachedSPNs {
+		c.names = make(map[string]*canonicalSPN)
+	}
+	c.names[service] = e
+	c.mu.Unlock()
+}
+
+// resolve works out the principal and realm for a service name, reporting
+// whether DNS answered if it was asked
+func (c *spnCache) resolve(service string) (e *canonicalSPN, ok bool) {
+	ok = true
+	name, realm := service, ""
+
+	if i := strings.Index(service, "/"); i < 0 {
+		// host-based service, service@host
+		if i := strings.LastIndex(service, "@"); i >= 0 {
+			name = service[:i] + "/" + service[i+1:]
+		}
+	} else if i := strings.LastIndex(service, "@"); i >= 0 {
+		name, realm = service[:i], service[i+1:]
+	}
+
+	spn := types.NewPrincipalName(nametype.KRB_NT_PRINCIPAL, name)
+	if n := len(spn.NameString); n > 1 && CanonicalizeHostnames {
+		var cname string
+		var err error
+		if cname, err = lookupCNAME(spn.NameString[n-1]); err == nil {
+			spn.NameString[n-1] = strings.ToLower(strings.TrimSuffix(cname, "."))
+			name = strings.Join(spn.NameString, "/")
+		}
+		ok = err == nil
+	}
+
+	if realm == "" {
+		realm = c.resolveRealm(spn.NameString[len(spn.NameString)-1])
+	}
+
+	return &canonicalSPN{
+		name:    name,
+		spn:     spn,
+		realm:   realm,
+		expires: time.Now().Add(SPNCacheTTL),
+	}, ok
+}
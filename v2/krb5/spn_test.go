@@ -0,0 +1,111 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package krb5
+
+import (
+	"errors"
+	"strings"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+)
+
+// countingRealms maps hosts under example.com to EXAMPLE.COM and everything
+// else to OTHER.ORG, counting the lookups
+func countingRealms(n *int32) func(string) string {
+	return func(host string) string {
+		atomic.AddInt32(n, 1)
+		if strings.HasSuffix(host, ".example.com") {
+			return "EXAMPLE.COM"
+		}
+		return "OTHER.ORG"
+	}
+}
+
+// setupSPNCache sets CanonicalizeHostnames, SPNCacheTTL and the DNS lookup,
+// returning a function to restore the defaults
+func setupSPNCache(canon bool, ttl time.Duration, lookup func(string) (string, error)) (restore func()) {
+	oldCanon, oldTTL, oldLookup := CanonicalizeHostnames, SPNCacheTTL, lookupCNAME
+	CanonicalizeHostnames, SPNCacheTTL, lookupCNAME = canon, ttl, lookup
+
+	return func() {
+		CanonicalizeHostnames, SPNCacheTTL, lookupCNAME = oldCanon, oldTTL, oldLookup
+	}
+}
+
+func TestSPNCache(t *testing.T) {
+	defer setupSPNCache(false, time.Hour, nil)()
+
+	var lookups int32
+	c := newSPNCache(countingRealms(&lookups))
+
+	var tests = []struct {
+		service string
+		name    string
+		realm   string
+	}{
+		{"HTTP/www.example.com", "HTTP/www.example.com", "EXAMPLE.COM"},
+		{"HTTP@www.example.com", "HTTP/www.example.com", "EXAMPLE.COM"},
+		{"host/db.other.org@EXAMPLE.COM", "host/db.other.org", "EXAMPLE.COM"},
+		{"host/db.other.org", "host/db.other.org", "OTHER.ORG"},
+		{"ldap", "ldap", "OTHER.ORG"},
+	}
+
+	for _, tt := range tests {
+		e := c.canonicalize(tt.service)
+		assert.Equal(t, tt.name, e.name, tt.service)
+		assert.Equal(t, tt.realm, e.realm, tt.service)
+		assert.Equal(t, strings.Split(tt.name, "/"), e.spn.NameString, tt.service)
+	}
+	assert.Equal(t, int32(4), atomic.LoadInt32(&lookups))
+
+	// the second time round, everything comes from the cache
+	for _, tt := range tests {
+		c.canonicalize(tt.service)
+	}
+	assert.Equal(t, int32(4), atomic.LoadInt32(&lookups))
+}
+
+func TestSPNCacheDNS(t *testing.T) {
+	var queries int32
+	answer := make(chan string, 10)
+	defer setupSPNCache(true, time.Millisecond*50, func(host string) (string, error) {
+		atomic.AddInt32(&queries, 1)
+		if a := <-answer; a != "" {
+			return a, nil
+		}
+		return "", errors.New("no such host")
+	})()
+
+	var lookups int32
+	c := newSPNCache(countingRealms(&lookups))
+
+	answer <- "WWW1.Example.COM."
+	e := c.canonicalize("HTTP@www")
+	assert.Equal(t, "HTTP/www1.example.com", e.name)
+	assert.Equal(t, "EXAMPLE.COM", e.realm)
+
+	// expired, so the old answer is used while DNS is asked again
+	time.Sleep(time.Millisecond * 60)
+	assert.Equal(t, "HTTP/www1.example.com", c.canonicalize("HTTP@www").name)
+	answer <- "www2.example.com"
+	assert.Eventually(t, func() bool {
+		return c.canonicalize("HTTP@www").name == "HTTP/www2.example.com"
+	}, time.Second*5, time.Millisecond*5)
+
+	// and if DNS fails, the last good answer is kept
+	time.Sleep(time.Millisecond * 60)
+	c.canonicalize("HTTP@www")
+	answer <- ""
+	assert.Eventually(t, func() bool {
+		c.mu.Lock()
+		defer c.mu.Unlock()
+		return !c.names["HTTP@www"].refreshing
+	}, time.Second*5, time.Millisecond*5)
+	assert.Equal(t, int32(3), atomic.LoadInt32(&queries))
+	assert.Equal(t, "HTTP/www2.example.com", c.canonicalize("HTTP@www").name)
+}
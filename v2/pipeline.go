@@ -0,0 +1,150 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package gssapi
+
+import (
+	"errors"
+	"sync"
+)
+
+// ErrPipelineClosed is returned by UnwrapPipeline.Next after Close
+var ErrPipelineClosed = errors.New("gssapi: unwrap pipeline closed")
+
+type unwrapResult struct {
+	msg    []byte
+	sealed bool
+	err    error
+}
+
+// UnwrapPipeline receives and unwraps the tokens of a single connection
+// ahead of the application.  One goroutine reads the next tokens from the
+// connection while a second unwraps them, so that waiting for the network,
+// decrypting and the application's own processing of the previous message
+// all overlap, and a single stream runs at the speed of the slowest of the
+// three rather than their sum.
+//
+// Tokens are unwrapped one at a time in the order they were read, so the
+// mechanism's sequence checks see exactly what they would if the
+// application called Unwrap itself.  While the pipeline is running the
+// application must not call Unwrap or VerifySignature on the context;
+// it may carry on sending with Wrap and MakeSignature if the mechanism
+// allows those to run alongside Unwrap, as the Kerberos mechanism does.
+type UnwrapPipeline struct {
+	results   chan unwrapResult
+	done      chan struct{}
+	closeOnce sync.Once
+	err       error
+}
+
+// NewUnwrapPipeline starts reading tokens with readToken and unwrapping
+// them with mech.  readToken is the application's framing, returning the
+// next whole token from the connection; it may reuse its buffer from one
+// call to the next, as TokenConn.ReadToken does, because the pipeline
+// copies each token before reading the next.  depth bounds the read-ahead:
+// at most depth tokens wait to be unwrapped and depth messages wait for
+// Next.  A depth of less than one is treated as one.
+func NewUnwrapPipeline(mech Mech, readToken func() ([]byte, error), depth int) *UnwrapPipeline {
+	if depth < 1 {
+		depth = 1
+	}
+
+	p := &UnwrapPipeline{
+		results: make(chan unwrapResult, depth),
+		done:    make(chan struct{}),
+	}
+
+	tokens := make(chan unwrapResult, depth)
+	go p.read(readToken, tokens)
+	go p.unwrap(mech, tokens)
+
+	return p
+}
+
+// read passes tokens to the unwrap goroutine, up to and including the
+// first read error.  Each token is copied: the message that Unwrap returns
+// may be a slice of the token, and it must outlive the next readToken.
+func (p *UnwrapPipeline) read(readToken func() ([]byte, error), tokens chan<- unwrapResult) {
+	defer close(tokens)
+
+	for {
+		tok, err := readToken()
+		if err == nil {
+			tok = append([]byte(nil), tok...)
+		}
+		select {
+		case tokens <- unwrapResult{msg: tok, err: err}:
+		case <-p.done:
+			return
+		}
+
+		if err != nil {
+			return
+		}
+	}
+}
+
+// unwrap passes messages to Next, up to and including the first error
+func (p *UnwrapPipeline) unwrap(mech Mech, tokens <-chan unwrapResult) {
+	defer close(p.results)
+
+	for r := range tokens {
+		if r.err == nil {
+			r.msg, r.sealed, r.err = mech.Unwrap(r.msg)
+		}
+
+		select {
+		case p.results <- r:
+		case <-p.done:
+			return
+		}
+
+		if r.err != nil {
+			return
+		}
+	}
+}
+
+// Next returns the next message, as Unwrap would have.  The first error,
+// from either readToken or Unwrap, is returned after every message that
+// preceded it, and then again by every later call.  Next must not be
+// called concurrently, but Close may be called while it is waiting.
+func (p *UnwrapPipeline) Next() (msg []byte, isSealed bool, err error) {
+	if p.err != nil {
+		return nil, false, p.err
+	}
+
+	var r unwrapResult
+	ok := false
+	select {
+	case <-p.done:
+	default:
+		select {
+		case r, ok = <-p.results:
+		case <-p.done:
+		}
+	}
+
+	if !ok {
+		r.err = ErrPipelineClosed
+	}
+	if r.err != nil {
+		p.err = r.err
+	}
+
+	return r.msg, r.sealed, r.err
+}
+
+// Close stops the pipeline and discards any tokens that have been read
+// ahead; Next returns ErrPipelineClosed from then on.  A readToken call
+// that is blocked is not interrupted, so the connection should be closed
+// as well, and the context must not be used to unwrap anything else once
+// the pipeline has read ahead of the application.
+func (p *UnwrapPipeline) Close() error {
+	p.closeOnce.Do(func() {
+		close(p.done)
+	})
+
+	return nil
+}
@@ -0,0 +1,179 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package gssapi
+
+import (
+	"errors"
+	"fmt"
+	"io"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+// seqMech unwraps tokens made of a sequence number byte and a payload,
+// checking that the sequence numbers arrive in order
+type seqMech struct {
+	Mech
+	next  byte
+	delay time.Duration
+}
+
+func (m *seqMech) Unwrap(tokenIn []byte) ([]byte, bool, error) {
+	time.Sleep(m.delay)
+
+	if len(tokenIn) == 0 {
+		return nil, false, errors.New("empty token")
+	}
+	if tokenIn[0] != m.next {
+		return nil, false, fmt.Errorf("bad sequence number, got %d, wanted %d", tokenIn[0], m.next)
+	}
+	m.next++
+
+	return tokenIn[1:], true, nil
+}
+
+// tokenSource returns the tokens in turn, then err
+func tokenSource(tokens [][]byte, delay time.Duration, err error) func() ([]byte, error) {
+	return func() ([]byte, error) {
+		time.Sleep(delay)
+		if len(tokens) == 0 {
+			return nil, err
+		}
+
+		tok := tokens[0]
+		tokens = tokens[1:]
+		return tok, nil
+	}
+}
+
+func seqTokens(n int) (tokens [][]byte) {
+	for i := 0; i < n; i++ {
+		tokens = append(tokens, []byte{byte(i), 'm', byte('0' + i%10)})
+	}
+	return
+}
+
+func TestUnwrapPipeline(t *testing.T) {
+	p := NewUnwrapPipeline(&seqMech{}, tokenSource(seqTokens(20), 0, io.EOF), 4)
+	defer p.Close()
+
+	for i := 0; i < 20; i++ {
+		msg, sealed, err := p.Next()
+		require.NoError(t, err)
+		assert.True(t, sealed)
+		assert.Equal(t, []byte{'m', byte('0' + i%10)}, msg)
+	}
+
+	// the read error comes after the messages, and stays
+	_, _, err := p.Next()
+	assert.Equal(t, io.EOF, err)
+	_, _, err = p.Next()
+	assert.Equal(t, io.EOF, err)
+}
+
+func TestUnwrapPipelineReusedBuffer(t *testing.T) {
+	// a reader that reads every token into the same buffer, and a mechanism
+	// that returns a slice of the token, as a signed Unwrap does
+	var buf [3]byte
+	next := tokenSource(seqTokens(8), 0, io.EOF)
+	readToken := func() ([]byte, error) {
+		tok, err := next()
+		if err != nil {
+			return nil, err
+		}
+		return buf[:copy(buf[:], tok)], nil
+	}
+
+	p := NewUnwrapPipeline(&seqMech{}, readToken, 4)
+	defer p.Close()
+
+	// let the pipeline read ahead, and keep every message
+	time.Sleep(time.Millisecond * 20)
+	var msgs [][]byte
+	for i := 0; i < 8; i++ {
+		msg, _, err := p.Next()
+		require.NoError(t, err)
+		msgs = append(msgs, msg)
+	}
+
+	for i, msg := range msgs {
+		assert.Equal(t, []byte{'m', byte('0' + i)}, msg)
+	}
+}
+
+func TestUnwrapPipelineUnwrapError(t *testing.T) {
+	tokens := seqTokens(6)
+	tokens[3][0] = 9
+
+	p := NewUnwrapPipeline(&seqMech{}, tokenSource(tokens, 0, io.EOF), 2)
+	defer p.Close()
+
+	for i := 0; i < 3; i++ {
+		_, _, err := p.Next()
+		require.NoError(t, err)
+	}
+
+	_, _, err := p.Next()
+	assert.EqualError(t, err, "bad sequence number, got 9, wanted 3")
+	_, _, err = p.Next()
+	assert.EqualError(t, err, "bad sequence number, got 9, wanted 3")
+}
+
+func TestUnwrapPipelineClose(t *testing.T) {
+	block := make(chan struct{})
+	defer close(block)
+
+	p := NewUnwrapPipeline(&seqMech{}, func() ([]byte, error) {
+		<-block
+		return nil, io.EOF
+	}, 1)
+
+	go func() {
+		time.Sleep(time.Millisecond * 10)
+		p.Close()
+	}()
+
+	// a waiting Next returns when the pipeline is closed
+	_, _, err := p.Next()
+	assert.Equal(t, ErrPipelineClosed, err)
+	assert.NoError(t, p.Close())
+}
+
+// benchmarkUnwrap receives tokens that each take as long to arrive as
+// they do to unwrap
+func benchmarkUnwrap(b *testing.B, pipelined bool) {
+	const delay = time.Millisecond
+	mech := &seqMech{delay: delay}
+	readToken := tokenSource(seqTokens(b.N), delay, io.EOF)
+
+	if !pipelined {
+		for i := 0; i < b.N; i++ {
+			tok, _ := readToken()
+			if _, _, err := mech.Unwrap(tok); err != nil {
+				b.Fatal(err)
+			}
+		}
+		return
+	}
+
+	p := NewUnwrapPipeline(mech, readToken, 8)
+	defer p.Close()
+	for i := 0; i < b.N; i++ {
+		if _, _, err := p.Next(); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkUnwrapSerial(b *testing.B) {
+	benchmarkUnwrap(b, false)
+}
+
+func BenchmarkUnwrapPipeline(b *testing.B) {
+	benchmarkUnwrap(b, true)
+}
@@ -0,0 +1,246 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package gssapi
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"net"
+	"sync"
+	"time"
+)
+
+// MaxTokenSize is the largest token that TokenConn.ReadToken accepts
+var MaxTokenSize = 64 << 20
+
+// ErrTokenConnReleased is returned by the reads and writes of a TokenConn
+// after Release
+var ErrTokenConnReleased = errors.New("gssapi: token connection released")
+
+// TokenConn sends and receives GSS-API tokens on a stream connection, each
+// preceded by its length as a four byte big-endian number.  Its buffers
+// come from a BufferPool, which takes them back once the connection has
+// been idle for the pool's idle period; a connection waiting for its next
+// token holds no buffers at all once that happens, provided that Done was
+// called for the last token it read.
+//
+// One goroutine may read tokens while another writes them.
+type TokenConn struct {
+	conn io.ReadWriter
+	pool *BufferPool
+	hdr  [4]byte // only used by the reader
+
+	mu         sync.Mutex
+	rbuf       []byte
+	wbuf       []byte
+	reading    bool // rbuf is being read into, or holds a token not yet Done
+	writing    bool
+	released   bool
+	lastActive time.Time
+}
+
+// NewTokenConn returns a TokenConn for conn, using buffers from pool or
+// from DefaultBufferPool if pool is nil.  Release must be called when the
+// connection is finished with.
+func NewTokenConn(conn io.ReadWriter, pool *BufferPool) *TokenConn {
+	if pool == nil {
+		pool = DefaultBufferPool()
+	}
+
+	c := &TokenConn{conn: conn, pool: pool, lastActive: time.Now()}
+	pool.register(c)
+
+	return c
+}
+
+// ReadToken reads the next token.  The token is only valid until the next
+// call to ReadToken, Done or Release.
+func (c *TokenConn) ReadToken() ([]byte, error) {
+	if c.isReleased() {
+		return nil, ErrTokenConnReleased
+	}
+
+	if _, err := io.ReadFull(c.conn, c.hdr[:]); err != nil {
+		return nil, err
+	}
+
+	n := int(binary.BigEndian.Uint32(c.hdr[:]))
+	if n > MaxTokenSize {
+		return nil, fmt.Errorf("gssapi: %d byte token is larger than the limit of %d", n, MaxTokenSize)
+	}
+
+	c.mu.Lock()
+	if c.released {
+		c.mu.Unlock()
+		return nil, ErrTokenConnReleased
+	}
+	if c.reading && cap(c.rbuf) < n {
+		// the caller may still hold the last token, so its buffer must
+		// not go to another connection
+		c.pool.forget(c.rbuf)
+		c.rbuf = nil
+	}
+	c.reading = true
+	c.rbuf = c.ensure(c.rbuf, n)
+	buf := c.rbuf[:n]
+	c.mu.Unlock()
+
+	_, err := io.ReadFull(c.conn, buf)
+
+	c.mu.Lock()
+	c.lastActive = time.Now()
+	if err != nil {
+		c.reading = false
+	}
+	if c.released {
+		// Release dropped the buffer while we were reading into it
+		err = ErrTokenConnReleased
+	}
+	c.mu.Unlock()
+
+	if err != nil {
+		return nil, err
+	}
+
+	return buf, nil
+}
+
+// Done tells the connection that the token last returned by ReadToken is
+// finished with, so that its buffer may go back to the pool while the
+// connection is idle.  Until then the buffer is only ever reused by this
+// connection.
+func (c *TokenConn) Done() {
+	c.mu.Lock()
+	c.reading = false
+	c.mu.Unlock()
+}
+
+// WriteToken writes a token with its length.  On a TCP or Unix domain
+// socket the two go in a single system call.
+func (c *TokenConn) WriteToken(token []byte) error {
+	n := 4 + len(token)
+
+	// very large tokens are written directly rather than copied
+	if n > 1<<maxBufferShift {
+		if c.isReleased() {
+			return ErrTokenConnReleased
+		}
+
+		var hdr [4]byte
+		binary.BigEndian.PutUint32(hdr[:], uint32(len(token)))
+		bufs := net.Buffers{hdr[:], token}
+		_, err := bufs.WriteTo(c.conn)
+		c.touch()
+		return err
+	}
+
+	c.mu.Lock()
+	if c.released {
+		c.mu.Unlock()
+		return ErrTokenConnReleased
+	}
+	c.writing = true
+	c.wbuf = c.ensure(c.wbuf, n)
+	buf := c.wbuf[:n]
+	c.mu.Unlock()
+
+	binary.BigEndian.PutUint32(buf, uint32(len(token)))
+	copy(buf[4:], token)
+	_, err := c.conn.Write(buf)
+
+	c.mu.Lock()
+	c.writing = false
+	c.lastActive = time.Now()
+	c.mu.Unlock()
+
+	return err
+}
+
+// Release gives the connection's buffers back to the pool for good; after
+// it, ReadToken and WriteToken return ErrTokenConnReleased.  A buffer that
+// a read or write on another goroutine is still using, or that holds a
+// token not yet Done, is left to the garbage collector rather than pooled.
+// Release does not close the underlying connection.
+func (c *TokenConn) Release() {
+	c.pool.unregister(c)
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	if c.released {
+		return
+	}
+	c.released = true
+
+	if c.rbuf != nil {
+		if c.reading {
+			c.pool.forget(c.rbuf)
+		} else {
+			c.pool.put(c.rbuf)
+		}
+		c.rbuf = nil
+	}
+	if c.wbuf != nil {
+		if c.writing {
+			c.pool.forget(c.wbuf)
+		} else {
+			c.pool.put(c.wbuf)
+		}
+		c.wbuf = nil
+	}
+}
+
+func (c *TokenConn) isReleased() bool {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	return c.released
+}
+
+func (c *TokenConn) touch() {
+	c.mu.Lock()
+	c.lastActive = time.Now()
+	c.mu.Unlock()
+}
+
+// ensure returns buf if it can hold n bytes, or else swaps it for a pool
+// buffer that can; c.mu must be held
+func (c *TokenConn) ensure(buf []byte, n int) []byte {
+	if cap(buf) >= n {
+		return buf
+	}
+
+	if buf != nil {
+		c.pool.put(buf)
+	}
+	return c.pool.get(n)
+}
+
+// reclaim returns the buffers that are not in use to the pool if the
+// connection has not been active since deadline, and reports how many
+// buffers it returned
+func (c *TokenConn) reclaim(deadline time.Time) (n int) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	if c.lastActive.After(deadline) {
+		return 0
+	}
+
+	if c.rbuf != nil && !c.reading {
+		c.pool.put(c.rbuf)
+		c.rbuf = nil
+		n++
+	}
+	if c.wbuf != nil && !c.writing {
+		c.pool.put(c.wbuf)
+		c.wbuf = nil
+		n++
+	}
+
+	return n
+}
@@ -0,0 +1,213 @@
+// Copyright 2021 Jake Scott. All rights reserved.
+// Use of this source code is governed by the Apache License
+// version 2.0 that can be found in the LICENSE file.
+
+package gssapi
+
+import (
+	"bytes"
+	"net"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestTokenConn(t *testing.T) {
+	pool := NewBufferPool(time.Hour, 1<<20)
+	defer pool.Close()
+
+	var wire bytes.Buffer
+	c := NewTokenConn(&wire, pool)
+
+	tokens := [][]byte{[]byte("first"), {}, bytes.Repeat([]byte{0xa5}, 5000)}
+	for _, tok := range tokens {
+		require.NoError(t, c.WriteToken(tok))
+	}
+	assert.Equal(t, []byte{0, 0, 0, 5, 'f', 'i', 'r', 's', 't'}, wire.Bytes()[:9])
+
+	for _, tok := range tokens {
+		got, err := c.ReadToken()
+		require.NoError(t, err)
+		assert.Equal(t, tok, got)
+	}
+
+	// both buffers are held, sized for the largest token
+	st := pool.Stats()
+	assert.Equal(t, 1, st.Connections)
+	assert.Equal(t, int64(2*8192), st.Held)
+
+	c.Done()
+	c.Release()
+	st = pool.Stats()
+	// the 512 byte buffer that the writer outgrew went to the reader, which
+	// outgrew it in turn while the caller might still have held a token in
+	// it, so it was dropped rather than pooled
+	assert.Equal(t, BufferStats{Held: 0, Pooled: 2 * 8192}, st)
+}
+
+func TestTokenConnLarge(t *testing.T) {
+	pool := NewBufferPool(time.Hour, 1<<20)
+	defer pool.Close()
+
+	// too large to pool, so written straight from the caller's slice
+	var wire bytes.Buffer
+	c := NewTokenConn(&wire, pool)
+	defer c.Release()
+
+	tok := bytes.Repeat([]byte{0x5a}, 1<<maxBufferShift)
+	require.NoError(t, c.WriteToken(tok))
+	assert.Equal(t, 4+len(tok), wire.Len())
+
+	got, err := c.ReadToken()
+	require.NoError(t, err)
+	assert.Equal(t, tok, got)
+}
+
+func TestTokenConnTooLarge(t *testing.T) {
+	pool := NewBufferPool(time.Hour, 0)
+	defer pool.Close()
+
+	wire := bytes.NewBuffer([]byte{0xff, 0xff, 0xff, 0xff})
+	c := NewTokenConn(wire, pool)
+	defer c.Release()
+
+	_, err := c.ReadToken()
+	assert.Error(t, err)
+	assert.Equal(t, int64(0), pool.Stats().Held)
+}
+
+func TestTokenConnNotDone(t *testing.T) {
+	pool := NewBufferPool(time.Millisecond*20, 1<<20)
+	defer pool.Close()
+
+	wire := bytes.NewBuffer([]byte{0, 0, 0, 5, 'h', 'e', 'l', 'l', 'o'})
+	c := NewTokenConn(wire, pool)
+	defer c.Release()
+
+	tok, err := c.ReadToken()
+	require.NoError(t, err)
+
+	// the token stays in its buffer until Done, however long it is held
+	time.Sleep(time.Millisecond * 100)
+	assert.Equal(t, []byte("hello"), tok)
+	assert.Equal(t, int64(512), pool.Stats().Held)
+
+	c.Done()
+	assert.Eventually(t, func() bool {
+		return pool.Stats().Held == 0
+	}, time.Second*5, time.Millisecond*5)
+}
+
+func TestTokenConnShortRead(t *testing.T) {
+	pool := NewBufferPool(time.Millisecond*20, 1<<20)
+	defer pool.Close()
+
+	// the connection fails part way through the token
+	wire := bytes.NewBuffer([]byte{0, 0, 0, 5, 'h', 'e'})
+	c := NewTokenConn(wire, pool)
+	defer c.Release()
+
+	_, err := c.ReadToken()
+	assert.Error(t, err)
+
+	// and its buffer is reclaimed without Done
+	assert.Eventually(t, func() bool {
+		return pool.Stats().Held == 0
+	}, time.Second*5, time.Millisecond*5)
+}
+
+func TestTokenConnRelease(t *testing.T) {
+	pool := NewBufferPool(time.Hour, 1<<20)
+	defer pool.Close()
+
+	client, server := net.Pipe()
+	defer client.Close()
+	defer server.Close()
+
+	sc := NewTokenConn(server, pool)
+
+	type result struct {
+		tok []byte
+		err error
+	}
+	read := make(chan result)
+	go func() {
+		tok, err := sc.ReadToken()
+		read <- result{tok, err}
+	}()
+
+	// the reader is blocked part way through a token
+	_, err := client.Write([]byte{0, 0, 0, 5, 'h', 'e'})
+	require.NoError(t, err)
+	assert.Eventually(t, func() bool {
+		return pool.Stats().Held == 512
+	}, time.Second*5, time.Millisecond*5)
+
+	// so its buffer is dropped rather than pooled for another connection
+	sc.Release()
+	assert.Equal(t, BufferStats{}, pool.Stats())
+
+	_, err = client.Write([]byte{'l', 'l', 'o'})
+	require.NoError(t, err)
+	r := <-read
+	assert.Equal(t, ErrTokenConnReleased, r.err)
+	assert.Nil(t, r.tok)
+
+	// and the connection cannot be used again
+	_, err = sc.ReadToken()
+	assert.Equal(t, ErrTokenConnReleased, err)
+	assert.Equal(t, ErrTokenConnReleased, sc.WriteToken([]byte("hello")))
+	assert.Equal(t, BufferStats{}, pool.Stats())
+}
+
+func TestTokenConnIdle(t *testing.T) {
+	pool := NewBufferPool(time.Millisecond*200, 1<<20)
+	defer pool.Close()
+
+	client, server := net.Pipe()
+	defer client.Close()
+
+	sc := NewTokenConn(server, pool)
+	cc := NewTokenConn(client, pool)
+
+	read := make(chan []byte)
+	go func() {
+		defer close(read)
+		for {
+			tok, err := sc.ReadToken()
+			if err != nil {
+				return
+			}
+			read <- append([]byte(nil), tok...)
+			sc.Done()
+		}
+	}()
+
+	require.NoError(t, cc.WriteToken([]byte("hello")))
+	assert.Equal(t, []byte("hello"), <-read)
+	assert.NotZero(t, pool.Stats().Held)
+
+	// idle, with the server waiting for its next token
+	assert.Eventually(t, func() bool {
+		return pool.Stats().Held == 0
+	}, time.Second*5, time.Millisecond*5)
+
+	st := pool.Stats()
+	assert.Equal(t, int64(2*512), st.Pooled)
+	assert.Equal(t, uint64(2), st.Reclaimed)
+
+	// and the buffers come back with the next token
+	require.NoError(t, cc.WriteToken([]byte("again")))
+	assert.Equal(t, []byte("again"), <-read)
+	st = pool.Stats()
+	assert.Equal(t, int64(2*512), st.Held)
+	assert.Equal(t, int64(0), st.Pooled)
+
+	server.Close()
+	<-read
+	sc.Release()
+	cc.Release()
+	assert.Equal(t, int64(0), pool.Stats().Held)
+}